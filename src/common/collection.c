@@ -51,6 +51,81 @@ static const char *comparators[] = {
   "!=", // DT_COLLECTION_RATING_COMP_NE,
 };
 
+/* the columns the collection is ordered by, for every dt_collection_sort_t. id comes last to make the order
+ * unique, which the index relies on. */
+#define DT_COLLECTION_SORT_COLUMNS 4
+
+typedef struct dt_collection_sort_column_t
+{
+  const char *name;
+  gboolean descending[2]; // in ascending and in descending collections
+} dt_collection_sort_column_t;
+
+static const dt_collection_sort_column_t sort_columns[][DT_COLLECTION_SORT_COLUMNS] = {
+  // DT_COLLECTION_SORT_FILENAME
+  { { "filename", { FALSE, TRUE } }, { "version", { FALSE, FALSE } }, { "id", { FALSE, FALSE } } },
+  // DT_COLLECTION_SORT_DATETIME
+  { { "datetime_taken", { FALSE, TRUE } },
+    { "filename", { FALSE, FALSE } },
+    { "version", { FALSE, FALSE } },
+    { "id", { FALSE, FALSE } } },
+  // DT_COLLECTION_SORT_RATING
+  { { "flags & 7", { TRUE, FALSE } },
+    { "filename", { FALSE, FALSE } },
+    { "version", { FALSE, FALSE } },
+    { "id", { FALSE, FALSE } } },
+  // DT_COLLECTION_SORT_ID
+  { { "id", { FALSE, TRUE } } },
+  // DT_COLLECTION_SORT_COLOR
+  { { "color", { TRUE, FALSE } },
+    { "filename", { FALSE, FALSE } },
+    { "version", { FALSE, FALSE } },
+    { "id", { FALSE, FALSE } } },
+  // DT_COLLECTION_SORT_GROUP
+  { { "group_id", { FALSE, TRUE } }, { "id-group_id != 0", { FALSE, FALSE } }, { "id", { FALSE, TRUE } } },
+  // DT_COLLECTION_SORT_PATH
+  { { "folder", { FALSE, TRUE } },
+    { "filename", { FALSE, TRUE } },
+    { "version", { FALSE, FALSE } },
+    { "id", { FALSE, FALSE } } },
+};
+
+/* don't bother with updating more images than that one by one */
+#define DT_COLLECTION_MAX_UPDATE 1000
+
+/* one value of a sort column. they compare like in sqlite: NULL before numbers before text. */
+typedef enum dt_collection_key_type_t
+{
+  DT_COLLECTION_KEY_NULL = 0,
+  DT_COLLECTION_KEY_INT,
+  DT_COLLECTION_KEY_TEXT
+} dt_collection_key_type_t;
+
+typedef struct dt_collection_entry_t
+{
+  int32_t imgid;
+  uint8_t type[DT_COLLECTION_SORT_COLUMNS];
+  union
+  {
+    int64_t i;
+    const gchar *s;
+  } key[DT_COLLECTION_SORT_COLUMNS];
+} dt_collection_entry_t;
+
+typedef struct dt_collection_index_t
+{
+  GPtrArray *entries;    // dt_collection_entry_t in the order of the query
+  GHashTable *imgs;      // imgid -> entry
+  GStringChunk *strings; // text keys, folders are stored only once
+  gchar *where;          // where part of the query, to check single images against
+  dt_collection_sort_t sort;
+  int descending;
+} dt_collection_index_t;
+
+/* (re)builds the index of the collection, returns FALSE if the collection can't have one. */
+static gboolean _dt_collection_index_build(dt_collection_t *collection, const gchar *where);
+static void _dt_collection_index_free(dt_collection_index_t *index);
+
 /* Stores the collection query, returns 1 if changed.. */
 static int _dt_collection_store(const dt_collection_t *collection, gchar *query);
 /* Counts the number of images in the current collection */
@@ -59,6 +134,8 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection);
  * we need 2 different since there are different kinds of signals we need to listen to. */
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data);
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data);
+static void _dt_collection_tag_changed_callback(gpointer instance, gpointer user_data);
+static void _dt_collection_image_import_callback(gpointer instance, guint imgid, gpointer user_data);
 
 /* determine image offset of specified imgid for the given collection */
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid);
@@ -66,6 +143,7 @@ static int dt_collection_image_offset_with_collection(const dt_collection_t *col
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  dt_pthread_mutex_init(&collection->index_lock, NULL);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -83,14 +161,14 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
   /* connect to all the signals that might indicate that the count of images matching the collection changed
    */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_TAG_CHANGED,
-                            G_CALLBACK(_dt_collection_recount_callback_1), collection);
+                            G_CALLBACK(_dt_collection_tag_changed_callback), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
                             G_CALLBACK(_dt_collection_recount_callback_1), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_REMOVED,
                             G_CALLBACK(_dt_collection_recount_callback_1), collection);
 
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_IMAGE_IMPORT,
-                            G_CALLBACK(_dt_collection_recount_callback_2), collection);
+                            G_CALLBACK(_dt_collection_image_import_callback), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED,
                             G_CALLBACK(_dt_collection_recount_callback_2), collection);
 
@@ -103,7 +181,13 @@ void dt_collection_free(const dt_collection_t *collection)
                                (gpointer)collection);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_2),
                                (gpointer)collection);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_tag_changed_callback),
+                               (gpointer)collection);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_image_import_callback),
+                               (gpointer)collection);
 
+  _dt_collection_index_free(collection->index);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&collection->index_lock);
   g_free(collection->query);
   g_free(collection->where_ext);
   g_free((dt_collection_t *)collection);
@@ -200,15 +284,17 @@ int dt_collection_update(const dt_collection_t *collection)
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
   result = _dt_collection_store(collection, query);
 
+  /* update the index or the cached count. collection isn't a real const anyway, we are writing to it in
+   * _dt_collection_store, too. */
+  if(!_dt_collection_index_build((dt_collection_t *)collection, wq))
+    ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection);
+
   /* free memory used */
   g_free(sq);
   g_free(wq);
   g_free(selq);
   g_free(query);
 
-  /* update the cached count. collection isn't a real const anyway, we are writing to it in
-   * _dt_collection_store, too. */
-  ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection);
   dt_collection_hint_message(collection);
 
   return result;
@@ -324,83 +410,18 @@ gboolean dt_collection_get_sort_descending(const dt_collection_t *collection)
 
 gchar *dt_collection_get_sort_query(const dt_collection_t *collection)
 {
-  gchar *sq = NULL;
-
-  if(collection->params.descending)
-  {
-    switch(collection->params.sort)
-    {
-      case DT_COLLECTION_SORT_DATETIME:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "datetime_taken DESC, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_RATING:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "flags & 7, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_FILENAME:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "filename DESC, version");
-        break;
-
-      case DT_COLLECTION_SORT_ID:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "id DESC");
-        break;
-
-      case DT_COLLECTION_SORT_COLOR:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "color, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_GROUP:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "group_id DESC, id-group_id != 0, id DESC");
-        break;
-
-      case DT_COLLECTION_SORT_PATH:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "folder DESC, filename DESC, version");
-        break;
-
-      case DT_COLLECTION_SORT_NONE:
-        // shouldn't happen
-        break;
-    }
-  }
-  else
-  {
-    switch(collection->params.sort)
-    {
-      case DT_COLLECTION_SORT_DATETIME:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "datetime_taken, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_RATING:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "flags & 7 DESC, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_FILENAME:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_ID:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "id");
-        break;
-
-      case DT_COLLECTION_SORT_COLOR:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "color DESC, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_GROUP:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "group_id, id-group_id != 0, id");
-        break;
-
-      case DT_COLLECTION_SORT_PATH:
-        sq = dt_util_dstrcat(sq, ORDER_BY_QUERY, "folder, filename, version");
-        break;
-
-      case DT_COLLECTION_SORT_NONE:
-        // shouldn't happen
-        break;
-    }
-  }
-
+  const dt_collection_sort_t sort = collection->params.sort;
+  // DT_COLLECTION_SORT_NONE shouldn't happen
+  if(sort < DT_COLLECTION_SORT_FILENAME || sort > DT_COLLECTION_SORT_PATH) return NULL;
+
+  gchar *columns = NULL;
+  const int descending = collection->params.descending ? 1 : 0;
+  for(int k = 0; k < DT_COLLECTION_SORT_COLUMNS && sort_columns[sort][k].name; k++)
+    columns = dt_util_dstrcat(columns, "%s%s%s", k ? ", " : "", sort_columns[sort][k].name,
+                              sort_columns[sort][k].descending[descending] ? " DESC" : "");
+
+  gchar *sq = dt_util_dstrcat(NULL, ORDER_BY_QUERY, columns);
+  g_free(columns);
   return sq;
 }
 
@@ -440,6 +461,7 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection)
   else
     count_query = dt_util_dstrcat(count_query, "SELECT COUNT(DISTINCT id) %s", fq);
 
+  // the same connection as the query itself, a reader could see another snapshot during an import
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
   if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
      && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
@@ -454,6 +476,241 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection)
   return count;
 }
 
+/* the query for the index: image ids and the values of the sort columns */
+static gchar *_dt_collection_index_query(const dt_collection_t *collection, const gchar *where)
+{
+  const dt_collection_sort_t sort = collection->params.sort;
+  gchar *columns = NULL;
+  for(int k = 0; k < DT_COLLECTION_SORT_COLUMNS && sort_columns[sort][k].name; k++)
+    columns = dt_util_dstrcat(columns, ", %s", sort_columns[sort][k].name);
+
+  gchar *query = NULL;
+  if(sort == DT_COLLECTION_SORT_PATH)
+    query = dt_util_dstrcat(query, "SELECT DISTINCT id%s FROM (SELECT * FROM main.images WHERE %s) JOIN (SELECT id "
+                                   "AS film_rolls_id, folder FROM main.film_rolls) ON film_id = film_rolls_id",
+                            columns, where);
+  else
+    query = dt_util_dstrcat(query, "SELECT DISTINCT id%s FROM main.images WHERE %s", columns, where);
+  g_free(columns);
+  return query;
+}
+
+static dt_collection_entry_t *_dt_collection_entry_new(dt_collection_index_t *index, sqlite3_stmt *stmt)
+{
+  dt_collection_entry_t *entry = g_malloc0(sizeof(dt_collection_entry_t));
+  entry->imgid = sqlite3_column_int(stmt, 0);
+  for(int k = 0; k < DT_COLLECTION_SORT_COLUMNS && sort_columns[index->sort][k].name; k++)
+  {
+    switch(sqlite3_column_type(stmt, k + 1))
+    {
+      case SQLITE_NULL:
+        entry->type[k] = DT_COLLECTION_KEY_NULL;
+        break;
+      case SQLITE_INTEGER:
+      case SQLITE_FLOAT:
+        entry->type[k] = DT_COLLECTION_KEY_INT;
+        entry->key[k].i = sqlite3_column_int64(stmt, k + 1);
+        break;
+      default:
+        entry->type[k] = DT_COLLECTION_KEY_TEXT;
+        entry->key[k].s = g_string_chunk_insert_const(index->strings, (const char *)sqlite3_column_text(stmt, k + 1));
+        break;
+    }
+  }
+  return entry;
+}
+
+/* compares like the ORDER BY of the query */
+static int _dt_collection_entry_cmp(const dt_collection_index_t *index, const dt_collection_entry_t *a,
+                                    const dt_collection_entry_t *b)
+{
+  for(int k = 0; k < DT_COLLECTION_SORT_COLUMNS && sort_columns[index->sort][k].name; k++)
+  {
+    int c = a->type[k] - b->type[k];
+    if(!c && a->type[k] == DT_COLLECTION_KEY_INT)
+      c = (a->key[k].i > b->key[k].i) - (a->key[k].i < b->key[k].i);
+    else if(!c && a->type[k] == DT_COLLECTION_KEY_TEXT)
+      c = strcmp(a->key[k].s, b->key[k].s);
+    if(c) return sort_columns[index->sort][k].descending[index->descending] ? -c : c;
+  }
+  return 0;
+}
+
+/* position of the first entry not before entry */
+static guint _dt_collection_index_lower_bound(const dt_collection_index_t *index, const dt_collection_entry_t *entry)
+{
+  guint lo = 0, hi = index->entries->len;
+  while(lo < hi)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(_dt_collection_entry_cmp(index, g_ptr_array_index(index->entries, mid), entry) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void _dt_collection_index_free(dt_collection_index_t *index)
+{
+  if(!index) return;
+  g_ptr_array_free(index->entries, TRUE);
+  g_hash_table_destroy(index->imgs);
+  g_string_chunk_free(index->strings);
+  g_free(index->where);
+  g_free(index);
+}
+
+static gboolean _dt_collection_index_build(dt_collection_t *collection, const gchar *where)
+{
+  // the colour labels are joined in, which gives several rows per image. and we can't mirror arbitrary queries.
+  const uint32_t flags = collection->params.query_flags;
+  const dt_collection_sort_t sort = collection->params.sort;
+  dt_collection_index_t *index = NULL;
+  if(!collection->clone && (flags & COLLECTION_QUERY_USE_SORT) && !(flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+     && sort >= DT_COLLECTION_SORT_FILENAME && sort <= DT_COLLECTION_SORT_PATH && sort != DT_COLLECTION_SORT_COLOR)
+  {
+    index = g_malloc0(sizeof(dt_collection_index_t));
+    index->entries = g_ptr_array_new_with_free_func(g_free);
+    index->imgs = g_hash_table_new(NULL, NULL);
+    index->strings = g_string_chunk_new(1 << 16);
+    index->where = g_strdup(where);
+    index->sort = sort;
+    index->descending = collection->params.descending ? 1 : 0;
+
+    gchar *sq = dt_collection_get_sort_query(collection);
+    gchar *query = _dt_collection_index_query(collection, where);
+    query = dt_util_dstrcat(query, " %s", sq);
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      dt_collection_entry_t *entry = _dt_collection_entry_new(index, stmt);
+      g_ptr_array_add(index->entries, entry);
+      g_hash_table_insert(index->imgs, GINT_TO_POINTER(entry->imgid), entry);
+    }
+    sqlite3_finalize(stmt);
+    g_free(query);
+    g_free(sq);
+  }
+
+  dt_pthread_mutex_lock(&collection->index_lock);
+  dt_collection_index_t *old = collection->index;
+  collection->index = index;
+  if(index) collection->count = index->entries->len;
+  dt_pthread_mutex_unlock(&collection->index_lock);
+  _dt_collection_index_free(old);
+
+  return index != NULL;
+}
+
+void dt_collection_update_images(const dt_collection_t *collection, const int imgid)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  GList *imgs = NULL;
+  int num = 0;
+  if(imgid > 0)
+  {
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(imgid));
+    num = 1;
+  }
+  else
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images LIMIT ?1",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, DT_COLLECTION_MAX_UPDATE + 1);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+      num++;
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  dt_pthread_mutex_lock(&c->index_lock);
+  dt_collection_index_t *index = c->index;
+  if(!index || num > DT_COLLECTION_MAX_UPDATE)
+  {
+    dt_pthread_mutex_unlock(&c->index_lock);
+    g_list_free(imgs);
+    dt_collection_update_query(collection);
+    return;
+  }
+
+  // sort keys of the images which are in the collection now
+  gchar *ids = NULL;
+  for(GList *iter = imgs; iter; iter = g_list_next(iter))
+    ids = dt_util_dstrcat(ids, "%s%d", iter == imgs ? "" : ",", GPOINTER_TO_INT(iter->data));
+  gchar *where = g_strdup_printf("(%s) AND id IN (%s)", index->where, ids);
+  gchar *query = _dt_collection_index_query(collection, where);
+  GHashTable *current = g_hash_table_new(NULL, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_collection_entry_t *entry = _dt_collection_entry_new(index, stmt);
+    g_hash_table_insert(current, GINT_TO_POINTER(entry->imgid), entry);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(where);
+  g_free(ids);
+
+  // move them to their new place, if any
+  gboolean changed = FALSE;
+  GList *gone = NULL;
+  for(GList *iter = imgs; iter; iter = g_list_next(iter))
+  {
+    dt_collection_entry_t *old = g_hash_table_lookup(index->imgs, iter->data);
+    dt_collection_entry_t *entry = g_hash_table_lookup(current, iter->data);
+    if(old && entry && !_dt_collection_entry_cmp(index, old, entry))
+    {
+      g_free(entry);
+      continue;
+    }
+    gint64 pos = -1;
+    if(old)
+    {
+      pos = _dt_collection_index_lower_bound(index, old);
+      g_hash_table_remove(index->imgs, iter->data);
+      g_ptr_array_remove_index(index->entries, pos);
+    }
+    if(entry)
+    {
+      const guint new_pos = _dt_collection_index_lower_bound(index, entry);
+      g_ptr_array_insert(index->entries, new_pos, entry);
+      g_hash_table_insert(index->imgs, iter->data, entry);
+      if(new_pos != pos) changed = TRUE;
+    }
+    else if(old)
+    {
+      gone = g_list_prepend(gone, iter->data);
+      changed = TRUE;
+    }
+  }
+  c->count = index->entries->len;
+  dt_pthread_mutex_unlock(&c->index_lock);
+  g_hash_table_destroy(current);
+  g_list_free(imgs);
+
+  // images which left the collection can't stay selected
+  for(GList *iter = gone; iter; iter = g_list_next(iter))
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.selected_images WHERE imgid = ?1",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(iter->data));
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+  g_list_free(gone);
+
+  dt_collection_hint_message(collection);
+
+  /* only if the images in the view are different now */
+  if(changed && !collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+}
+
 uint32_t dt_collection_get_count(const dt_collection_t *collection)
 {
   return collection->count;
@@ -519,6 +776,19 @@ int dt_collection_get_nth(const dt_collection_t *collection, int nth)
 {
   if(nth < 0 || nth >= dt_collection_get_count(collection))
     return -1;
+
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->index_lock);
+  if(c->index)
+  {
+    const int imgid = nth < c->index->entries->len
+                          ? ((dt_collection_entry_t *)g_ptr_array_index(c->index->entries, nth))->imgid
+                          : -1;
+    dt_pthread_mutex_unlock(&c->index_lock);
+    return imgid;
+  }
+  dt_pthread_mutex_unlock(&c->index_lock);
+
   const gchar *query = dt_collection_get_query(collection);
   sqlite3_stmt *stmt = NULL;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
@@ -905,10 +1175,24 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
       }
       break;
     case DT_COLLECTION_PROP_TAG: // tag
-      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
-                              escaped_text);
-      break;
+    {
+      // a whole branch of the hierarchy, "a|b|%" as the collect module has it, comes from the closure table
+      // which the tag index keeps. everything else is matched with LIKE on the names.
+      const size_t len = strlen(escaped_text);
+      if(len > 2 && g_str_has_suffix(escaped_text, "|%") && strcspn(escaped_text, "%_") == len - 1)
+      {
+        gchar *ancestor = g_ascii_strdown(escaped_text, len - 2);
+        query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                       "(SELECT id FROM memory.tag_closure WHERE ancestor = '%s')))",
+                                ancestor);
+        g_free(ancestor);
+      }
+      else
+        query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
+                                       "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
+                                escaped_text);
+    }
+    break;
 
     // TODO: How to handle images without metadata? In the moment they are not shown.
     // TODO: Autogenerate this code?
@@ -1255,8 +1539,20 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid)
 {
-  const gchar *qin = dt_collection_get_query(collection);
   int offset = 0;
+
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->index_lock);
+  if(c->index)
+  {
+    const dt_collection_entry_t *entry = g_hash_table_lookup(c->index->imgs, GINT_TO_POINTER(imgid));
+    if(entry) offset = _dt_collection_index_lower_bound(c->index, entry);
+    dt_pthread_mutex_unlock(&c->index_lock);
+    return offset;
+  }
+  dt_pthread_mutex_unlock(&c->index_lock);
+
+  const gchar *qin = dt_collection_get_query(collection);
   sqlite3_stmt *stmt;
 
   if(qin)
@@ -1295,11 +1591,22 @@ int dt_collection_image_offset(int imgid)
   return dt_collection_image_offset_with_collection(darktable.collection, imgid);
 }
 
+/* counts the collection again, or rebuilds its index */
+static void _dt_collection_recount(dt_collection_t *collection)
+{
+  dt_pthread_mutex_lock(&collection->index_lock);
+  gchar *where = collection->index ? g_strdup(collection->index->where) : NULL;
+  dt_pthread_mutex_unlock(&collection->index_lock);
+  if(!where || !_dt_collection_index_build(collection, where))
+    collection->count = _dt_collection_compute_count(collection);
+  g_free(where);
+}
+
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
   int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection);
+  _dt_collection_recount(collection);
   if(!collection->clone)
   {
     if(old_count != collection->count) dt_collection_hint_message(collection);
@@ -1311,7 +1618,7 @@ static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpo
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
   int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection);
+  _dt_collection_recount(collection);
   if(!collection->clone)
   {
     if(old_count != collection->count) dt_collection_hint_message(collection);
@@ -1319,6 +1626,30 @@ static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpo
   }
 }
 
+static void _dt_collection_tag_changed_callback(gpointer instance, gpointer user_data)
+{
+  dt_collection_t *collection = (dt_collection_t *)user_data;
+  // if the query doesn't look at tags, no image can have moved in or out of it
+  // (attaching and detaching tags updates the collection on its own).
+  dt_pthread_mutex_lock(&collection->index_lock);
+  const gboolean skip = collection->index && !strstr(collection->index->where, "tagged_images");
+  dt_pthread_mutex_unlock(&collection->index_lock);
+  if(skip) return;
+  _dt_collection_recount_callback_1(instance, user_data);
+}
+
+static void _dt_collection_image_import_callback(gpointer instance, guint imgid, gpointer user_data)
+{
+  dt_collection_t *collection = (dt_collection_t *)user_data;
+  dt_pthread_mutex_lock(&collection->index_lock);
+  const gboolean indexed = collection->index != NULL;
+  dt_pthread_mutex_unlock(&collection->index_lock);
+  if(indexed)
+    dt_collection_update_images(collection, imgid);
+  else
+    _dt_collection_recount_callback_2(instance, 0, user_data);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
+
 #include <glib.h>
 #include <inttypes.h>
 
@@ -131,6 +133,12 @@ typedef struct dt_collection_t
   unsigned int count;
   dt_collection_params_t params;
   dt_collection_params_t store;
+
+  /** the images of the collection in sort order, kept up to date with dt_collection_update_images() so that
+   * changing a few images doesn't mean running the whole query again. NULL for clones and for queries we
+   * can't mirror. */
+  struct dt_collection_index_t *index;
+  dt_pthread_mutex_t index_lock;
 } dt_collection_t;
 
 
@@ -197,6 +205,9 @@ uint32_t dt_collection_get_selected_count(const dt_collection_t *collection);
 
 /** update query by conf vars */
 void dt_collection_update_query(const dt_collection_t *collection);
+/** the image (or the selected images, if imgid <= 0) changed in a way that might move it in or out of the
+ * collection, or change its position. only looks at these images, unless the collection has no index. */
+void dt_collection_update_images(const dt_collection_t *collection, const int imgid);
 
 /** updates the hint message for collection */
 void dt_collection_hint_message(const dt_collection_t *collection);
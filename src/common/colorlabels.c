@@ -40,33 +40,31 @@ void dt_colorlabels_remove_labels_selection()
 void dt_colorlabels_remove_labels(const int imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.color_labels WHERE imgid=?1", -1,
-                              &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db, "DELETE FROM main.color_labels WHERE imgid=?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 }
 
 void dt_colorlabels_set_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 }
 
 void dt_colorlabels_remove_label(const int imgid, const int color)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db, "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 }
 
 void dt_colorlabels_toggle_label_selection(const int color)
@@ -111,30 +109,29 @@ void dt_colorlabels_toggle_label(const int imgid, const int color)
 {
   if(imgid <= 0) return;
   sqlite3_stmt *stmt, *stmt2;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmt2, NULL);
+    stmt2 = dt_database_get_statement(darktable.db,
+                                      "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2");
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_statement(darktable.db, stmt2);
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmt2, NULL);
+    stmt2 = dt_database_get_statement(darktable.db,
+                                      "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, color);
     sqlite3_step(stmt2);
-    sqlite3_finalize(stmt2);
+    dt_database_release_statement(darktable.db, stmt2);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   dt_collection_hint_message(darktable.collection);
 }
@@ -143,19 +140,18 @@ int dt_colorlabels_check_label(const int imgid, const int color)
 {
   if(imgid <= 0) return 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT * FROM main.color_labels WHERE imgid=?1 AND color=?2 LIMIT 1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return 1;
   }
   else
   {
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return 0;
   }
 }
@@ -46,6 +46,8 @@
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
+#include "common/sidecar_writer.h"
+#include "common/tags.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
@@ -851,15 +853,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
-  // Make sure that the database and xmp files are in sync
-  // We need conf and db to be up and running for that which is the case here.
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-  {
-    changed_xmp_files = dt_control_crawler_run();
-  }
-
   // FIXME: move there into dt_database_t
   dt_pthread_mutex_init(&(darktable.db_insert), NULL);
   dt_pthread_mutex_init(&(darktable.plugin_threadsafe), NULL);
@@ -918,6 +911,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
 
+  darktable.sidecar_writer = (dt_sidecar_writer_t *)calloc(1, sizeof(dt_sidecar_writer_t));
+  dt_sidecar_writer_init(darktable.sidecar_writer);
+
+  darktable.tag_index = (dt_tag_index_t *)calloc(1, sizeof(dt_tag_index_t));
+  dt_tag_index_init(darktable.tag_index);
+
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
@@ -1037,11 +1036,14 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   if(init_gui) dt_ctl_switch_mode_to(mode);
 
-  // last but not least construct the popup that asks the user about images whose xmp files are newer than the
-  // db entry
-  if(init_gui && changed_xmp_files)
+  // last but not least make sure that the database and xmp files are in sync. that runs in the background and
+  // asks the user about images whose xmp files are newer than the db entry when it finds some.
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui)
   {
-    dt_control_crawler_show_image_list(changed_xmp_files);
+    darktable.crawler = (dt_control_crawler_t *)calloc(1, sizeof(dt_control_crawler_t));
+    dt_control_crawler_init(darktable.crawler);
+    dt_control_crawler_start(darktable.crawler);
   }
 
   return 0;
@@ -1065,6 +1067,10 @@ void dt_cleanup()
 
     dt_control_shutdown(darktable.control);
 
+    dt_control_crawler_cleanup(darktable.crawler);
+    free(darktable.crawler);
+    darktable.crawler = NULL;
+
     dt_lib_cleanup(darktable.lib);
     free(darktable.lib);
   }
@@ -1079,6 +1085,13 @@ void dt_cleanup()
     free(darktable.imageio);
     free(darktable.gui);
   }
+  // writes what's still queued, so it needs the image cache
+  dt_sidecar_writer_cleanup(darktable.sidecar_writer);
+  free(darktable.sidecar_writer);
+  darktable.sidecar_writer = NULL;
+  dt_tag_index_cleanup(darktable.tag_index);
+  free(darktable.tag_index);
+  darktable.tag_index = NULL;
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
@@ -37,7 +37,7 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 15
+#define CURRENT_DATABASE_VERSION_LIBRARY 18
 #define CURRENT_DATABASE_VERSION_DATA 1
 
 typedef struct dt_database_t
@@ -54,8 +54,36 @@ typedef struct dt_database_t
   sqlite3 *handle;
 
   gchar *error_message, *error_dbfilename;
+
+  /* statements slower than profile_threshold seconds, waiting to have their query plan logged. sqlite doesn't
+   * want us to run statements from the profile callback, so that happens in dt_database_get(). */
+  double profile_threshold;
+  dt_pthread_mutex_t profile_mutex;
+  GList *slow_queries;
+  gboolean explaining;
+
+  /* prepared statements which aren't in use right now, a GSList of them per sql text. */
+  GHashTable *statements;
+  dt_pthread_mutex_t statements_mutex;
+
+  /* with the write-ahead log, read only connections for background jobs. readers holds the idle ones,
+   * num_readers counts all we tried to open. */
+  gboolean wal;
+  GSList *readers;
+  int num_readers;
+  dt_pthread_mutex_t readers_mutex;
+
+  /* only one thread at a time may have a transaction open on the main handle, else the second BEGIN fails
+   * and its statements end up in someone else's transaction. */
+  dt_pthread_mutex_t transaction_mutex;
 } dt_database_t;
 
+typedef struct dt_database_slow_query_t
+{
+  gchar *sql;
+  double time;
+} dt_database_slow_query_t;
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
@@ -967,6 +995,47 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
 
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 15;
+  }
+  else if(version == 15)
+  {
+    // 15 -> 16 remember where the embedded jpeg previews are, so we don't have to look again
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    TRY_EXEC("CREATE TABLE main.embedded_previews (imgid INTEGER PRIMARY KEY, file_size INTEGER, "
+             "jpeg_offset INTEGER, jpeg_length INTEGER)",
+             "[init] can't create `embedded_previews' table\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 16;
+  }
+  else if(version == 16)
+  {
+    // 16 -> 17 indexes for what the collect module filters and lists by. the ones on tagged_images,
+    // color_labels and meta_data cover the sub-queries of the collection rules, so they don't touch the tables.
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    TRY_EXEC("CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)",
+             "[init] can't create index `images_datetime_taken_index'\n");
+    TRY_EXEC("CREATE INDEX main.images_maker_model_index ON images (maker, model)",
+             "[init] can't create index `images_maker_model_index'\n");
+    TRY_EXEC("DROP INDEX main.tagged_images_tagid_index",
+             "[init] can't drop index `tagged_images_tagid_index'\n");
+    TRY_EXEC("CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create index `tagged_images_tagid_index'\n");
+    TRY_EXEC("CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)",
+             "[init] can't create index `color_labels_color_index'\n");
+    TRY_EXEC("CREATE INDEX main.metadata_key_index ON meta_data (key, value, id)",
+             "[init] can't create index `metadata_key_index'\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    // give the planner something to choose between the indexes with
+    sqlite3_exec(db->handle, "ANALYZE main", NULL, NULL, NULL);
+    new_version = 17;
+  }
+  else if(version == 17)
+  {
+    // 17 -> 18 remember the mtime of film roll folders, so the crawler can skip the ones that didn't change
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    TRY_EXEC("ALTER TABLE main.film_rolls ADD COLUMN crawl_timestamp INTEGER",
+             "[init] can't add `crawl_timestamp' column to film_rolls table in database\n");
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 18;
   } // maybe in the future, see commented out code elsewhere
     //   else if(version == XXX)
     //   {
@@ -1049,6 +1118,228 @@ static gboolean _upgrade_data_schema(dt_database_t *db, int version)
   return TRUE;
 }
 
+/* remembers statements which took longer than the threshold. runs inside sqlite, so no sql here. */
+static void _database_profile(void *data, const char *sql, sqlite3_uint64 ns)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  const double time = ns * 1e-9;
+  if(time < db->profile_threshold) return;
+
+  dt_pthread_mutex_lock(&db->profile_mutex);
+  // the query plans we run ourselves don't count
+  if(!db->explaining)
+  {
+    dt_database_slow_query_t *q = g_malloc(sizeof(dt_database_slow_query_t));
+    q->sql = g_strdup(sql);
+    q->time = time;
+    db->slow_queries = g_list_append(db->slow_queries, q);
+  }
+  dt_pthread_mutex_unlock(&db->profile_mutex);
+}
+
+/* logs the slow statements we collected so far, together with their query plan */
+static void _database_explain_slow_queries(dt_database_t *db)
+{
+  dt_pthread_mutex_lock(&db->profile_mutex);
+  if(db->explaining)
+  {
+    dt_pthread_mutex_unlock(&db->profile_mutex);
+    return;
+  }
+  GList *queries = db->slow_queries;
+  db->slow_queries = NULL;
+  db->explaining = TRUE;
+  dt_pthread_mutex_unlock(&db->profile_mutex);
+
+  for(GList *iter = queries; iter; iter = g_list_next(iter))
+  {
+    dt_database_slow_query_t *q = (dt_database_slow_query_t *)iter->data;
+    dt_print(DT_DEBUG_PERF, "[sql] %.3f secs for \"%s\"\n", q->time, q->sql);
+    gchar *explain = g_strdup_printf("EXPLAIN QUERY PLAN %s", q->sql);
+    sqlite3_stmt *stmt;
+    if(sqlite3_prepare_v2(db->handle, explain, -1, &stmt, NULL) == SQLITE_OK)
+    {
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+        dt_print(DT_DEBUG_PERF, "[sql]   %d %d %d %s\n", sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+                 sqlite3_column_int(stmt, 2), (const char *)sqlite3_column_text(stmt, 3));
+    }
+    sqlite3_finalize(stmt);
+    g_free(explain);
+    g_free(q->sql);
+    g_free(q);
+  }
+  g_list_free(queries);
+
+  dt_pthread_mutex_lock(&db->profile_mutex);
+  db->explaining = FALSE;
+  dt_pthread_mutex_unlock(&db->profile_mutex);
+}
+
+/* how many idle statements we keep for the same sql. more than one are only needed when several threads run
+ * it at the same time, or a caller nests it. */
+#define DT_DATABASE_MAX_IDLE_STATEMENTS 4
+
+static void _database_free_statements(gpointer data)
+{
+  g_slist_free_full((GSList *)data, (GDestroyNotify)sqlite3_finalize);
+}
+
+sqlite3_stmt *dt_database_get_statement(const dt_database_t *db, const char *sql)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3_stmt *stmt = NULL;
+
+  dt_pthread_mutex_lock(&d->statements_mutex);
+  GSList *idle = (GSList *)g_hash_table_lookup(d->statements, sql);
+  if(idle)
+  {
+    stmt = (sqlite3_stmt *)idle->data;
+    g_hash_table_steal(d->statements, sql);
+    idle = g_slist_delete_link(idle, idle);
+    if(idle) g_hash_table_insert(d->statements, (gpointer)sqlite3_sql(idle->data), idle);
+  }
+  dt_pthread_mutex_unlock(&d->statements_mutex);
+
+  if(!stmt)
+  {
+    dt_print(DT_DEBUG_SQL, "[sql] caching statement \"%s\"\n", sql);
+    if(sqlite3_prepare_v2(dt_database_get(db), sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+      fprintf(stderr, "[sql] could not prepare \"%s\": %s\n", sql, sqlite3_errmsg(d->handle));
+      sqlite3_finalize(stmt);
+      return NULL;
+    }
+  }
+  return stmt;
+}
+
+void dt_database_release_statement(const dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  // the key is owned by the first statement in the list, so it has to stay the first one
+  const char *sql = sqlite3_sql(stmt);
+  dt_pthread_mutex_lock(&d->statements_mutex);
+  GSList *idle = (GSList *)g_hash_table_lookup(d->statements, sql);
+  if(g_slist_length(idle) >= DT_DATABASE_MAX_IDLE_STATEMENTS)
+  {
+    dt_pthread_mutex_unlock(&d->statements_mutex);
+    sqlite3_finalize(stmt);
+    return;
+  }
+  if(idle)
+    idle->next = g_slist_prepend(idle->next, stmt);
+  else
+    g_hash_table_insert(d->statements, (gpointer)sql, g_slist_prepend(NULL, stmt));
+  dt_pthread_mutex_unlock(&d->statements_mutex);
+}
+
+#define DT_DATABASE_MAX_READERS 4
+
+/* switches all attached databases which can do it to the write-ahead log. returns TRUE if main uses it. */
+static gboolean _database_set_wal(dt_database_t *db)
+{
+  // page_size can't be changed any more once the log is in use
+  sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+  // safe with the log, only the last transactions before a power failure might get lost
+  sqlite3_exec(db->handle, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+
+  gboolean wal = FALSE;
+  sqlite3_stmt *stmt;
+  if(sqlite3_prepare_v2(db->handle, "PRAGMA main.journal_mode", -1, &stmt, NULL) == SQLITE_OK
+     && sqlite3_step(stmt) == SQLITE_ROW)
+    wal = !g_ascii_strcasecmp((const char *)sqlite3_column_text(stmt, 0), "wal");
+  sqlite3_finalize(stmt);
+  return wal;
+}
+
+static sqlite3 *_database_open_reader(dt_database_t *db)
+{
+  sqlite3 *handle = NULL;
+  if(sqlite3_open_v2(db->dbfilename_library, &handle, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+  {
+    fprintf(stderr, "[sql] could not open a reader for `%s': %s\n", db->dbfilename_library,
+            sqlite3_errmsg(handle));
+    sqlite3_close(handle);
+    return NULL;
+  }
+
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(handle, "ATTACH DATABASE ?1 AS data", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, db->dbfilename_data, -1, SQLITE_TRANSIENT);
+  if(rc != SQLITE_OK || sqlite3_step(stmt) != SQLITE_DONE)
+  {
+    fprintf(stderr, "[sql] could not attach `%s' to a reader: %s\n", db->dbfilename_data, sqlite3_errmsg(handle));
+    sqlite3_finalize(stmt);
+    sqlite3_close(handle);
+    return NULL;
+  }
+  sqlite3_finalize(stmt);
+
+  // checkpoints lock the database for a moment, rather wait than fail
+  sqlite3_busy_timeout(handle, 1000);
+  if(darktable.unmuted & DT_DEBUG_PERF) sqlite3_profile(handle, _database_profile, db);
+  dt_print(DT_DEBUG_SQL, "[sql] opened reader %d\n", db->num_readers);
+  return handle;
+}
+
+sqlite3 *dt_database_get_reader(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!d->wal) return dt_database_get(db);
+
+  sqlite3 *handle = NULL;
+  gboolean open = FALSE;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  if(d->readers)
+  {
+    handle = (sqlite3 *)d->readers->data;
+    d->readers = g_slist_delete_link(d->readers, d->readers);
+  }
+  else if(d->num_readers < DT_DATABASE_MAX_READERS)
+  {
+    // a reader which fails to open still counts, so we don't keep trying
+    d->num_readers++;
+    open = TRUE;
+  }
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+
+  if(open) handle = _database_open_reader(d);
+  return handle ? handle : dt_database_get(db);
+}
+
+// nesting depth of the transaction this thread holds, only the outermost one talks to sqlite
+static __thread int _transaction_depth = 0;
+
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(_transaction_depth++ > 0) return;
+  dt_pthread_mutex_lock(&d->transaction_mutex);
+  sqlite3_exec(d->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+}
+
+void dt_database_release_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(_transaction_depth <= 0 || --_transaction_depth > 0) return;
+  sqlite3_exec(d->handle, "COMMIT", NULL, NULL, NULL);
+  dt_pthread_mutex_unlock(&d->transaction_mutex);
+}
+
+void dt_database_release_reader(const dt_database_t *db, sqlite3 *handle)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!handle || handle == d->handle) return;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  d->readers = g_slist_prepend(d->readers, handle);
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+}
+
 /* create the current database schema and set the version in db_info accordingly */
 static void _create_library_schema(dt_database_t *db)
 {
@@ -1068,7 +1359,7 @@ static void _create_library_schema(dt_database_t *db)
                //                        "folder VARCHAR(1024), external_drive VARCHAR(1024))", //
                //                        FIXME: make sure to bump CURRENT_DATABASE_VERSION_LIBRARY and add a
                //                        case to _upgrade_library_schema_step when adding this!
-               "folder VARCHAR(1024) NOT NULL)",
+               "folder VARCHAR(1024) NOT NULL, crawl_timestamp INTEGER)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.film_rolls_folder_index ON film_rolls (folder)", NULL, NULL, NULL);
   ////////////////////////////// images
@@ -1089,6 +1380,9 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE INDEX main.images_group_id_index ON images (group_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_index ON images (film_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_filename_index ON images (filename)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_maker_model_index ON images (maker, model)", NULL, NULL, NULL);
   ////////////////////////////// selected_images
   sqlite3_exec(db->handle, "CREATE TABLE main.selected_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   ////////////////////////////// history
@@ -1107,7 +1401,8 @@ static void _create_library_schema(dt_database_t *db)
   ////////////////////////////// tagged_images
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, "
                            "PRIMARY KEY (imgid, tagid))", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// used_tags
   sqlite3_exec(db->handle, "CREATE TABLE main.used_tags (id INTEGER, name VARCHAR NOT NULL)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.used_tags_idx ON used_tags (id, name)", NULL, NULL, NULL);
@@ -1115,9 +1410,16 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.color_labels_idx ON color_labels (imgid, color)", NULL, NULL,
                NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// meta_data
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index ON meta_data (id, key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_index ON meta_data (key, value, id)", NULL, NULL, NULL);
+  ////////////////////////////// embedded_previews
+  sqlite3_exec(db->handle, "CREATE TABLE main.embedded_previews (imgid INTEGER PRIMARY KEY, file_size INTEGER, "
+                           "jpeg_offset INTEGER, jpeg_length INTEGER)",
+               NULL, NULL, NULL);
 }
 
 /* create the current database schema and set the version in db_info accordingly */
@@ -1172,6 +1474,11 @@ static void _create_memory_schema(dt_database_t *db)
       NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tmp_selection (imgid INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tagq (tmpid INTEGER PRIMARY KEY, id INTEGER)", NULL, NULL, NULL);
+  // every tag below an inner node of the hierarchy, "a|b|c" is listed for "a" and "a|b". see common/tags.c
+  sqlite3_exec(db->handle, "CREATE TABLE memory.tag_closure (ancestor VARCHAR, id INTEGER)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX memory.tag_closure_ancestor_index ON tag_closure (ancestor, id)",
+               NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.taglist "
                            "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT REPLACE, count INTEGER)",
                NULL, NULL, NULL);
@@ -1514,6 +1821,11 @@ start:
 
   /* create database */
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  dt_pthread_mutex_init(&db->profile_mutex, NULL);
+  dt_pthread_mutex_init(&db->statements_mutex, NULL);
+  dt_pthread_mutex_init(&db->readers_mutex, NULL);
+  dt_pthread_mutex_init(&db->transaction_mutex, NULL);
+  db->statements = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _database_free_statements);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
 
@@ -1545,6 +1857,11 @@ start:
     g_free(db->dbfilename_data);
     g_free(db->lockfile_library);
     g_free(db->dbfilename_library);
+    dt_pthread_mutex_destroy(&db->profile_mutex);
+    dt_pthread_mutex_destroy(&db->statements_mutex);
+    dt_pthread_mutex_destroy(&db->readers_mutex);
+    dt_pthread_mutex_destroy(&db->transaction_mutex);
+    g_hash_table_destroy(db->statements);
     g_free(db);
     return NULL;
   }
@@ -1569,10 +1886,29 @@ start:
   }
   sqlite3_finalize(stmt);
 
-  // some sqlite3 config
-  sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  // some sqlite3 config. the write-ahead log lets background jobs read through their own connections while
+  // the gui thread or an import writes, but it doesn't work on network file systems, so it's optional. the
+  // readers need both databases on disk.
+  if(dt_conf_get_bool("database_wal") && strcmp(db->dbfilename_library, ":memory:")
+     && strcmp(dbfilename_data, ":memory:"))
+  {
+    db->wal = _database_set_wal(db);
+    if(!db->wal) fprintf(stderr, "[init] could not switch `%s' to the write-ahead log\n", db->dbfilename_library);
+  }
+  if(!db->wal)
+  {
+    // this also switches a library which used the log before back
+    sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  }
+
+  // with -d perf log slow statements and how sqlite runs them
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    db->profile_threshold = dt_conf_get_int("database_slow_query_threshold") / 1000.0;
+    sqlite3_profile(db->handle, _database_profile, db);
+  }
 
   /* now that we got functional databases that are locked for us we can make sure that the schema is set up */
 
@@ -1798,6 +2134,10 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  if(db->slow_queries) _database_explain_slow_queries((dt_database_t *)db);
+  // sqlite3_close() refuses to close a handle with statements left
+  g_hash_table_destroy(db->statements);
+  g_slist_free_full(db->readers, (GDestroyNotify)sqlite3_close);
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -1811,11 +2151,16 @@ void dt_database_destroy(const dt_database_t *db)
   }
   g_free(db->dbfilename_data);
   g_free(db->dbfilename_library);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->profile_mutex);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->statements_mutex);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->readers_mutex);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&db->transaction_mutex);
   g_free((dt_database_t *)db);
 }
 
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
+  if(db && db->slow_queries) _database_explain_slow_queries((dt_database_t *)db);
   return db ? db->handle : NULL;
 }
 
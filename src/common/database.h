@@ -21,6 +21,7 @@
 #include <glib.h>
 
 struct dt_database_t;
+struct sqlite3_stmt;
 
 /** allocates and initializes database */
 struct dt_database_t *dt_database_init(const char *alternative, const gboolean load_data);
@@ -32,6 +33,21 @@ struct sqlite3 *dt_database_get(const struct dt_database_t *);
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
 gboolean dt_database_get_lock_acquired(const struct dt_database_t *db);
+/** get a prepared statement for sql, which is only compiled the first time it's asked for. the statement
+ * belongs to the caller until it's handed back with dt_database_release_statement(), so several threads can
+ * run the same sql at once. sql has to stay the same text, it's the key. returns NULL on error. */
+struct sqlite3_stmt *dt_database_get_statement(const struct dt_database_t *db, const char *sql);
+/** resets stmt, clears its bindings and puts it back into the cache. */
+void dt_database_release_statement(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
+/** get a read only connection for a background job, which doesn't have to wait for the writes on the main
+ * handle. only main and data are attached, not memory. if the library doesn't use the write-ahead log, or all
+ * readers are busy, this is just dt_database_get(). hand it back with dt_database_release_reader(). */
+struct sqlite3 *dt_database_get_reader(const struct dt_database_t *db);
+void dt_database_release_reader(const struct dt_database_t *db, struct sqlite3 *handle);
+/** open a transaction on the main handle. other threads wanting one wait until it's released again, calls
+ * from the same thread nest and only the outermost pair issues BEGIN and COMMIT. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+void dt_database_release_transaction(const struct dt_database_t *db);
 /** show an error popup. this has to be postponed until after we tried using dbus to reach another instance */
 void dt_database_show_error(const struct dt_database_t *db);
 
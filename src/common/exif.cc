@@ -1030,26 +1030,29 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
   }
 }
 
-/** read the metadata of an image.
- * XMP data trumps IPTC data trumps EXIF data
- */
-int dt_exif_read(dt_image_t *img, const char *path)
+struct dt_exif_prefetch_t
+{
+  gboolean have_mtime;
+  time_t mtime;
+  std::unique_ptr<Exiv2::Image> image;   // the parsed image, NULL if exiv2 can't read it
+  std::unique_ptr<Exiv2::Image> sidecar; // and its .xmp, if there is one
+};
+
+static void dt_exif_set_datetime_from_mtime(dt_image_t *img, const time_t mtime)
 {
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
   // ...)
-  struct stat statbuf;
-
-  if(!stat(path, &statbuf))
-  {
-    struct tm result;
-    strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&statbuf.st_mtime, &result));
-  }
+  struct tm result;
+  strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&mtime, &result));
+}
 
+/** store the metadata of an already parsed image.
+ * XMP data trumps IPTC data trumps EXIF data
+ */
+static int dt_exif_read_image(dt_image_t *img, const char *path, Exiv2::Image *image)
+{
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(path));
-    assert(image.get() != 0);
-    image->readMetadata();
     bool res = true;
 
     // EXIF metadata
@@ -1086,6 +1089,80 @@ int dt_exif_read(dt_image_t *img, const char *path)
   }
 }
 
+/** read the metadata of an image.
+ * XMP data trumps IPTC data trumps EXIF data
+ */
+int dt_exif_read(dt_image_t *img, const char *path)
+{
+  struct stat statbuf;
+  if(!stat(path, &statbuf)) dt_exif_set_datetime_from_mtime(img, statbuf.st_mtime);
+
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(path));
+    assert(image.get() != 0);
+    image->readMetadata();
+    return dt_exif_read_image(img, path, image.get());
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+    return 1;
+  }
+}
+
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path, const char *sidecar)
+{
+  dt_exif_prefetch_t *p = new dt_exif_prefetch_t;
+  struct stat statbuf;
+  p->have_mtime = !stat(path, &statbuf);
+  p->mtime = p->have_mtime ? statbuf.st_mtime : 0;
+
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(path));
+    assert(image.get() != 0);
+    image->readMetadata();
+    p->image = std::move(image);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+  }
+
+  // most images don't have a sidecar yet, no need to bother exiv2 with those
+  if(sidecar && g_file_test(sidecar, G_FILE_TEST_IS_REGULAR))
+  {
+    try
+    {
+      std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(sidecar));
+      assert(image.get() != 0);
+      image->readMetadata();
+      p->sidecar = std::move(image);
+    }
+    catch(Exiv2::AnyError &e)
+    {
+      // treated like no sidecar at all, just as dt_exif_xmp_read() does
+    }
+  }
+
+  return p;
+}
+
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, dt_exif_prefetch_t *p)
+{
+  if(p->have_mtime) dt_exif_set_datetime_from_mtime(img, p->mtime);
+  if(!p->image) return 1;
+  return dt_exif_read_image(img, path, p->image.get());
+}
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *p)
+{
+  delete p;
+}
+
 int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path, const int compressed)
 {
   try
@@ -1645,6 +1722,7 @@ static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos)
       char *next_tag = strstr(tag, ",");
       if(next_tag) *(next_tag++) = 0;
       // check if tag is available, get its id:
+      gboolean created = FALSE;
       for(int k = 0; k < 2; k++)
       {
         DT_DEBUG_SQLITE3_BIND_TEXT(stmt_sel_id, 1, tag, -1, SQLITE_TRANSIENT);
@@ -1657,10 +1735,11 @@ static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos)
         fprintf(stderr, "[xmp_import] creating tag: %s\n", tag);
         // create this tag (increment id, leave icon empty), retry.
         DT_DEBUG_SQLITE3_BIND_TEXT(stmt_ins_tags, 1, tag, -1, SQLITE_TRANSIENT);
-        sqlite3_step(stmt_ins_tags);
+        created = sqlite3_step(stmt_ins_tags) == SQLITE_DONE;
         sqlite3_reset(stmt_ins_tags);
         sqlite3_clear_bindings(stmt_ins_tags);
       }
+      if(created && tagid > 0) dt_tag_index_add(darktable.tag_index, tagid, tag);
       // associate image and tag.
       DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 1, tagid);
       DT_DEBUG_SQLITE3_BIND_INT(stmt_ins_tagged, 2, img->id);
@@ -1976,17 +2055,11 @@ skip:
 }
 
 // need a write lock on *img (non-const) to write stars (and soon color labels).
-int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+static int dt_exif_xmp_read_image(dt_image_t *img, const char *filename, Exiv2::Image *image,
+                                  const int history_only)
 {
-  // exclude pfm to avoid stupid errors on the console
-  const char *c = filename + strlen(filename) - 4;
-  if(c >= filename && !strcmp(c, ".pfm")) return 1;
   try
   {
-    // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(filename));
-    assert(image.get() != 0);
-    image->readMetadata();
     Exiv2::XmpData &xmpData = image->xmpData();
 
     sqlite3_stmt *stmt;
@@ -2127,7 +2200,8 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       return 1;
     }
 
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+    // a savepoint instead of a transaction, so that this also works inside the batches of the film import
+    sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_read", NULL, NULL, NULL);
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                                 &stmt, NULL);
@@ -2231,12 +2305,13 @@ end:
 
     if(all_ok)
     {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_read", NULL, NULL, NULL);
     }
     else
     {
       std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TO xmp_read", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_read", NULL, NULL, NULL);
       return 1;
     }
 
@@ -2251,6 +2326,39 @@ end:
   return 0;
 }
 
+int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+{
+  // exclude pfm to avoid stupid errors on the console
+  const char *c = filename + strlen(filename) - 4;
+  if(c >= filename && !strcmp(c, ".pfm")) return 1;
+  try
+  {
+    // read xmp sidecar
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(filename));
+    assert(image.get() != 0);
+    image->readMetadata();
+    return dt_exif_xmp_read_image(img, filename, image.get(), history_only);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    return 1;
+  }
+}
+
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, dt_exif_prefetch_t *p)
+{
+  if(!p->sidecar) return 1;
+  return dt_exif_xmp_read_image(img, filename, p->sidecar.get(), 0);
+}
+
+// a reader connection which is handed back however we leave, exiv2 likes to throw
+struct dt_exif_db_reader_t
+{
+  sqlite3 *handle;
+  dt_exif_db_reader_t() : handle(dt_database_get_reader(darktable.db)) {}
+  ~dt_exif_db_reader_t() { dt_database_release_reader(darktable.db, handle); }
+};
+
 // helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
 static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
 {
@@ -2258,11 +2366,14 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   int stars = 1, raw_params = 0, history_end = -1;
   double longitude = NAN, latitude = NAN, altitude = NAN;
   gchar *filename = NULL;
+  // this runs for the sidecar writer and exports, so it's worth not waiting for other threads writing to the
+  // library. tags come from dt_tag_get_list() and use the main handle.
+  dt_exif_db_reader_t reader;
   // get stars and raw params from db
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT filename, flags, raw_parameters, "
-                                                             "longitude, latitude, altitude, history_end "
-                                                             "FROM main.images WHERE id = ?1",
+  DT_DEBUG_SQLITE3_PREPARE_V2(reader.handle, "SELECT filename, flags, raw_parameters, "
+                                              "longitude, latitude, altitude, history_end "
+                                              "FROM main.images WHERE id = ?1",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
@@ -2324,7 +2435,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   sqlite3_finalize(stmt);
 
   // the meta data
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT key, value FROM main.meta_data WHERE id = ?1",
+  DT_DEBUG_SQLITE3_PREPARE_V2(reader.handle, "SELECT key, value FROM main.meta_data WHERE id = ?1",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -2387,7 +2498,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   std::unique_ptr<Exiv2::Value> v(Exiv2::Value::create(Exiv2::xmpSeq)); // or xmpBag or xmpAlt.
 
   /* Already initialized v = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT color FROM main.color_labels WHERE imgid=?1",
+  DT_DEBUG_SQLITE3_PREPARE_V2(reader.handle, "SELECT color FROM main.color_labels WHERE imgid=?1",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -2417,7 +2528,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   tvm.setXmpArrayType(Exiv2::XmpValue::xaNone);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+      reader.handle,
       "SELECT imgid, formid, form, name, version, points, points_count, source FROM main.mask WHERE imgid = ?1",
       -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
@@ -2480,7 +2591,7 @@ static void dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   xmpData.add(Exiv2::XmpKey("Xmp.darktable.history"), &tv);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+      reader.handle,
       "SELECT module, operation, op_params, enabled, blendop_params, "
       "blendop_version, multi_priority, multi_name FROM main.history WHERE imgid = ?1 ORDER BY num",
       -1, &stmt, NULL);
@@ -2846,12 +2957,24 @@ static void dt_exif_log_handler(int log_level, const char *message)
   }
 }
 
+// the xmp toolkit isn't thread safe, and the film import parses images and sidecars in several threads
+static dt_pthread_mutex_t xmp_toolkit_lock;
+
+static void dt_exif_xmp_lock(void *data, bool lock)
+{
+  if(lock)
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)data);
+  else
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)data);
+}
+
 void dt_exif_init()
 {
   // preface the exiv2 messages with "[exiv2] "
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
-  Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&xmp_toolkit_lock, NULL);
+  Exiv2::XmpParser::initialize(&dt_exif_xmp_lock, &xmp_toolkit_lock);
   // this has te stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   Exiv2::XmpProperties::registerNs("http://ns.adobe.com/lightroom/1.0/", "lr");
@@ -2861,6 +2984,7 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+  dt_pthread_mutex_destroy(&xmp_toolkit_lock);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -30,6 +30,22 @@ extern "C" {
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
 
+/** the parsed metadata of an image file and its sidecar, see dt_exif_prefetch(). */
+typedef struct dt_exif_prefetch_t dt_exif_prefetch_t;
+
+/** parse the metadata of path and, if it exists, of the xmp sidecar (may be NULL). this doesn't touch the
+ * database and is safe to call from any thread, so the slow part of reading many files can be done in
+ * parallel. free the result with dt_exif_prefetch_free(). */
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path, const char *sidecar);
+
+/** same as dt_exif_read(), with the metadata parsed by dt_exif_prefetch(). */
+int dt_exif_read_prefetched(dt_image_t *img, const char *path, dt_exif_prefetch_t *p);
+
+/** same as dt_exif_xmp_read(), with the sidecar parsed by dt_exif_prefetch(). */
+int dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, dt_exif_prefetch_t *p);
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *p);
+
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
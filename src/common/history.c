@@ -239,6 +239,49 @@ int dt_history_load_and_apply_on_selection(gchar *filename)
   return res;
 }
 
+/* copy the history items of imgid (or the ones in ops) to the temp table memory.style_items, which is used
+   only to get a ROWNUM of the results */
+static void _history_copy_to_style_items(const int32_t imgid, GList *ops)
+{
+  sqlite3_stmt *stmt;
+  /* delete all items from the temp styles_items */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
+
+  //  prepare SQL request
+  char req[2048];
+  g_strlcpy(req, "INSERT INTO memory.style_items (num, module, operation, op_params, enabled, blendop_params, "
+                 "blendop_version, multi_name, multi_priority) SELECT num, module, operation, "
+                 "op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority FROM "
+                 "main.history WHERE imgid = ?1",
+            sizeof(req));
+
+  //  Add ops selection if any format: ... and num in (val1, val2)
+  if(ops)
+  {
+    GList *l = ops;
+    int first = 1;
+    g_strlcat(req, " AND num IN (", sizeof(req));
+
+    while(l)
+    {
+      unsigned int value = GPOINTER_TO_UINT(l->data);
+      char v[30];
+
+      if(!first) g_strlcat(req, ",", sizeof(req));
+      snprintf(v, sizeof(v), "%u", value);
+      g_strlcat(req, v, sizeof(req));
+      first = 0;
+      l = g_list_next(l);
+    }
+    g_strlcat(req, ")", sizeof(req));
+  }
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
 int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
 {
   sqlite3_stmt *stmt;
@@ -283,44 +326,7 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   }
   sqlite3_finalize(stmt);
 
-  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
-
-  /* copy history items from styles onto temp table */
-
-  //  prepare SQL request
-  char req[2048];
-  g_strlcpy(req, "INSERT INTO memory.style_items (num, module, operation, op_params, enabled, blendop_params, "
-                 "blendop_version, multi_name, multi_priority) SELECT num, module, operation, "
-                 "op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority FROM "
-                 "main.history WHERE imgid = ?1",
-            sizeof(req));
-
-  //  Add ops selection if any format: ... and num in (val1, val2)
-  if(ops)
-  {
-    GList *l = ops;
-    int first = 1;
-    g_strlcat(req, " AND num IN (", sizeof(req));
-
-    while(l)
-    {
-      unsigned int value = GPOINTER_TO_UINT(l->data);
-      char v[30];
-
-      if(!first) g_strlcat(req, ",", sizeof(req));
-      snprintf(v, sizeof(v), "%u", value);
-      g_strlcat(req, v, sizeof(req));
-      first = 0;
-      l = g_list_next(l);
-    }
-    g_strlcat(req, ")", sizeof(req));
-  }
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  _history_copy_to_style_items(imgid, ops);
 
   /* copy the history items into the history of the dest image */
   /* note: rowid starts at 1 while num has to start at 0! */
@@ -357,6 +363,7 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   }
 
   // let's copy now
+  char req[2048];
   g_strlcpy(req, "INSERT INTO main.mask (imgid, formid, form, name, version, points, points_count, source) SELECT "
                  "?1, formid, form, name, version, points, points_count, source FROM main.mask WHERE imgid = ?2",
             sizeof(req));
@@ -476,28 +483,125 @@ int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge, GList
 {
   if(imgid < 0) return 1;
 
-  int res = 0;
   sqlite3_stmt *stmt;
+  GList *imgs = NULL;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT imgid FROM main.selected_images WHERE imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int(stmt, 0);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(!imgs) return 1;
 
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid, dest_imgid, merge, ops);
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
-    } while(sqlite3_step(stmt) == SQLITE_ROW);
+  /* the items to paste are the same for all images. they are added to all of them at once, the same as
+     dt_history_copy_and_paste_on_image() does one by one, in a single transaction. */
+  _history_copy_to_style_items(imgid, ops);
+
+  dt_database_start_transaction(darktable.db);
+  if(merge)
+  {
+    // first trim the stacks to get rid of whatever is above the selected entry
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "DELETE FROM main.history WHERE imgid IN (SELECT imgid FROM "
+                                "main.selected_images WHERE imgid != ?1) AND num >= (SELECT history_end "
+                                "FROM main.images WHERE id = imgid)", -1, &stmt, NULL);
   }
   else
-    res = 1;
+  {
+    // replace history stacks
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "DELETE FROM main.history WHERE imgid IN (SELECT imgid FROM "
+                                "main.selected_images WHERE imgid != ?1)", -1, &stmt, NULL);
+  }
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 
+  /* append the items to every stack */
+  /* note: rowid starts at 1 while num has to start at 0! */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.history "
+                              "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
+                              "version,multi_priority,multi_name) SELECT "
+                              "s.imgid,(SELECT IFNULL(MAX(num), -1)+1 FROM main.history AS h WHERE "
+                              "h.imgid = s.imgid)+i.rowid-1,i.module,i.operation,i.op_params,i.enabled,"
+                              "i.blendop_params,i.blendop_version,i.multi_priority,i.multi_name "
+                              "FROM main.selected_images AS s, memory.style_items AS i WHERE s.imgid != ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
   sqlite3_finalize(stmt);
-  return res;
+
+  if(merge && ops)
+  {
+    // the new items are the last ones of every stack
+    int count = 0;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT COUNT(*) FROM memory.style_items", -1,
+                                &stmt, NULL);
+    if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT imgid, MAX(num) + 1 FROM main.history WHERE imgid IN "
+                                "(SELECT imgid FROM main.selected_images WHERE imgid != ?1) GROUP BY imgid",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      _dt_history_cleanup_multi_instance(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1) - count);
+    sqlite3_finalize(stmt);
+  }
+
+  // we have to copy masks too, see dt_history_copy_and_paste_on_image()
+  if(!merge)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "DELETE FROM main.mask WHERE imgid IN (SELECT imgid FROM "
+                                "main.selected_images WHERE imgid != ?1)", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.mask (imgid, formid, form, name, version, points, "
+                              "points_count, source) SELECT s.imgid, m.formid, m.form, m.name, m.version, "
+                              "m.points, m.points_count, m.source FROM main.mask AS m, "
+                              "main.selected_images AS s WHERE m.imgid = ?1 AND s.imgid != ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  // always make the whole stack active
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
+                              "WHERE imgid = id) WHERE id IN (SELECT imgid FROM main.selected_images "
+                              "WHERE imgid != ?1)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
+
+  // xmp files are written in the background, thumbnails are recreated when they are shown next
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t dest_imgid = GPOINTER_TO_INT(l->data);
+
+    /* if current image in develop reload history */
+    if(dt_dev_is_current_image(darktable.develop, dest_imgid))
+    {
+      dt_dev_reload_history_items(darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    }
+
+    dt_image_synch_xmp(dest_imgid);
+    dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  }
+  g_list_free(imgs);
+  return 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -27,6 +27,7 @@
 #include "common/imageio.h"
 #include "common/imageio_rawspeed.h"
 #include "common/mipmap_cache.h"
+#include "common/sidecar_writer.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -356,7 +357,7 @@ void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t orienta
 
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
   // write that through to xmp:
-  dt_image_write_sidecar_file(imgid);
+  dt_sidecar_writer_queue(darktable.sidecar_writer, imgid);
 }
 
 dt_image_orientation_t dt_image_get_orientation(const int imgid)
@@ -577,6 +578,9 @@ void dt_image_remove(const int32_t imgid)
   int old_group_id = img->group_id;
   dt_image_cache_read_release(darktable.image_cache, img);
 
+  // a queued sidecar write would bring the xmp back after it got deleted, and load the image into the cache
+  dt_sidecar_writer_cancel(darktable.sidecar_writer, imgid);
+
   // make sure we remove from the cache first, or else the cache will look for imgid in sql
   dt_image_cache_remove(darktable.image_cache, imgid);
 
@@ -614,6 +618,11 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.embedded_previews WHERE imgid = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
   // also clear all thumbnails in mipmap_cache.
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
 
@@ -742,21 +751,22 @@ void dt_image_read_duplicates(const uint32_t id, const char *filename)
 }
 
 
-uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
+dt_image_import_prefetch_t *dt_image_import_prefetch(const char *filename, gboolean override_ignore_jpegs,
+                                                     gboolean skip_metadata)
 {
-  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR) || dt_util_get_file_size(filename) == 0) return 0;
+  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR) || dt_util_get_file_size(filename) == 0) return NULL;
   const char *cc = filename + strlen(filename);
   for(; *cc != '.' && cc > filename; cc--)
     ;
-  if(!strcmp(cc, ".dt")) return 0;
-  if(!strcmp(cc, ".dttags")) return 0;
-  if(!strcmp(cc, ".xmp")) return 0;
+  if(!strcmp(cc, ".dt")) return NULL;
+  if(!strcmp(cc, ".dttags")) return NULL;
+  if(!strcmp(cc, ".xmp")) return NULL;
   char *ext = g_ascii_strdown(cc + 1, -1);
   if(override_ignore_jpegs == FALSE && (!strcmp(ext, "jpg") || !strcmp(ext, "jpeg"))
      && dt_conf_get_bool("ui_last/import_ignore_jpegs"))
   {
     g_free(ext);
-    return 0;
+    return NULL;
   }
   int supported = 0;
   char **extensions = g_strsplit(dt_supported_extensions, ",", 100);
@@ -770,8 +780,67 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   if(!supported)
   {
     g_free(ext);
-    return 0;
+    return NULL;
+  }
+
+  dt_image_import_prefetch_t *p = (dt_image_import_prefetch_t *)calloc(1, sizeof(dt_image_import_prefetch_t));
+  if(!p)
+  {
+    g_free(ext);
+    return NULL;
+  }
+  p->filename = g_strdup(filename);
+  p->ext = ext;
+
+  // set the bits in flags that indicate if any of the extra files (.txt, .wav) are present
+  char *extra_file = dt_image_get_audio_path_from_path(filename);
+  if(extra_file)
+  {
+    p->flags |= DT_IMAGE_HAS_WAV;
+    g_free(extra_file);
   }
+  extra_file = dt_image_get_text_path_from_path(filename);
+  if(extra_file)
+  {
+    p->flags |= DT_IMAGE_HAS_TXT;
+    g_free(extra_file);
+  }
+
+  if(!skip_metadata)
+  {
+    char dtfilename[PATH_MAX] = { 0 };
+    g_strlcpy(dtfilename, filename, sizeof(dtfilename));
+    g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
+    p->exif = dt_exif_prefetch(filename, dtfilename);
+  }
+
+  return p;
+}
+
+void dt_image_import_prefetch_free(dt_image_import_prefetch_t *p)
+{
+  if(!p) return;
+  if(p->exif) dt_exif_prefetch_free(p->exif);
+  g_free(p->filename);
+  g_free(p->ext);
+  free(p);
+}
+
+uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
+{
+  // a single image doesn't gain anything from reading ahead, and we might not need the metadata at all
+  dt_image_import_prefetch_t *p = dt_image_import_prefetch(filename, override_ignore_jpegs, TRUE);
+  if(!p) return 0;
+  const uint32_t id = dt_image_import_prefetched(film_id, p, NULL);
+  dt_image_import_prefetch_free(p);
+  return id;
+}
+
+uint32_t dt_image_import_prefetched(const int32_t film_id, const dt_image_import_prefetch_t *p,
+                                    GArray *imported)
+{
+  const char *filename = p->filename;
+  const char *ext = p->ext;
   int rc;
   uint32_t id = 0;
   // select from images; if found => return
@@ -787,7 +856,6 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
     id = sqlite3_column_int(stmt, 0);
     g_free(imgfname);
     sqlite3_finalize(stmt);
-    g_free(ext);
     dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
     img->flags &= ~DT_IMAGE_REMOVE;
     dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -805,19 +873,7 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
     dt_conf_set_int("ui_last/import_initial_rating", 1);
   }
   flags |= DT_IMAGE_NO_LEGACY_PRESETS;
-  // set the bits in flags that indicate if any of the extra files (.txt, .wav) are present
-  char *extra_file = dt_image_get_audio_path_from_path(filename);
-  if(extra_file)
-  {
-    flags |= DT_IMAGE_HAS_WAV;
-    g_free(extra_file);
-  }
-  extra_file = dt_image_get_text_path_from_path(filename);
-  if(extra_file)
-  {
-    flags |= DT_IMAGE_HAS_TXT;
-    g_free(extra_file);
-  }
+  flags |= p->flags;
   // insert dummy image entry in database
   DT_DEBUG_SQLITE3_PREPARE_V2(
       dt_database_get(darktable.db),
@@ -930,13 +986,16 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   img->group_id = group_id;
 
   // read dttags and exif for database queries!
-  (void)dt_exif_read(img, filename);
+  if(p->exif)
+    (void)dt_exif_read_prefetched(img, filename, p->exif);
+  else
+    (void)dt_exif_read(img, filename);
   char dtfilename[PATH_MAX] = { 0 };
   g_strlcpy(dtfilename, filename, sizeof(dtfilename));
   // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
   g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-  int res = dt_exif_xmp_read(img, dtfilename, 0);
+  int res = p->exif ? dt_exif_xmp_read_prefetched(img, dtfilename, p->exif) : dt_exif_xmp_read(img, dtfilename, 0);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -951,7 +1010,6 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   guint tagid = 0;
   char tagname[512];
   snprintf(tagname, sizeof(tagname), "darktable|format|%s", ext);
-  g_free(ext);
   dt_tag_new(tagname, &tagid);
   dt_tag_attach(tagid, id);
 
@@ -966,7 +1024,10 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   g_free(basename);
   g_free(sql_pattern);
 
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
+  if(imported)
+    g_array_append_val(imported, id);
+  else
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
   // the following line would look logical with new_tags_set being the return value
   // from dt_tag_new above, but this could lead to too rapid signals, being able to lock up the
   // keywords side pane when trying to use it, which can lock up the whole dt GUI ..
@@ -1512,15 +1573,18 @@ void dt_image_write_sidecar_file(int imgid)
 
     if(!dt_exif_xmp_write(imgid, filename))
     {
+      // the folder watches of the crawler shouldn't take this for a change by someone else
+      dt_sidecar_writer_written(darktable.sidecar_writer, filename);
+
       // put the timestamp into db. this can't be done in exif.cc since that code gets called
       // for the copy exporter, too
       sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1",
-                                  -1, &stmt, NULL);
+      stmt = dt_database_get_statement(darktable.db,
+                                       "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') "
+                                       "WHERE id = ?1");
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_statement(darktable.db, stmt);
     }
   }
 }
@@ -1530,7 +1594,7 @@ void dt_image_synch_xmp(const int selected)
 {
   if(selected > 0)
   {
-    dt_image_write_sidecar_file(selected);
+    dt_sidecar_writer_queue(darktable.sidecar_writer, selected);
   }
   else if(dt_conf_get_bool("write_sidecar_files"))
   {
@@ -1540,7 +1604,7 @@ void dt_image_synch_xmp(const int selected)
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
+      dt_sidecar_writer_queue(darktable.sidecar_writer, imgid);
     }
     sqlite3_finalize(stmt);
   }
@@ -1562,7 +1626,7 @@ void dt_image_synch_all_xmp(const gchar *pathname)
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
+      dt_sidecar_writer_queue(darktable.sidecar_writer, imgid);
     }
     sqlite3_finalize(stmt);
     g_free(imgfname);
@@ -213,6 +213,25 @@ void dt_image_print_exif(const dt_image_t *img, char *line, size_t line_len);
 void dt_image_read_duplicates(uint32_t id, const char *filename);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. */
 uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+/** what dt_image_import() needs to know about a file before touching the data base. */
+typedef struct dt_image_import_prefetch_t
+{
+  gchar *filename;
+  gchar *ext;                      // lower case
+  uint32_t flags;                  // DT_IMAGE_HAS_WAV and DT_IMAGE_HAS_TXT
+  struct dt_exif_prefetch_t *exif; // the parsed metadata and sidecar, NULL if skipped
+} dt_image_import_prefetch_t;
+/** the first half of dt_image_import(): checks the file and reads its metadata, without touching the data
+ * base or the caches, so it can run on any thread. skip_metadata if the image is probably known already.
+ * returns NULL if the file can't be imported. */
+dt_image_import_prefetch_t *dt_image_import_prefetch(const char *filename, gboolean override_ignore_jpegs,
+                                                     gboolean skip_metadata);
+/** the second half of dt_image_import(), adds the prefetched image to the data base and image cache. if
+ * imported isn't NULL the id of a new image is appended to it, and raising DT_SIGNAL_IMAGE_IMPORT is up to
+ * the caller, once the image is committed. */
+uint32_t dt_image_import_prefetched(const int32_t film_id, const dt_image_import_prefetch_t *p,
+                                    GArray *imported);
+void dt_image_import_prefetch_free(dt_image_import_prefetch_t *p);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
 /** duplicates the given image in the database with the duplicate getting the supplied version number. if that
@@ -278,6 +297,7 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 /* try to sync .xmp for all local copies */
 void dt_image_local_copy_synch(void);
 // xmp functions:
+// writes the sidecar right away. the dt_image_synch_*() ones only queue it in darktable.sidecar_writer.
 void dt_image_write_sidecar_file(int imgid);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
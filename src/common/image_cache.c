@@ -21,6 +21,7 @@
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/image.h"
+#include "common/sidecar_writer.h"
 #include "control/conf.h"
 #include "develop/develop.h"
 
@@ -36,13 +37,12 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
   // load stuff from db and store in cache:
   char *str;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  stmt = dt_database_get_statement(
+      darktable.db,
       "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure, "
       "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, "
       "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, "
-      "raw_maximum FROM main.images WHERE id = ?1",
-      -1, &stmt, NULL);
+      "raw_maximum FROM main.images WHERE id = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -134,7 +134,7 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
     fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", entry->key,
             sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
@@ -212,15 +212,14 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
 {
   if(img->id <= 0) return;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
+  stmt = dt_database_get_statement(
+      darktable.db,
       "UPDATE main.images SET width = ?1, height = ?2, maker = ?3, model = ?4, "
       "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
       "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
       "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
       "latitude = ?19, altitude = ?20, color_matrix = ?21, colorspace = ?22, raw_black = ?23, "
-      "raw_maximum = ?24 WHERE id = ?25",
-      -1, &stmt, NULL);
+      "raw_maximum = ?24 WHERE id = ?25");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, -1, SQLITE_STATIC);
@@ -248,14 +247,14 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 25, img->id);
   int rc = sqlite3_step(stmt);
   if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
     // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    dt_sidecar_writer_queue(darktable.sidecar_writer, img->id);
   }
   dt_cache_release(&cache->cache, img->cache_entry);
 }
@@ -267,6 +266,11 @@ void dt_image_cache_remove(dt_image_cache_t *cache, const uint32_t imgid)
   dt_cache_remove(&cache->cache, imgid);
 }
 
+int dt_image_cache_contains(dt_image_cache_t *cache, const uint32_t imgid)
+{
+  return dt_cache_contains(&cache->cache, imgid);
+}
+
 
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -21,6 +21,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
 
 typedef union
 {
@@ -151,6 +154,65 @@ void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const
   }
 }
 
+static inline uint16_t _float_to_half(const float f)
+{
+  const dt_image_float_int_t u = { .f = f };
+  const uint16_t sign = (u.i >> 16) & 0x8000;
+  const uint32_t x = u.i & 0x7fffffff;
+  if(x > 0x7f800000) return sign | 0x7e00; // nan
+  if(x >= 0x47800000) return sign | 0x7c00; // inf, or too large
+  if(x < 0x38800000)
+  {
+    // denormal half, or zero
+    if(x < 0x33000000) return sign;
+    const uint32_t e = x >> 23, m = (x & 0x7fffff) | 0x800000;
+    const uint32_t shift = 126 - e;
+    const uint32_t h = m >> shift, rem = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    return sign | (h + (rem > halfway || (rem == halfway && (h & 1))));
+  }
+  // rebias the exponent and round the mantissa. a carry ends up in the exponent, which is right, and values
+  // just below 65536 correctly round to inf.
+  const uint32_t h = (x >> 13) - ((127 - 15) << 10), rem = x & 0x1fff;
+  return sign | (h + (rem > 0x1000 || (rem == 0x1000 && (h & 1))));
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t e = (h >> 10) & 0x1f, m = h & 0x3ff;
+  dt_image_float_int_t u;
+  if(e == 0x1f)
+    u.i = sign | 0x7f800000 | (m << 13);
+  else if(e)
+    u.i = sign | ((e + 127 - 15) << 23) | (m << 13);
+  else
+  {
+    // denormal
+    u.f = m * (1.0f / (1 << 24));
+    u.i |= sign;
+  }
+  return u.f;
+}
+
+void dt_image_compress_half(const float *in, uint16_t *out, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  for(; k + 4 <= n; k += 4)
+    _mm_storel_epi64((__m128i *)(out + k), _mm_cvtps_ph(_mm_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+#endif
+  for(; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+void dt_image_uncompress_half(const uint16_t *in, float *out, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  for(; k + 4 <= n; k += 4) _mm_storeu_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+#endif
+  for(; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -19,12 +19,17 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
 
 /** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH
  * 2006. */
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
 
+/** convert n floats to half floats and back, rounding to nearest even. */
+void dt_image_compress_half(const float *in, uint16_t *out, const size_t n);
+void dt_image_uncompress_half(const uint16_t *in, float *out, const size_t n);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
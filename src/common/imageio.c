@@ -38,6 +38,7 @@
 #include "common/imageio_jpeg.h"
 #include "common/imageio_pfm.h"
 #include "common/imageio_png.h"
+#include "common/imageio_preview.h"
 #include "common/imageio_rawspeed.h"
 #include "common/imageio_rgbe.h"
 #include "common/imageio_tiff.h"
@@ -55,6 +56,7 @@
 #endif
 
 #include <assert.h>
+#include <fcntl.h>
 #include <glib/gstdio.h>
 #include <inttypes.h>
 #include <math.h>
@@ -62,9 +64,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 // load a full-res thumbnail:
-int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+int dt_imageio_large_thumbnail(const char *filename, const int32_t imgid, const int min_size,
+                               uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space)
 {
   int res = 1;
@@ -73,8 +81,11 @@ int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *
   char *mime_type = NULL;
   size_t bufsize;
 
-  // get the biggest thumb from exif
-  if(dt_exif_get_thumbnail(filename, &buf, &bufsize, &mime_type)) goto error;
+  // get the biggest thumb, looking in the usual places ourselves first, exiv2 is much slower at that
+  if(!dt_imageio_preview_get(imgid, filename, min_size, &buf, &bufsize))
+    mime_type = strdup("image/jpeg");
+  else if(dt_exif_get_thumbnail(filename, &buf, &bufsize, &mime_type))
+    goto error;
 
   if(strcmp(mime_type, "image/jpeg") == 0)
   {
@@ -410,37 +421,89 @@ static const uint8_t _imageio_ldr_magic[] = {
   0x00, 0x00, 0x04, 0x49, 0x49, 0x2a, 0x00
 };
 
-gboolean dt_imageio_is_ldr(const char *filename)
+gboolean dt_imageio_is_ldr_mem(const uint8_t *data, const size_t size)
 {
   size_t offset = 0;
-  uint8_t block[16] = { 0 };
-  FILE *fin = g_fopen(filename, "rb");
-  if(fin)
-  {
-    /* read block from file */
-    size_t s = fread(block, 16, 1, fin);
-    fclose(fin);
+  /* all magics are within the first 16 bytes */
+  if(size < 16) return FALSE;
 
-    /* compare magic's */
-    while(s)
+  /* compare magic's */
+  for(;;)
+  {
+    if(memcmp(_imageio_ldr_magic + offset + 3, data + _imageio_ldr_magic[offset + 1],
+              _imageio_ldr_magic[offset + 2]) == 0)
     {
-      if(memcmp(_imageio_ldr_magic + offset + 3, block + _imageio_ldr_magic[offset + 1],
-                _imageio_ldr_magic[offset + 2]) == 0)
-      {
-        if(_imageio_ldr_magic[offset] == 0x01)
-          return FALSE;
-        else
-          return TRUE;
-      }
-      offset += 3 + (_imageio_ldr_magic + offset)[2];
-
-      /* check if finished */
-      if(offset >= sizeof(_imageio_ldr_magic)) break;
+      if(_imageio_ldr_magic[offset] == 0x01)
+        return FALSE;
+      else
+        return TRUE;
     }
+    offset += 3 + (_imageio_ldr_magic + offset)[2];
+
+    /* check if finished */
+    if(offset >= sizeof(_imageio_ldr_magic)) break;
   }
   return FALSE;
 }
 
+gboolean dt_imageio_is_ldr(const char *filename)
+{
+  uint8_t block[16] = { 0 };
+  FILE *fin = g_fopen(filename, "rb");
+  if(!fin) return FALSE;
+
+  /* read block from file */
+  const size_t s = fread(block, 16, 1, fin);
+  fclose(fin);
+  return s ? dt_imageio_is_ldr_mem(block, sizeof(block)) : FALSE;
+}
+
+dt_imageio_map_t *dt_imageio_map_file(const char *filename)
+{
+  // one open() and fstat() instead of a stat() of the path, the magic sniffing and then every loader
+  // opening and reading the file again.
+  const int fd = g_open(filename, O_RDONLY, 0);
+  if(fd == -1) return NULL;
+
+  struct stat statbuf;
+  if(fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode) || statbuf.st_size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  GError *error = NULL;
+  GMappedFile *file = g_mapped_file_new_from_fd(fd, FALSE, &error);
+  // the mapping keeps its own reference to the file
+  close(fd);
+  if(!file)
+  {
+    dt_print(DT_DEBUG_CAMERA_SUPPORT, "[imageio_map] can't map `%s': %s\n", filename, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  dt_imageio_map_t *map = (dt_imageio_map_t *)calloc(1, sizeof(dt_imageio_map_t));
+  map->file = file;
+  map->data = (const uint8_t *)g_mapped_file_get_contents(file);
+  map->size = g_mapped_file_get_length(file);
+#ifndef _WIN32
+  // the rest of the last page reads as zeros, that's all the padding we can get without copying
+  const size_t page = sysconf(_SC_PAGESIZE);
+  map->padded = map->size % page != 0 && page - map->size % page >= DT_IMAGEIO_MAP_PADDING;
+  // most loaders go through all of it front to back, have the kernel read ahead
+  posix_madvise((void *)map->data, map->size, POSIX_MADV_WILLNEED);
+#endif
+  return map;
+}
+
+void dt_imageio_unmap_file(dt_imageio_map_t *map)
+{
+  if(!map) return;
+  g_mapped_file_unref(map->file);
+  free(map);
+}
+
 int dt_imageio_is_hdr(const char *filename)
 {
   const char *c = filename + strlen(filename);
@@ -456,10 +519,11 @@ int dt_imageio_is_hdr(const char *filename)
 }
 
 // transparent read method to load ldr image to dt_raw_image_t with exif and so on.
-dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf)
+dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, const dt_imageio_map_t *map,
+                                        dt_mipmap_buffer_t *buf)
 {
   dt_imageio_retval_t ret;
-  ret = dt_imageio_open_tiff(img, filename, buf);
+  ret = dt_imageio_open_tiff(img, filename, map, buf);
   if(ret == DT_IMAGEIO_OK || ret == DT_IMAGEIO_CACHE_FULL)
   {
     img->buf_dsc.filters = 0u;
@@ -470,7 +534,7 @@ dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, d
     return ret;
   }
 
-  ret = dt_imageio_open_png(img, filename, buf);
+  ret = dt_imageio_open_png(img, filename, map, buf);
   if(ret == DT_IMAGEIO_OK || ret == DT_IMAGEIO_CACHE_FULL)
   {
     img->buf_dsc.filters = 0u;
@@ -494,7 +558,7 @@ dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, d
   }
 #endif
 
-  ret = dt_imageio_open_jpeg(img, filename, buf);
+  ret = dt_imageio_open_jpeg(img, filename, map, buf);
   if(ret == DT_IMAGEIO_OK || ret == DT_IMAGEIO_CACHE_FULL)
   {
     img->buf_dsc.filters = 0u;
@@ -537,209 +601,122 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
                                         0, NULL, copy_metadata, storage, storage_params, num, total);
 }
 
-// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
-int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
-                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
-                                 const int32_t ignore_exif, const int32_t display_byteorder,
-                                 const gboolean high_quality, const gboolean upscale, const int32_t thumbnail_export,
-                                 const char *filter, const gboolean copy_metadata,
-                                 dt_imageio_module_storage_t *storage,
-                                 dt_imageio_module_data_t *storage_params, int num, int total)
+// add the items of the style of format_params to the history of dev, to be applied during export
+static int _export_apply_style(dt_develop_t *dev, dt_imageio_module_data_t *format_params)
 {
-  dt_develop_t dev;
-  dt_dev_init(&dev, 0);
-  dt_dev_load_image(&dev, imgid);
+  GList *stls;
 
-  const int buf_is_downscaled
-      = (thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"));
+  dt_iop_module_t *m = NULL;
 
-  dt_mipmap_buffer_t buf;
-  if(buf_is_downscaled)
-    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
-  else
-    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
-
-  const dt_image_t *img = &dev.image_storage;
-
-  if(!buf.buf || !buf.width || !buf.height)
+  if((stls = dt_styles_get_item_list(format_params->style, TRUE, -1)) == 0)
   {
-    fprintf(stderr, "allocation failed???\n");
-    dt_control_log(_("image `%s' is not available!"), img->filename);
-    goto error_early;
+    dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
+    return 1;
   }
 
-  const int wd = img->width;
-  const int ht = img->height;
-  const float max_scale = upscale ? 100.0 : 1.0;
-
-  int res = 0;
-
-  dt_times_t start;
-  dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
-  if(!res)
+  // remove everything above history_end
+  GList *history = g_list_nth(dev->history, dev->history_end);
+  while(history)
   {
-    dt_control_log(
-        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
-        thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
-    goto error;
+    GList *next = g_list_next(history);
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
+    free(hist->params);
+    free(hist->blend_params);
+    free(history->data);
+    dev->history = g_list_delete_link(dev->history, history);
+    history = next;
   }
 
-  //  If a style is to be applied during export, add the iop params into the history
-  if(!thumbnail_export && format_params->style[0] != '\0')
+  // Add each params
+  while(stls)
   {
-    GList *stls;
-
-    dt_iop_module_t *m = NULL;
-
-    if((stls = dt_styles_get_item_list(format_params->style, TRUE, -1)) == 0)
-    {
-      dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
-      goto error;
-    }
-
-    // remove everything above history_end
-    GList *history = g_list_nth(dev.history, dev.history_end);
-    while(history)
-    {
-      GList *next = g_list_next(history);
-      dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
-      free(hist->params);
-      free(hist->blend_params);
-      free(history->data);
-      dev.history = g_list_delete_link(dev.history, history);
-      history = next;
-    }
+    dt_style_item_t *s = (dt_style_item_t *)stls->data;
+    gboolean module_found = FALSE;
 
-    // Add each params
-    while(stls)
+    GList *modules = dev->iop;
+    while(modules)
     {
-      dt_style_item_t *s = (dt_style_item_t *)stls->data;
-      gboolean module_found = FALSE;
+      m = (dt_iop_module_t *)modules->data;
 
-      GList *modules = dev.iop;
-      while(modules)
+      //  since the name in the style is returned with a possible multi-name, just check the start of the
+      //  name
+      if(strncmp(m->op, s->name, strlen(m->op)) == 0)
       {
-        m = (dt_iop_module_t *)modules->data;
+        dt_dev_history_item_t *h = malloc(sizeof(dt_dev_history_item_t));
+        dt_iop_module_t *sty_module = m;
 
-        //  since the name in the style is returned with a possible multi-name, just check the start of the
-        //  name
-        if(strncmp(m->op, s->name, strlen(m->op)) == 0)
+        if(format_params->style_append && !(m->flags() & IOP_FLAGS_ONE_INSTANCE))
         {
-          dt_dev_history_item_t *h = malloc(sizeof(dt_dev_history_item_t));
-          dt_iop_module_t *sty_module = m;
-
-          if(format_params->style_append && !(m->flags() & IOP_FLAGS_ONE_INSTANCE))
+          sty_module = dt_dev_module_duplicate(m->dev, m, 0);
+          if(!sty_module)
           {
-            sty_module = dt_dev_module_duplicate(m->dev, m, 0);
-            if(!sty_module)
-            {
-              free(h);
-              goto error;
-            }
+            free(h);
+            return 1;
           }
+        }
 
-          h->params = s->params;
-          h->blend_params = s->blendop_params;
-          h->enabled = s->enabled;
-          h->module = sty_module;
-          h->multi_priority = 1;
-          g_strlcpy(h->multi_name, "<style>", sizeof(h->multi_name));
-
-          if(m->legacy_params && (s->module_version != m->version()))
-          {
-            void *new_params = malloc(m->params_size);
-            m->legacy_params(m, h->params, s->module_version, new_params, labs(m->version()));
+        h->params = s->params;
+        h->blend_params = s->blendop_params;
+        h->enabled = s->enabled;
+        h->module = sty_module;
+        h->multi_priority = 1;
+        g_strlcpy(h->multi_name, "<style>", sizeof(h->multi_name));
 
-            free(h->params);
-            h->params = new_params;
-          }
+        if(m->legacy_params && (s->module_version != m->version()))
+        {
+          void *new_params = malloc(m->params_size);
+          m->legacy_params(m, h->params, s->module_version, new_params, labs(m->version()));
 
-          dev.history_end++;
-          dev.history = g_list_append(dev.history, h);
-          module_found = TRUE;
-          g_free(s->name);
-          break;
+          free(h->params);
+          h->params = new_params;
         }
-        modules = g_list_next(modules);
+
+        dev->history_end++;
+        dev->history = g_list_append(dev->history, h);
+        module_found = TRUE;
+        g_free(s->name);
+        break;
       }
-      if(!module_found) dt_style_item_free(s);
-      stls = g_list_next(stls);
+      modules = g_list_next(modules);
     }
-    g_list_free(stls);
+    if(!module_found) dt_style_item_free(s);
+    stls = g_list_next(stls);
   }
+  g_list_free(stls);
+  return 0;
+}
 
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
-
-  if(filter)
-  {
-    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(&pipe, filter + 4);
-    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(&pipe, filter + 5);
-  }
-
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
-                                  &pipe.processed_height);
-
-  dt_show_times(&start, "[export] creating pixelpipe", NULL);
+// find out whether the output color profile of this export is srgb, for the exif data
+static int _export_is_srgb(const dt_develop_t *dev)
+{
+  const int icctype = dt_conf_get_int("plugins/lighttable/export/icctype");
+  if(icctype == DT_COLORSPACE_SRGB) return 1;
+  if(icctype != DT_COLORSPACE_NONE) return 0;
 
-  // find output color profile for this image:
-  int sRGB = 1;
-  int icctype = dt_conf_get_int("plugins/lighttable/export/icctype");
-  if(icctype == DT_COLORSPACE_SRGB)
-  {
-    sRGB = 1;
-  }
-  else if(icctype == DT_COLORSPACE_NONE)
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
   {
-    GList *modules = dev.iop;
-    dt_iop_module_t *colorout = NULL;
-    while(modules)
+    dt_iop_module_t *colorout = (dt_iop_module_t *)modules->data;
+    if(colorout->get_p && strcmp(colorout->op, "colorout") == 0)
     {
-      colorout = (dt_iop_module_t *)modules->data;
-      if(colorout->get_p && strcmp(colorout->op, "colorout") == 0)
-      {
-        const dt_colorspaces_color_profile_type_t *type = colorout->get_p(colorout->params, "type");
-        sRGB = (!type || *type == DT_COLORSPACE_SRGB);
-        break; // colorout can't have > 1 instance
-      }
-      modules = g_list_next(modules);
+      const dt_colorspaces_color_profile_type_t *type = colorout->get_p(colorout->params, "type");
+      return (!type || *type == DT_COLORSPACE_SRGB); // colorout can't have > 1 instance
     }
   }
-  else
-  {
-    sRGB = 0;
-  }
-
-  // get only once at the beginning, in case the user changes it on the way:
-  const gboolean high_quality_processing
-      = ((format_params->max_width == 0 || format_params->max_width >= pipe.processed_width)
-         && (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height))
-            ? FALSE
-            : high_quality;
-
-  const int width = format_params->max_width;
-  const int height = format_params->max_height;
-  const double scalex = width > 0 ? fminf(width / (double)pipe.processed_width, max_scale) : 1.0;
-  const double scaley = height > 0 ? fminf(height / (double)pipe.processed_height, max_scale) : 1.0;
-  const double scale = fminf(scalex, scaley);
-
-  const int processed_width = scale * pipe.processed_width + .5f;
-  const int processed_height = scale * pipe.processed_height + .5f;
-
-  const int bpp = format->bpp(format_params);
+  return 1;
+}
 
-  dt_get_times(&start);
+// run the pipe on the region (x, y, width, height) of the scaled output, result ends up in pipe->backbuf
+static void _export_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int x, const int y,
+                            const int width, const int height, const double scale, const int bpp,
+                            const gboolean high_quality_processing)
+{
   if(high_quality_processing)
   {
     /*
      * if high quality processing was requested, downsampling will be done
      * at the very end of the pipe (just before border and watermark)
      */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, x, y, width, height, scale);
   }
   else
   {
@@ -750,7 +727,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     // find the finalscale module
     dt_dev_pixelpipe_iop_t *finalscale = NULL;
     {
-      GList *nodes = g_list_last(pipe.nodes);
+      GList *nodes = g_list_last(pipe->nodes);
       while(nodes)
       {
         dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
@@ -767,18 +744,18 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, x, y, width, height, scale);
 
     if(finalscale) finalscale->enabled = 1;
   }
-  dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
-                                         : "[dev_process_export] pixel pipeline processing",
-                NULL);
-
-  uint8_t *outbuf = pipe.backbuf;
+}
 
+// convert the pipe output in place to what the format module wants to get
+static void _export_convert(uint8_t *outbuf, const int width, const int height, const int bpp,
+                            const gboolean high_quality_processing, const int32_t display_byteorder)
+{
   // downconversion to low-precision formats:
   if(bpp == 8)
   {
@@ -787,7 +764,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
       if(high_quality_processing)
       {
         const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        for(size_t k = 0; k < (size_t)width * height; k++)
         {
           // convert in place, this is unfortunately very serial..
           const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
@@ -806,7 +783,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
       if(high_quality_processing)
       {
         const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        for(size_t k = 0; k < (size_t)width * height; k++)
         {
           // convert in place, this is unfortunately very serial..
           const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
@@ -819,12 +796,12 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
       }
       else
       { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
+        uint8_t *const buf8 = outbuf;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static)
 #endif
         // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+        for(size_t k = 0; k < (size_t)width * height; k++)
         {
           uint8_t tmp = buf8[4 * k + 0];
           buf8[4 * k + 0] = buf8[4 * k + 2];
@@ -838,38 +815,187 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     // uint16_t per color channel
     float *buff = (float *)outbuf;
     uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
+    for(int y = 0; y < height; y++)
+      for(int x = 0; x < width; x++)
       {
         // convert in place
-        const size_t k = (size_t)processed_width * y + x;
+        const size_t k = (size_t)width * y + x;
         for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
       }
   }
   // else output float, no further harm done to the pixels :)
+}
+
+static int _export_read_exif(const uint32_t imgid, const int sRGB, const int width, const int height,
+                             uint8_t **exif_profile)
+{
+  // Exif data should be 65536 bytes max, but if original size is close to that, adding new tags could make it
+  // go over that... so let it be and see what happens when we write the image
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+  // last param is dng mode, it's false here
+  return dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, width, height, 0);
+}
+
+// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
+int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
+                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                 const int32_t ignore_exif, const int32_t display_byteorder,
+                                 const gboolean high_quality, const gboolean upscale, const int32_t thumbnail_export,
+                                 const char *filter, const gboolean copy_metadata,
+                                 dt_imageio_module_storage_t *storage,
+                                 dt_imageio_module_data_t *storage_params, int num, int total)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  const int buf_is_downscaled
+      = (thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"));
+
+  dt_mipmap_buffer_t buf;
+  if(buf_is_downscaled)
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
+  else
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
 
-  format_params->width = processed_width;
-  format_params->height = processed_height;
+  const dt_image_t *img = &dev.image_storage;
 
-  if(!ignore_exif)
+  if(!buf.buf || !buf.width || !buf.height)
   {
-    int length;
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
-                                  // adding new tags could make it go over that... so let it be and see what
-                                  // happens when we write the image
-    char pathname[PATH_MAX] = { 0 };
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
-    // last param is dng mode, it's false here
-    length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+    fprintf(stderr, "allocation failed???\n");
+    dt_control_log(_("image `%s' is not available!"), img->filename);
+    goto error_early;
+  }
+
+  const int wd = img->width;
+  const int ht = img->height;
+  const float max_scale = upscale ? 100.0 : 1.0;
 
-    res = format->write_image(format_params, filename, outbuf, exif_profile, length, imgid, num, total);
+  int res = 0;
+
+  dt_times_t start;
+  dt_get_times(&start);
+  // huge images would need several full size buffers in the pipe. if that doesn't fit into the memory budget
+  // and the format can take it, the image can be processed and written in bands instead. modules looking at
+  // the neighbourhood of a pixel (blurs, local contrast, ...) can't see across the bands and leave seams, so
+  // only do that when the user asked for it.
+  const double memory_limit = dt_conf_get_float("host_memory_limit") * 1024.0 * 1024.0;
+  const int streaming = !thumbnail_export && format->write_image_begin && memory_limit > 0.0
+                        && dt_conf_get_bool("plugins/imageio/export_in_bands")
+                        && 2.0 * 4.0 * sizeof(float) * wd * ht > memory_limit;
+
+  dt_dev_pixelpipe_t pipe;
+  // when streaming, the pipe's cache lines get allocated on demand, at the size of a band
+  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
+                         : dt_dev_pixelpipe_init_export(&pipe, streaming ? 0 : wd, streaming ? 0 : ht,
+                                                        format->levels(format_params));
+  if(!res)
+  {
+    dt_control_log(
+        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+        thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
+    goto error;
+  }
+
+  //  If a style is to be applied during export, add the iop params into the history
+  if(!thumbnail_export && format_params->style[0] != '\0' && _export_apply_style(&dev, format_params))
+    goto error;
+
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+
+  if(filter)
+  {
+    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(&pipe, filter + 4);
+    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(&pipe, filter + 5);
+  }
+
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  dt_show_times(&start, "[export] creating pixelpipe", NULL);
+
+  // find output color profile for this image:
+  const int sRGB = _export_is_srgb(&dev);
+
+  // get only once at the beginning, in case the user changes it on the way:
+  const gboolean high_quality_processing
+      = ((format_params->max_width == 0 || format_params->max_width >= pipe.processed_width)
+         && (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height))
+            ? FALSE
+            : high_quality;
+
+  const int width = format_params->max_width;
+  const int height = format_params->max_height;
+  const double scalex = width > 0 ? fminf(width / (double)pipe.processed_width, max_scale) : 1.0;
+  const double scaley = height > 0 ? fminf(height / (double)pipe.processed_height, max_scale) : 1.0;
+  const double scale = fminf(scalex, scaley);
+
+  const int processed_width = scale * pipe.processed_width + .5f;
+  const int processed_height = scale * pipe.processed_height + .5f;
+
+  const int bpp = format->bpp(format_params);
+
+  if(streaming)
+  {
+    // the pipe only ever sees a band of rows at a time, and the format module writes them out as they come.
+    // size the bands so one of them (at input resolution, including some temporary buffers of the modules)
+    // stays well within the memory budget.
+    const double row_size = 4.0 * sizeof(float) * wd / scale;
+    const int band = CLAMP((int)(memory_limit / (6.0 * row_size)), 64, MAX(processed_height, 64));
+
+    uint8_t *exif_profile = NULL;
+    const int length
+        = ignore_exif ? 0 : _export_read_exif(imgid, sRGB, processed_width, processed_height, &exif_profile);
+
+    format_params->width = processed_width;
+    format_params->height = processed_height;
+
+    dt_get_times(&start);
+    void *handle = format->write_image_begin(format_params, filename, exif_profile, length, imgid, num, total);
+    res = !handle;
+    for(int y = 0; !res && y < processed_height; y += band)
+    {
+      const int rows = MIN(band, processed_height - y);
+      _export_process(&pipe, &dev, 0, y, processed_width, rows, scale, bpp, high_quality_processing);
+      _export_convert(pipe.backbuf, processed_width, rows, bpp, high_quality_processing, display_byteorder);
+      res = format->write_image_rows(format_params, handle, pipe.backbuf, y, rows);
+    }
+    if(handle) res = format->write_image_end(format_params, handle, res) || res;
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing in bands", NULL);
 
     free(exif_profile);
   }
   else
   {
-    res = format->write_image(format_params, filename, outbuf, NULL, 0, imgid, num, total);
+    dt_get_times(&start);
+    _export_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale, bpp, high_quality_processing);
+    dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
+                                           : "[dev_process_export] pixel pipeline processing",
+                  NULL);
+
+    uint8_t *outbuf = pipe.backbuf;
+    _export_convert(outbuf, processed_width, processed_height, bpp, high_quality_processing, display_byteorder);
+
+    format_params->width = processed_width;
+    format_params->height = processed_height;
+
+    if(!ignore_exif)
+    {
+      uint8_t *exif_profile = NULL;
+      const int length = _export_read_exif(imgid, sRGB, processed_width, processed_height, &exif_profile);
+
+      res = format->write_image(format_params, filename, outbuf, exif_profile, length, imgid, num, total);
+
+      free(exif_profile);
+    }
+    else
+    {
+      res = format->write_image(format_params, filename, outbuf, NULL, 0, imgid, num, total);
+    }
   }
 
   dt_dev_pixelpipe_cleanup(&pipe);
@@ -901,6 +1027,218 @@ error_early:
 }
 
 
+// area average of the float rgba pipe output, fast and good enough for the downscale factors between renditions
+static void _export_downscale(const float *const in, const int iw, const int ih, float *const out, const int ow,
+                              const int oh)
+{
+  const float sx = iw / (float)ow, sy = ih / (float)oh;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, out)
+#endif
+  for(int j = 0; j < oh; j++)
+  {
+    const int y0 = MIN(j * sy, ih - 1), y1 = CLAMP((int)((j + 1) * sy), y0 + 1, ih);
+    for(int i = 0; i < ow; i++)
+    {
+      const int x0 = MIN(i * sx, iw - 1), x1 = CLAMP((int)((i + 1) * sx), x0 + 1, iw);
+      float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for(int y = y0; y < y1; y++)
+        for(int x = x0; x < x1; x++)
+          for(int c = 0; c < 4; c++) sum[c] += in[4 * ((size_t)y * iw + x) + c];
+      const float norm = 1.0f / ((x1 - x0) * (y1 - y0));
+      for(int c = 0; c < 4; c++) out[4 * ((size_t)j * ow + i) + c] = sum[c] * norm;
+    }
+  }
+}
+
+int dt_imageio_export_renditions(const uint32_t imgid, dt_imageio_rendition_t *renditions, const int count,
+                                 const gboolean high_quality, const gboolean upscale,
+                                 const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
+                                 dt_imageio_module_data_t *storage_params, int num, int total)
+{
+  if(count <= 0) return 1;
+  for(int k = 0; k < count; k++) renditions[k].result = 1;
+
+  float *scaled = NULL;
+  uint8_t *outbuf = NULL;
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+
+  const dt_image_t *img = &dev.image_storage;
+
+  if(!buf.buf || !buf.width || !buf.height)
+  {
+    dt_control_log(_("image `%s' is not available!"), img->filename);
+    goto error_early;
+  }
+
+  // the pipe output has to be good enough for the most demanding format
+  int levels = 0, max_bpp = 0;
+  for(int k = 0; k < count; k++)
+  {
+    const int bpp = renditions[k].format->bpp(renditions[k].format_params);
+    if(bpp > max_bpp)
+    {
+      max_bpp = bpp;
+      levels = renditions[k].format->levels(renditions[k].format_params);
+    }
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, img->width, img->height, levels))
+  {
+    dt_control_log(
+        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+        C_("noun", "export"));
+    goto error;
+  }
+
+  // all renditions share the processing, so they share the style of the first one, too
+  dt_imageio_module_data_t *const first_params = renditions[0].format_params;
+  if(first_params->style[0] != '\0' && _export_apply_style(&dev, first_params)) goto error;
+
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  dt_show_times(&start, "[export] creating pixelpipe", NULL);
+
+  const int sRGB = _export_is_srgb(&dev);
+
+  // run the pipe once, for the largest rendition
+  const float max_scale = upscale ? 100.0 : 1.0;
+  double scale = 0.0;
+  for(int k = 0; k < count; k++)
+  {
+    const int width = renditions[k].max_width;
+    const int height = renditions[k].max_height;
+    const double scalex = width > 0 ? fminf(width / (double)pipe.processed_width, max_scale) : 1.0;
+    const double scaley = height > 0 ? fminf(height / (double)pipe.processed_height, max_scale) : 1.0;
+    scale = fmax(scale, fmin(scalex, scaley));
+  }
+
+  const int processed_width = scale * pipe.processed_width + .5f;
+  const int processed_height = scale * pipe.processed_height + .5f;
+
+  dt_get_times(&start);
+  dt_dev_pixelpipe_iop_t *finalscale = NULL;
+  if(scale >= 1.0 || !high_quality)
+  {
+    // downsampling right after demosaic, see dt_imageio_export_with_flags()
+    for(GList *nodes = g_list_last(pipe.nodes); nodes; nodes = g_list_previous(nodes))
+    {
+      dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
+      if(!strcmp(node->module->op, "finalscale"))
+      {
+        finalscale = node;
+        break;
+      }
+    }
+  }
+  if(finalscale) finalscale->enabled = 0;
+  dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+  if(finalscale) finalscale->enabled = 1;
+  dt_show_times(&start, "[dev_process_export] pixel pipeline processing", NULL);
+
+  const float *const pipe_out = (const float *)pipe.backbuf;
+  if(!pipe_out) goto error;
+
+  // then derive all the renditions from its output
+  for(int k = 0; k < count; k++)
+  {
+    dt_imageio_rendition_t *r = renditions + k;
+    const int width = r->max_width;
+    const int height = r->max_height;
+    const double scalex = width > 0 ? fminf(width / (double)processed_width, 1.0f) : 1.0;
+    const double scaley = height > 0 ? fminf(height / (double)processed_height, 1.0f) : 1.0;
+    const double rscale = fmin(scalex, scaley);
+    const int wd = MAX(1, (int)(rscale * processed_width + .5f));
+    const int ht = MAX(1, (int)(rscale * processed_height + .5f));
+    const size_t pixels = (size_t)wd * ht;
+
+    const float *in = pipe_out;
+    if(wd != processed_width || ht != processed_height)
+    {
+      scaled = (float *)dt_alloc_align(16, pixels * 4 * sizeof(float));
+      if(!scaled) goto error;
+      _export_downscale(pipe_out, processed_width, processed_height, scaled, wd, ht);
+      in = scaled;
+    }
+
+    const int bpp = r->format->bpp(r->format_params);
+    outbuf = (uint8_t *)dt_alloc_align(16, pixels * 4 * MAX(1, bpp / 8));
+    if(!outbuf) goto error;
+    if(bpp == 8)
+    {
+      for(size_t p = 0; p < pixels; p++)
+        for(int c = 0; c < 3; c++) outbuf[4 * p + c] = CLAMP(in[4 * p + c] * 0xff, 0, 0xff);
+    }
+    else if(bpp == 16)
+    {
+      uint16_t *buf16 = (uint16_t *)outbuf;
+      for(size_t p = 0; p < pixels; p++)
+        for(int c = 0; c < 3; c++) buf16[4 * p + c] = CLAMP(in[4 * p + c] * 0x10000, 0, 0xffff);
+    }
+    else
+      memcpy(outbuf, in, pixels * 4 * sizeof(float));
+
+    dt_free_align(scaled);
+    scaled = NULL;
+
+    r->format_params->width = r->width = wd;
+    r->format_params->height = r->height = ht;
+
+    int length;
+    uint8_t *exif_profile = NULL;
+    char pathname[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+    length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, wd, ht, 0);
+    r->result = r->format->write_image(r->format_params, r->filename, outbuf, exif_profile, length, imgid, num,
+                                       total);
+    free(exif_profile);
+    dt_free_align(outbuf);
+    outbuf = NULL;
+
+    if(r->result) continue;
+
+    if(copy_metadata && (r->format->flags(r->format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+      dt_exif_xmp_attach(imgid, r->filename);
+
+    if(strcmp(r->format->mime(r->format_params), "memory")
+       && !(r->format->flags(r->format_params) & FORMAT_FLAGS_NO_TMPFILE))
+    {
+      dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, r->filename, r->format,
+                              r->format_params, storage, storage_params);
+    }
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+
+  for(int k = 0; k < count; k++)
+    if(renditions[k].result) return 1;
+  return 0;
+
+error:
+  dt_free_align(scaled);
+  dt_free_align(outbuf);
+  dt_dev_pixelpipe_cleanup(&pipe);
+error_early:
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  return 1;
+}
+
 // fallback read method in case file could not be opened yet.
 // use GraphicsMagick (if supported) to read exotic LDRs
 dt_imageio_retval_t dt_imageio_open_exotic(dt_image_t *img, const char *filename,
@@ -931,14 +1269,17 @@ dt_imageio_retval_t dt_imageio_open(dt_image_t *img,               // non-const
                                     const char *filename,          // full path
                                     dt_mipmap_buffer_t *buf)
 {
-  /* first of all, check if file exists, don't bother to test loading if not exists */
-  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) return !DT_IMAGEIO_OK;
+  /* map the file once for all loaders. if that's not possible, check if the file exists at all, don't
+     bother to test loading if not. the loaders will read it on their own then. */
+  dt_imageio_map_t *map = dt_imageio_map_file(filename);
+  if(!map && !g_file_test(filename, G_FILE_TEST_IS_REGULAR)) return !DT_IMAGEIO_OK;
 
   dt_imageio_retval_t ret = DT_IMAGEIO_FILE_CORRUPTED;
   img->loader = LOADER_UNKNOWN;
 
   /* check if file is ldr using magic's */
-  if(dt_imageio_is_ldr(filename)) ret = dt_imageio_open_ldr(img, filename, buf);
+  if(map ? dt_imageio_is_ldr_mem(map->data, map->size) : dt_imageio_is_ldr(filename))
+    ret = dt_imageio_open_ldr(img, filename, map, buf);
 
   /* silly check using file extensions: */
   if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL && dt_imageio_is_hdr(filename))
@@ -947,7 +1288,7 @@ dt_imageio_retval_t dt_imageio_open(dt_image_t *img,               // non-const
   /* use rawspeed to load the raw */
   if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
   {
-    ret = dt_imageio_open_rawspeed(img, filename, buf);
+    ret = dt_imageio_open_rawspeed(img, filename, map, buf);
     if(ret == DT_IMAGEIO_OK) img->loader = LOADER_RAWSPEED;
   }
 
@@ -955,6 +1296,7 @@ dt_imageio_retval_t dt_imageio_open(dt_image_t *img,               // non-const
   if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
     ret = dt_imageio_open_exotic(img, filename, buf);
 
+  dt_imageio_unmap_file(map);
   return ret;
 }
 
@@ -50,13 +50,33 @@ typedef enum dt_imageio_levels_t
   IMAGEIO_CHANNEL_MASK = 0xFF00
 } dt_imageio_levels_t;
 
+// zero bytes that are safe to read past the end of a mapped file, rawspeed's bit pumps want some
+#define DT_IMAGEIO_MAP_PADDING 16
+
+// the input file, mapped into memory once per load and handed to all loaders that can read from memory.
+// that way sniffing the format and trying several loaders doesn't read and copy the file over and over.
+typedef struct dt_imageio_map_t
+{
+  GMappedFile *file;
+  const uint8_t *data;
+  size_t size;
+  gboolean padded; // DT_IMAGEIO_MAP_PADDING zeros can be read past data + size
+} dt_imageio_map_t;
+
+// maps a regular, non-empty file read-only. returns NULL if that's not possible.
+dt_imageio_map_t *dt_imageio_map_file(const char *filename);
+void dt_imageio_unmap_file(dt_imageio_map_t *map);
+
 // Checks that the image is indeed an ldr image
 gboolean dt_imageio_is_ldr(const char *filename);
+// same, looking at the first bytes of the file which are already in memory
+gboolean dt_imageio_is_ldr_mem(const uint8_t *data, const size_t size);
 
 // opens the file using pfm, hdr, exr.
 dt_imageio_retval_t dt_imageio_open_hdr(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
-// opens file using imagemagick
-dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
+// opens file using the ldr loaders, from map if that isn't NULL
+dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, const dt_imageio_map_t *map,
+                                        dt_mipmap_buffer_t *buf);
 // try all the options in sequence
 dt_imageio_retval_t dt_imageio_open(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
 // tries to open the files not opened by the other routines using GraphicsMagick (if supported)
@@ -78,6 +98,24 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
                                  dt_imageio_module_data_t *storage_params, int num, int total);
 
+/** one output of dt_imageio_export_renditions() */
+typedef struct dt_imageio_rendition_t
+{
+  const char *filename;
+  struct dt_imageio_module_format_t *format;
+  struct dt_imageio_module_data_t *format_params;
+  int max_width, max_height; // 0 for unbounded, like in format_params
+  int width, height;         // out: size of the written image
+  int result;                // out: 0 on success
+} dt_imageio_rendition_t;
+
+/** export several renditions of one image, running the pixelpipe only once for the largest of them and
+ *  downscaling its output for the others. all renditions share the style of the first one. */
+int dt_imageio_export_renditions(const uint32_t imgid, dt_imageio_rendition_t *renditions, const int count,
+                                 const gboolean high_quality, const gboolean upscale,
+                                 const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
+                                 dt_imageio_module_data_t *storage_params, int num, int total);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
@@ -97,7 +135,10 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
                                           const dt_image_orientation_t orientation);
 
 // allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
-int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+// where the thumbnail was found is remembered for imgid, pass -1 if the image isn't in the library.
+// min_size is the longer side it's going to be shown at, 0 if that's not known.
+int dt_imageio_large_thumbnail(const char *filename, const int32_t imgid, const int min_size,
+                               uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
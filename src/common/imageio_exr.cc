@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
 #include <memory>
 #include <stdio.h>
 #include <string.h>
@@ -186,6 +187,99 @@ dt_imageio_retval_t dt_imageio_open_exr(dt_image_t *img, const char *filename, d
   return DT_IMAGEIO_OK;
 }
 
+static inline uint8_t _linear_to_srgb_8(float v)
+{
+  // half floats can be inf or nan, which the clamp doesn't catch
+  if(!std::isfinite(v)) v = 0.0f;
+  const float c = v <= 0.0031308f ? 12.92f * v : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+  return (uint8_t)CLAMP(c * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+int dt_imageio_exr_thumbnail(const char *filename, const int min_width, const int min_height, uint8_t **buffer,
+                             int32_t *width, int32_t *height, dt_colorspaces_color_profile_type_t *color_space)
+{
+  bool isTiled = false;
+  if(!Imf::isOpenExrFile(filename, isTiled) || !isTiled) return 1;
+
+  Imf::setGlobalThreadCount(dt_get_num_threads());
+
+  float *tmp = NULL;
+  try
+  {
+    Imf::TiledInputFile file(filename);
+    const Imf::Header &header = file.header();
+    const Imf::TileDescription &tiles = header.tileDescription();
+    if(tiles.mode == Imf::ONE_LEVEL) return 1;
+    // we'd need colorin to get anything else right
+    if(Imf::hasChromaticities(header)) return 1;
+    for(Imf::ChannelList::ConstIterator i = header.channels().begin(); i != header.channels().end(); ++i)
+      if(i.name()[0] != 'R' && i.name()[0] != 'G' && i.name()[0] != 'B' && i.name()[0] != 'A') return 1;
+
+    // the smallest level that's still large enough. rip maps can pick the direction independently.
+    int lx = 0, ly = 0;
+    if(tiles.mode == Imf::MIPMAP_LEVELS)
+    {
+      while(lx + 1 < file.numLevels() && file.levelWidth(lx + 1) >= min_width
+            && file.levelHeight(lx + 1) >= min_height)
+        lx++;
+      ly = lx;
+    }
+    else
+    {
+      while(lx + 1 < file.numXLevels() && file.levelWidth(lx + 1) >= min_width) lx++;
+      while(ly + 1 < file.numYLevels() && file.levelHeight(ly + 1) >= min_height) ly++;
+    }
+
+    // only decode the tiles of that level
+    const Imath::Box2i dw = file.dataWindowForLevel(lx, ly);
+    const int wd = dw.max.x - dw.min.x + 1;
+    const int ht = dw.max.y - dw.min.y + 1;
+    tmp = (float *)dt_alloc_align(16, (size_t)4 * sizeof(float) * wd * ht);
+    if(!tmp) return 1;
+    for(size_t k = 0; k < (size_t)4 * wd * ht; k++) tmp[k] = 0.0f;
+
+    const size_t xstride = sizeof(float) * 4;
+    const size_t ystride = sizeof(float) * wd * 4;
+    // slices are addressed in level coordinates, which start at the data window origin
+    char *base = (char *)tmp - dw.min.x * xstride - dw.min.y * ystride;
+    Imf::FrameBuffer frameBuffer;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, base + 0 * sizeof(float), xstride, ystride, 1, 1, 0.0));
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, base + 1 * sizeof(float), xstride, ystride, 1, 1, 0.0));
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, base + 2 * sizeof(float), xstride, ystride, 1, 1, 0.0));
+    file.setFrameBuffer(frameBuffer);
+    file.readTiles(0, file.numXTiles(lx) - 1, 0, file.numYTiles(ly) - 1, lx, ly);
+
+    *buffer = (uint8_t *)malloc((size_t)4 * wd * ht);
+    if(!*buffer)
+    {
+      dt_free_align(tmp);
+      return 1;
+    }
+    uint8_t *out = *buffer;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(tmp, out) firstprivate(wd, ht)
+#endif
+    for(size_t k = 0; k < (size_t)wd * ht; k++)
+    {
+      for(int c = 0; c < 3; c++) out[4 * k + c] = _linear_to_srgb_8(tmp[4 * k + c]);
+      out[4 * k + 3] = 0;
+    }
+    dt_free_align(tmp);
+
+    *width = wd;
+    *height = ht;
+    // no chromaticities means rec709 primaries, so this is sRGB now
+    *color_space = DT_COLORSPACE_SRGB;
+    return 0;
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr_thumbnail] %s\n", e.what());
+    dt_free_align(tmp);
+    return 1;
+  }
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "common/colorspaces.h"
 #include "common/image.h"
 #include "common/mipmap_cache.h"
 
@@ -28,6 +29,12 @@ extern "C" {
 
 dt_imageio_retval_t dt_imageio_open_exr(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
 
+/** decode the smallest mip level of a tiled exr that still covers min_width x min_height into an 8-bit rgba
+ * buffer (allocated by the function), like dt_imageio_large_thumbnail() does for embedded jpegs. only works
+ * for files with mip levels and plain rec709 primaries, returns != 0 otherwise. */
+int dt_imageio_exr_thumbnail(const char *filename, const int min_width, const int min_height, uint8_t **buffer,
+                             int32_t *width, int32_t *height, dt_colorspaces_color_profile_type_t *color_space);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,8 @@
 #include "common/exif.h"
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
+#include "common/imageio_jpeg_stripes.h"
+#include "control/conf.h"
 #include <setjmp.h>
 
 // error functions
@@ -128,6 +130,8 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
   jpg->src.term_source = dt_imageio_jpeg_term_source;
   jpg->src.next_input_byte = (JOCTET *)in;
   jpg->src.bytes_in_buffer = length;
+  jpg->mem = (const uint8_t *)in;
+  jpg->mem_length = length;
 
   struct dt_imageio_jpeg_error_mgr jerr;
   jpg->dinfo.err = jpeg_std_error(&jerr.pub);
@@ -195,6 +199,16 @@ static int decompress_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
 
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
+  // our own thumbnails are written in stripes with restart markers, those we can decode in parallel
+  if(jpg->mem && !dt_imageio_jpeg_stripes_decompress(jpg->mem, jpg->mem_length, out))
+  {
+    jpeg_destroy_decompress(&(jpg->dinfo));
+    return 0;
+  }
+  // decode those the same way when we can't do it in parallel
+  if(jpg->mem && dt_imageio_jpeg_stripes_tagged(jpg->mem, jpg->mem_length))
+    jpg->dinfo.do_fancy_upsampling = FALSE;
+
   struct dt_imageio_jpeg_error_mgr jerr;
   jpg->dinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
@@ -260,6 +274,23 @@ int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
   return 0;
 }
 
+typedef struct dt_imageio_jpeg_write_t
+{
+  int quality;
+  const uint8_t *icc;
+  uint32_t icc_len;
+  const void *exif;
+  int exif_len;
+} dt_imageio_jpeg_write_t;
+
+static void _jpeg_write_setup(j_compress_ptr cinfo, void *data)
+{
+  const dt_imageio_jpeg_write_t *w = (dt_imageio_jpeg_write_t *)data;
+  jpeg_set_quality(cinfo, w->quality, TRUE);
+  if(w->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(w->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+}
+
 int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, const int height,
                              const int quality)
 {
@@ -271,6 +302,21 @@ int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, c
   jpg.dest.next_output_byte = (JOCTET *)out;
   jpg.dest.free_in_buffer = 4 * width * height * sizeof(uint8_t);
 
+  // encode in parallel if the user wants that and the image is large enough
+  dt_imageio_jpeg_write_t w = { quality, NULL, 0, NULL, 0 };
+  size_t length = 0;
+  dt_imageio_jpeg_stripes_t *stripes
+      = dt_conf_get_bool("plugins/imageio/format/jpeg/parallel")
+            ? dt_imageio_jpeg_stripes_begin_mem(out, jpg.dest.free_in_buffer, &length, width, height,
+                                                _jpeg_write_setup, NULL, &w)
+            : NULL;
+  if(stripes)
+  {
+    // if that doesn't fit, or fails otherwise, try again the plain way
+    const int failed = dt_imageio_jpeg_stripes_rows(stripes, in, height);
+    if(!dt_imageio_jpeg_stripes_end(stripes, failed)) return length;
+  }
+
   jpg.cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
   if(setjmp(jerr.setjmp_buffer))
@@ -286,9 +332,7 @@ int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, c
   jpg.cinfo.input_components = 3;
   jpg.cinfo.in_color_space = JCS_RGB;
   jpeg_set_defaults(&(jpg.cinfo));
-  jpeg_set_quality(&(jpg.cinfo), quality, TRUE);
-  if(quality > 90) jpg.cinfo.comp_info[0].v_samp_factor = 1;
-  if(quality > 92) jpg.cinfo.comp_info[0].h_samp_factor = 1;
+  _jpeg_write_setup(&(jpg.cinfo), &w);
   jpeg_start_compress(&(jpg.cinfo), TRUE);
   uint8_t *row = malloc((size_t)3 * width * sizeof(uint8_t));
   const uint8_t *buf;
@@ -493,23 +537,64 @@ static boolean read_icc_profile(j_decompress_ptr dinfo, JOCTET **icc_data_ptr, u
 #undef MAX_SEQ_NO
 
 
+static void _jpeg_write_markers(j_compress_ptr cinfo, void *data)
+{
+  const dt_imageio_jpeg_write_t *w = (dt_imageio_jpeg_write_t *)data;
+  if(w->icc) write_icc_profile(cinfo, w->icc, w->icc_len);
+  if(w->exif && w->exif_len > 0 && w->exif_len < 65534)
+    jpeg_write_marker(cinfo, JPEG_APP0 + 1, w->exif, w->exif_len);
+}
+
 int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *in, const int width,
                                            const int height, const int quality, const void *exif, int exif_len,
                                            int imgid)
 {
   struct dt_imageio_jpeg_error_mgr jerr;
   dt_imageio_jpeg_t jpg;
+  dt_imageio_jpeg_write_t w = { quality, NULL, 0, exif, exif_len };
+
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return 1;
+
+  unsigned char *icc = NULL;
+  if(imgid > 0)
+  {
+    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid)->profile;
+    uint32_t len = 0;
+    cmsSaveProfileToMem(out_profile, 0, &len);
+    if(len > 0)
+    {
+      icc = malloc((size_t)len * sizeof(unsigned char));
+      cmsSaveProfileToMem(out_profile, icc, &len);
+      w.icc = icc;
+      w.icc_len = len;
+    }
+  }
+
+  // encode in parallel if the user wants that and the image is large enough
+  dt_imageio_jpeg_stripes_t *stripes
+      = dt_conf_get_bool("plugins/imageio/format/jpeg/parallel")
+            ? dt_imageio_jpeg_stripes_begin(f, width, height, _jpeg_write_setup, _jpeg_write_markers, &w)
+            : NULL;
+  if(stripes)
+  {
+    const int failed = dt_imageio_jpeg_stripes_rows(stripes, in, height);
+    const int res = dt_imageio_jpeg_stripes_end(stripes, failed);
+    fclose(f);
+    free(icc);
+    return res;
+  }
 
   jpg.cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
   if(setjmp(jerr.setjmp_buffer))
   {
     jpeg_destroy_compress(&(jpg.cinfo));
+    fclose(f);
+    free(icc);
     return 1;
   }
   jpeg_create_compress(&(jpg.cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
   jpeg_stdio_dest(&(jpg.cinfo), f);
 
   jpg.cinfo.image_width = width;
@@ -517,26 +602,10 @@ int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *
   jpg.cinfo.input_components = 3;
   jpg.cinfo.in_color_space = JCS_RGB;
   jpeg_set_defaults(&(jpg.cinfo));
-  jpeg_set_quality(&(jpg.cinfo), quality, TRUE);
-  if(quality > 90) jpg.cinfo.comp_info[0].v_samp_factor = 1;
-  if(quality > 92) jpg.cinfo.comp_info[0].h_samp_factor = 1;
+  _jpeg_write_setup(&(jpg.cinfo), &w);
   jpeg_start_compress(&(jpg.cinfo), TRUE);
 
-  if(imgid > 0)
-  {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid)->profile;
-    uint32_t len = 0;
-    cmsSaveProfileToMem(out_profile, 0, &len);
-    if(len > 0)
-    {
-      unsigned char *buf = malloc((size_t)len * sizeof(unsigned char));
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg.cinfo), buf, len);
-      free(buf);
-    }
-  }
-
-  if(exif && exif_len > 0 && exif_len < 65534) jpeg_write_marker(&(jpg.cinfo), JPEG_APP0 + 1, exif, exif_len);
+  _jpeg_write_markers(&(jpg.cinfo), &w);
 
   uint8_t *row = malloc((size_t)3 * width * sizeof(uint8_t));
   const uint8_t *buf;
@@ -553,6 +622,7 @@ int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *
   free(row);
   jpeg_destroy_compress(&(jpg.cinfo));
   fclose(f);
+  free(icc);
   return 0;
 }
 
@@ -722,7 +792,8 @@ dt_colorspaces_color_profile_type_t dt_imageio_jpeg_read_color_space(dt_imageio_
   return DT_COLORSPACE_DISPLAY; // nothing embedded
 }
 
-dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *mbuf)
+dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename, const dt_imageio_map_t *map,
+                                         dt_mipmap_buffer_t *mbuf)
 {
   const char *ext = filename + strlen(filename);
   while(*ext != '.' && ext > filename) ext--;
@@ -733,12 +804,18 @@ dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename,
   if(!img->exif_inited) (void)dt_exif_read(img, filename);
 
   dt_imageio_jpeg_t jpg;
-  if(dt_imageio_jpeg_read_header(filename, &jpg)) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(map)
+  {
+    // decode straight from the mapped file, that's also what allows decoding stripes in parallel
+    if(dt_imageio_jpeg_decompress_header(map->data, map->size, &jpg)) return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+  else if(dt_imageio_jpeg_read_header(filename, &jpg))
+    return DT_IMAGEIO_FILE_CORRUPTED;
   img->width = jpg.width;
   img->height = jpg.height;
 
   uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t) * jpg.width * jpg.height * 4);
-  if(dt_imageio_jpeg_read(&jpg, tmp))
+  if(map ? dt_imageio_jpeg_decompress(&jpg, tmp) : dt_imageio_jpeg_read(&jpg, tmp))
   {
     free(tmp);
     return DT_IMAGEIO_FILE_CORRUPTED;
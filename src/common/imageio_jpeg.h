@@ -40,6 +40,8 @@ typedef struct dt_imageio_jpeg_t
   struct jpeg_decompress_struct dinfo;
   struct jpeg_compress_struct cinfo;
   FILE *f;
+  const uint8_t *mem; // the compressed data when decompressing from memory
+  size_t mem_length;
 } dt_imageio_jpeg_t;
 
 /** reads the header and fills width/height in jpg struct. */
@@ -47,7 +49,8 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
 /** reads the whole image to the out buffer, which has to be large enough. */
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out);
 /** compresses in to out buffer with given quality (0..100). out buffer must be large enough. returns actual
- * data length. */
+ * data length. with plugins/imageio/format/jpeg/parallel set, large images are encoded in parallel
+ * stripes. */
 int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, const int height,
                              const int quality);
 
@@ -67,8 +70,10 @@ int dt_imageio_jpeg_read_profile(dt_imageio_jpeg_t *jpg, uint8_t **out);
 /** return the color space of the image, this only distinguishs between sRGB, AdobeRGB and unknown. used for mipmaps */
 dt_colorspaces_color_profile_type_t dt_imageio_jpeg_read_color_space(dt_imageio_jpeg_t *jpg);
 
-/** utility function to read and open jpeg from imagio.c */
-dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
+struct dt_imageio_map_t;
+/** utility function to read and open jpeg from imagio.c, decodes from map if that isn't NULL. */
+dt_imageio_retval_t dt_imageio_open_jpeg(dt_image_t *img, const char *filename,
+                                         const struct dt_imageio_map_t *map, dt_mipmap_buffer_t *buf);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -0,0 +1,594 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_jpeg_stripes.h"
+#include "common/darktable.h"
+
+#include <jerror.h>
+#include <setjmp.h>
+#include <string.h>
+
+#define M_SOF0 0xc0
+#define M_SOF1 0xc1
+#define M_DHT 0xc4
+#define M_RST0 0xd0
+#define M_EOI 0xd9
+#define M_SOS 0xda
+#define M_DQT 0xdb
+#define M_DRI 0xdd
+#define M_APP15 0xef
+
+// tags the files written here, only those are decoded in stripes. camera jpegs with restart markers would
+// be cut into hundreds of tiny ones.
+static const uint8_t _stripes_tag[] = { 0xff, M_APP15, 0, 19, 'd', 'a', 'r', 'k', 't', 'a', 'b', 'l', 'e',
+                                        ' ', 's', 't', 'r', 'i', 'p', 'e', 's' };
+
+// error handling, every stripe has its own
+
+typedef struct _stripes_error_mgr_t
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+} _stripes_error_mgr_t;
+
+static void _stripes_error_exit(j_common_ptr cinfo)
+{
+  _stripes_error_mgr_t *err = (_stripes_error_mgr_t *)cinfo->err;
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(err->setjmp_buffer, 1);
+}
+
+// destination manager writing into a growing memory buffer
+
+typedef struct _stripes_dest_t
+{
+  struct jpeg_destination_mgr pub;
+  uint8_t *buf;
+  size_t size, len;
+} _stripes_dest_t;
+
+static void _stripes_init_destination(j_compress_ptr cinfo)
+{
+  _stripes_dest_t *dest = (_stripes_dest_t *)cinfo->dest;
+  dest->pub.next_output_byte = dest->buf;
+  dest->pub.free_in_buffer = dest->size;
+}
+
+static boolean _stripes_empty_output_buffer(j_compress_ptr cinfo)
+{
+  _stripes_dest_t *dest = (_stripes_dest_t *)cinfo->dest;
+  uint8_t *buf = realloc(dest->buf, 2 * dest->size);
+  if(!buf) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  dest->buf = buf;
+  dest->pub.next_output_byte = buf + dest->size;
+  dest->pub.free_in_buffer = dest->size;
+  dest->size *= 2;
+  return TRUE;
+}
+
+static void _stripes_term_destination(j_compress_ptr cinfo)
+{
+  _stripes_dest_t *dest = (_stripes_dest_t *)cinfo->dest;
+  dest->len = dest->size - dest->pub.free_in_buffer;
+}
+
+// source manager reading from memory
+
+static void _stripes_init_source(j_decompress_ptr cinfo)
+{
+}
+
+static boolean _stripes_fill_input_buffer(j_decompress_ptr cinfo)
+{
+  // premature end of data, insert a fake EOI so libjpeg can finish gracefully
+  static const JOCTET eoi[2] = { 0xff, M_EOI };
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void _stripes_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+  if(num_bytes <= 0) return;
+  if((size_t)num_bytes > cinfo->src->bytes_in_buffer) num_bytes = cinfo->src->bytes_in_buffer;
+  cinfo->src->next_input_byte += num_bytes;
+  cinfo->src->bytes_in_buffer -= num_bytes;
+}
+
+static void _stripes_term_source(j_decompress_ptr cinfo)
+{
+}
+
+// find the marker segment in the headers of buf, returns its offset or -1
+static ssize_t _stripes_find_marker(const uint8_t *buf, const size_t len, const uint8_t marker)
+{
+  size_t p = 2; // skip SOI
+  while(p + 4 <= len && buf[p] == 0xff)
+  {
+    if(buf[p + 1] == marker) return p;
+    if(buf[p + 1] == M_SOS) return -1; // the headers end here
+    p += 2 + ((buf[p + 2] << 8) | buf[p + 3]);
+  }
+  return -1;
+}
+
+struct dt_imageio_jpeg_stripes_t
+{
+  FILE *f;          // the file we write to, or
+  uint8_t *out;     // the memory buffer of out_size bytes, *out_len of which are used
+  size_t out_size, *out_len;
+  int width, height;
+  dt_imageio_jpeg_stripes_setup_t setup;
+  dt_imageio_jpeg_stripes_markers_t markers;
+  void *data;
+
+  int stripe_rows;  // pixel rows per stripe, always whole MCU rows
+  int interval;     // MCUs per stripe, the restart interval
+  int batch;        // number of stripes encoded in parallel
+  int pending_rows; // rows waiting in pending
+  int done_stripes; // stripes written to f so far
+  uint8_t *pending; // batch * stripe_rows rows of packed rgb
+  _stripes_dest_t *dest; // the encoded stripes of the batch
+};
+
+static void _stripes_set_params(const dt_imageio_jpeg_stripes_t *s, j_compress_ptr cinfo, const int height)
+{
+  cinfo->image_width = s->width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  s->setup(cinfo, s->data);
+  // the stripes have to share the huffman tables, and must not have restart markers of their own
+  cinfo->optimize_coding = FALSE;
+  cinfo->restart_interval = 0;
+  cinfo->restart_in_rows = 0;
+}
+
+static dt_imageio_jpeg_stripes_t *_stripes_begin(FILE *f, uint8_t *out, const size_t out_size,
+                                                 size_t *out_len, const int width, const int height,
+                                                 dt_imageio_jpeg_stripes_setup_t setup,
+                                                 dt_imageio_jpeg_stripes_markers_t markers, void *data)
+{
+  const int threads = dt_get_num_threads();
+  if(threads < 2 || width > JPEG_MAX_DIMENSION || height > JPEG_MAX_DIMENSION) return NULL;
+
+  dt_imageio_jpeg_stripes_t *s = (dt_imageio_jpeg_stripes_t *)calloc(1, sizeof(dt_imageio_jpeg_stripes_t));
+  s->f = f;
+  s->out = out;
+  s->out_size = out_size;
+  s->out_len = out_len;
+  if(out_len) *out_len = 0;
+  s->width = width;
+  s->height = height;
+  s->setup = setup;
+  s->markers = markers;
+  s->data = data;
+
+  // find out about the size of an MCU with the parameters the caller wants
+  struct jpeg_compress_struct cinfo;
+  _stripes_error_mgr_t jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = _stripes_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    free(s);
+    return NULL;
+  }
+  jpeg_create_compress(&cinfo);
+  _stripes_set_params(s, &cinfo, height);
+  int max_h = 1, max_v = 1;
+  for(int k = 0; k < cinfo.num_components; k++)
+  {
+    max_h = MAX(max_h, cinfo.comp_info[k].h_samp_factor);
+    max_v = MAX(max_v, cinfo.comp_info[k].v_samp_factor);
+  }
+  jpeg_destroy_compress(&cinfo);
+
+  const int mcu_height = 8 * max_v;
+  const int mcus_per_row = (width + 8 * max_h - 1) / (8 * max_h);
+  const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+  // a few stripes per thread to even out the load, but a stripe has to fit into one restart interval
+  const int mcu_rows_per_stripe = MIN(MAX(1, mcu_rows / (4 * threads)), 65535 / mcus_per_row);
+  if(mcu_rows_per_stripe < 1 || mcu_rows < 2 * threads)
+  {
+    free(s);
+    return NULL;
+  }
+
+  s->stripe_rows = mcu_rows_per_stripe * mcu_height;
+  s->interval = mcu_rows_per_stripe * mcus_per_row;
+  s->batch = 2 * threads;
+  s->pending = malloc((size_t)3 * width * s->stripe_rows * s->batch);
+  s->dest = (_stripes_dest_t *)calloc(s->batch, sizeof(_stripes_dest_t));
+  if(!s->pending || !s->dest)
+  {
+    free(s->pending);
+    free(s->dest);
+    free(s);
+    return NULL;
+  }
+  for(int k = 0; k < s->batch; k++)
+  {
+    _stripes_dest_t *dest = s->dest + k;
+    dest->pub.init_destination = _stripes_init_destination;
+    dest->pub.empty_output_buffer = _stripes_empty_output_buffer;
+    dest->pub.term_destination = _stripes_term_destination;
+    // grows on demand, this is enough for most stripes
+    dest->size = (size_t)width * s->stripe_rows + 65536;
+    dest->buf = malloc(dest->size);
+    if(!dest->buf)
+    {
+      dt_imageio_jpeg_stripes_end(s, 1);
+      return NULL;
+    }
+  }
+  return s;
+}
+
+dt_imageio_jpeg_stripes_t *dt_imageio_jpeg_stripes_begin(FILE *f, const int width, const int height,
+                                                         dt_imageio_jpeg_stripes_setup_t setup,
+                                                         dt_imageio_jpeg_stripes_markers_t markers,
+                                                         void *data)
+{
+  return _stripes_begin(f, NULL, 0, NULL, width, height, setup, markers, data);
+}
+
+dt_imageio_jpeg_stripes_t *dt_imageio_jpeg_stripes_begin_mem(uint8_t *out, const size_t size, size_t *length,
+                                                             const int width, const int height,
+                                                             dt_imageio_jpeg_stripes_setup_t setup,
+                                                             dt_imageio_jpeg_stripes_markers_t markers,
+                                                             void *data)
+{
+  return _stripes_begin(NULL, out, size, length, width, height, setup, markers, data);
+}
+
+// encode one stripe of the pending rows into its own little jpeg
+static int _stripes_encode(const dt_imageio_jpeg_stripes_t *s, const int k, const int rows)
+{
+  struct jpeg_compress_struct cinfo;
+  _stripes_error_mgr_t jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = _stripes_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+  cinfo.dest = &s->dest[k].pub;
+  _stripes_set_params(s, &cinfo, rows);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  // only the headers of the very first stripe end up in the file
+  if(s->done_stripes + k == 0 && s->markers) s->markers(&cinfo, s->data);
+
+  const uint8_t *in = s->pending + (size_t)3 * s->width * s->stripe_rows * k;
+  for(int j = 0; j < rows; j++)
+  {
+    JSAMPROW row = (JSAMPROW)(in + (size_t)3 * s->width * j);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+// append len bytes to the file or the memory buffer, returns != 0 if they don't fit
+static int _stripes_put(dt_imageio_jpeg_stripes_t *s, const void *buf, const size_t len)
+{
+  if(s->f) return fwrite(buf, 1, len, s->f) != len;
+  if(len > s->out_size - *s->out_len) return 1;
+  memcpy(s->out + *s->out_len, buf, len);
+  *s->out_len += len;
+  return 0;
+}
+
+// append an encoded stripe to the output
+static int _stripes_write(dt_imageio_jpeg_stripes_t *s, const _stripes_dest_t *dest)
+{
+  const uint8_t *buf = dest->buf;
+  const size_t len = dest->len;
+  const ssize_t sos_pos = _stripes_find_marker(buf, len, M_SOS);
+  if(sos_pos < 0) return 1;
+  const size_t sos = sos_pos;
+  const size_t data = sos + 2 + ((buf[sos + 2] << 8) | buf[sos + 3]);
+  if(data + 2 > len) return 1;
+
+  int failed = 0;
+  if(s->done_stripes == 0)
+  {
+    // the headers of the first stripe become the ones of the image, with the real height and the restart
+    // interval added in front of the scan header
+    const ssize_t sof_pos = _stripes_find_marker(buf, len, M_SOF0);
+    if(sof_pos < 0) return 1;
+    const size_t sof = sof_pos;
+    const uint8_t height[2] = { s->height >> 8, s->height & 0xff };
+    const uint8_t dri[6] = { 0xff, M_DRI, 0, 4, s->interval >> 8, s->interval & 0xff };
+    failed |= _stripes_put(s, buf, sof + 5);
+    failed |= _stripes_put(s, height, 2);
+    failed |= _stripes_put(s, buf + sof + 7, sos - sof - 7);
+    failed |= _stripes_put(s, _stripes_tag, sizeof(_stripes_tag));
+    failed |= _stripes_put(s, dri, 6);
+    failed |= _stripes_put(s, buf + sos, data - sos);
+  }
+  else
+  {
+    const uint8_t rst[2] = { 0xff, M_RST0 + ((s->done_stripes - 1) & 7) };
+    failed |= _stripes_put(s, rst, 2);
+  }
+  // the entropy coded data is byte aligned and padded already, we only drop the EOI
+  failed |= _stripes_put(s, buf + data, len - 2 - data);
+  s->done_stripes++;
+  return failed;
+}
+
+// encode the pending rows in parallel and write them out
+static int _stripes_flush(dt_imageio_jpeg_stripes_t *s)
+{
+  const int stripes = (s->pending_rows + s->stripe_rows - 1) / s->stripe_rows;
+  int failed = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(s, failed)
+#endif
+  for(int k = 0; k < stripes; k++)
+  {
+    const int rows = MIN(s->stripe_rows, s->pending_rows - k * s->stripe_rows);
+    if(_stripes_encode(s, k, rows)) failed = 1;
+  }
+
+  for(int k = 0; !failed && k < stripes; k++) failed = _stripes_write(s, s->dest + k);
+
+  s->pending_rows = 0;
+  return failed;
+}
+
+int dt_imageio_jpeg_stripes_rows(dt_imageio_jpeg_stripes_t *s, const uint8_t *in, const int rows)
+{
+  const int batch_rows = s->batch * s->stripe_rows;
+  for(int j = 0; j < rows; j++)
+  {
+    const uint8_t *i = in + (size_t)4 * s->width * j;
+    uint8_t *o = s->pending + (size_t)3 * s->width * s->pending_rows;
+    for(int x = 0; x < s->width; x++, i += 4, o += 3) memcpy(o, i, 3);
+    if(++s->pending_rows == batch_rows && _stripes_flush(s)) return 1;
+  }
+  return 0;
+}
+
+int dt_imageio_jpeg_stripes_end(dt_imageio_jpeg_stripes_t *s, const int failed)
+{
+  int rc = failed;
+  if(!rc && s->pending_rows > 0) rc = _stripes_flush(s);
+  if(!rc)
+  {
+    const uint8_t eoi[2] = { 0xff, M_EOI };
+    rc = _stripes_put(s, eoi, 2);
+  }
+  for(int k = 0; k < s->batch; k++) free(s->dest[k].buf);
+  free(s->dest);
+  free(s->pending);
+  free(s);
+  return rc;
+}
+
+// decode one stripe, given as a standalone jpeg in buf, to rows of rgbx
+static int _stripes_decode(const uint8_t *buf, const size_t len, uint8_t *out, const int width, const int rows)
+{
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_source_mgr src;
+  _stripes_error_mgr_t jerr;
+  uint8_t *row = malloc((size_t)3 * width);
+  if(!row) return 1;
+  dinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = _stripes_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_decompress(&dinfo);
+    free(row);
+    return 1;
+  }
+  jpeg_create_decompress(&dinfo);
+  src.init_source = _stripes_init_source;
+  src.fill_input_buffer = _stripes_fill_input_buffer;
+  src.skip_input_data = _stripes_skip_input_data;
+  src.resync_to_restart = jpeg_resync_to_restart;
+  src.term_source = _stripes_term_source;
+  src.next_input_byte = buf;
+  src.bytes_in_buffer = len;
+  dinfo.src = &src;
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.out_color_space = JCS_RGB;
+  // fancy upsampling would have to look across the stripe borders
+  dinfo.do_fancy_upsampling = FALSE;
+  jpeg_start_decompress(&dinfo);
+  if((int)dinfo.output_width != width || (int)dinfo.output_height != rows || dinfo.output_components != 3)
+    longjmp(jerr.setjmp_buffer, 1);
+  while(dinfo.output_scanline < dinfo.output_height)
+  {
+    uint8_t *o = out + (size_t)4 * width * dinfo.output_scanline;
+    if(jpeg_read_scanlines(&dinfo, &row, 1) != 1) longjmp(jerr.setjmp_buffer, 1);
+    for(int x = 0; x < width; x++)
+    {
+      o[4 * x + 0] = row[3 * x + 0];
+      o[4 * x + 1] = row[3 * x + 1];
+      o[4 * x + 2] = row[3 * x + 2];
+      o[4 * x + 3] = 0xff;
+    }
+  }
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  free(row);
+  return 0;
+}
+
+int dt_imageio_jpeg_stripes_tagged(const uint8_t *in, const size_t length)
+{
+  if(length < 4 || in[0] != 0xff || in[1] != 0xd8) return 0;
+  size_t p = 2;
+  while(p + 4 <= length && in[p] == 0xff && in[p + 1] != M_SOS)
+  {
+    const size_t seglen = 2 + ((in[p + 2] << 8) | in[p + 3]);
+    if(in[p + 1] == M_APP15 && seglen == sizeof(_stripes_tag) && p + seglen <= length
+       && !memcmp(in + p, _stripes_tag, sizeof(_stripes_tag)))
+      return 1;
+    p += seglen;
+  }
+  return 0;
+}
+
+int dt_imageio_jpeg_stripes_decompress(const uint8_t *in, const size_t length, uint8_t *out)
+{
+  if(dt_get_num_threads() < 2 || length < 4 || in[0] != 0xff || in[1] != 0xd8) return 1;
+
+  // walk the headers, we want one of our files: a baseline frame with a restart interval and one interleaved
+  // scan. the tables, the frame and the scan header are all a stripe needs, so that's what we keep of them.
+  size_t sof = 0, sos = 0, keep[16];
+  int interval = 0, ours = 0, num_keep = 0;
+  size_t p = 2;
+  while(p + 4 <= length && in[p] == 0xff)
+  {
+    const uint8_t m = in[p + 1];
+    const size_t seglen = 2 + ((in[p + 2] << 8) | in[p + 3]);
+    if(m == M_SOF0 || m == M_SOF1)
+      sof = p;
+    else if(m > M_SOF1 && m <= 0xcf && m != M_DHT && m != 0xc8 && m != 0xcc)
+      return 1; // progressive, lossless or arithmetic coding
+    else if(m == M_DRI && p + 6 <= length)
+      interval = (in[p + 4] << 8) | in[p + 5];
+    else if(m == M_APP15 && seglen == sizeof(_stripes_tag) && p + seglen <= length)
+      ours = !memcmp(in + p, _stripes_tag, sizeof(_stripes_tag));
+    else if(m == M_SOS)
+    {
+      sos = p;
+      break;
+    }
+    if(m == M_SOF0 || m == M_SOF1 || m == M_DHT || m == M_DQT)
+    {
+      if(num_keep == 16) return 1;
+      keep[num_keep++] = p;
+    }
+    p += seglen;
+  }
+  if(!ours || !sof || !sos || interval == 0 || sof + 10 > length) return 1;
+  const size_t data = sos + 2 + ((in[sos + 2] << 8) | in[sos + 3]);
+  if(data >= length) return 1;
+
+  const int height = (in[sof + 5] << 8) | in[sof + 6];
+  const int width = (in[sof + 7] << 8) | in[sof + 8];
+  const int ncomp = in[sof + 9];
+  if(sof + 10 + 3 * ncomp > length || in[sos + 4] != ncomp || width == 0 || height == 0) return 1;
+  int max_h = 1, max_v = 1;
+  for(int c = 0; c < ncomp; c++)
+  {
+    max_h = MAX(max_h, in[sof + 11 + 3 * c] >> 4);
+    max_v = MAX(max_v, in[sof + 11 + 3 * c] & 0xf);
+  }
+  const int mcus_per_row = (width + 8 * max_h - 1) / (8 * max_h);
+  if(interval % mcus_per_row) return 1; // restart intervals don't cover whole rows
+  const int stripe_rows = interval / mcus_per_row * 8 * max_v;
+  const int stripes = (height + stripe_rows - 1) / stripe_rows;
+  if(stripes < 2) return 1;
+
+  // SOI, the kept segments and the scan header make up the headers of every stripe
+  uint8_t *header = malloc(data);
+  if(!header) return 1;
+  size_t header_len = 2, stripe_sof = 0;
+  header[0] = 0xff;
+  header[1] = 0xd8;
+  for(int k = 0; k < num_keep; k++)
+  {
+    const size_t seglen = 2 + ((in[keep[k] + 2] << 8) | in[keep[k] + 3]);
+    if(keep[k] == sof) stripe_sof = header_len;
+    memcpy(header + header_len, in + keep[k], seglen);
+    header_len += seglen;
+  }
+  memcpy(header + header_len, in + sos, data - sos);
+  header_len += data - sos;
+
+  // find the entropy coded segments between the restart markers
+  size_t *start = malloc(sizeof(size_t) * stripes);
+  size_t *end = malloc(sizeof(size_t) * stripes);
+  int n = 0, complete = 0;
+  start[n] = data;
+  for(size_t i = data; i + 1 < length; i++)
+  {
+    if(in[i] != 0xff || in[i + 1] == 0x00 || in[i + 1] == 0xff) continue; // data, stuffed byte or fill
+    const uint8_t m = in[i + 1];
+    if(m == M_RST0 + (n & 7) && n + 1 < stripes)
+    {
+      end[n++] = i;
+      start[n] = i + 2;
+      i++;
+    }
+    else
+    {
+      // everything else is the end of the scan, good if it's where we expect it
+      if(m == M_EOI && n + 1 == stripes)
+      {
+        end[n++] = i;
+        complete = 1;
+      }
+      break;
+    }
+  }
+  if(!complete)
+  {
+    free(header);
+    free(start);
+    free(end);
+    return 1;
+  }
+
+  // decode the stripes as separate images: the headers with the height patched, one segment, EOI
+  int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(in, out, start, end, header, failed)
+#endif
+  for(int k = 0; k < stripes; k++)
+  {
+    const int rows = MIN(stripe_rows, height - k * stripe_rows);
+    const size_t seglen = end[k] - start[k];
+    uint8_t *buf = malloc(header_len + seglen + 2);
+    if(!buf)
+    {
+      failed = 1;
+      continue;
+    }
+    memcpy(buf, header, header_len);
+    buf[stripe_sof + 5] = rows >> 8;
+    buf[stripe_sof + 6] = rows & 0xff;
+    memcpy(buf + header_len, in + start[k], seglen);
+    buf[header_len + seglen] = 0xff;
+    buf[header_len + seglen + 1] = M_EOI;
+    if(_stripes_decode(buf, header_len + seglen + 2, out + (size_t)4 * width * stripe_rows * k, width, rows))
+      failed = 1;
+    free(buf);
+  }
+
+  free(header);
+  free(start);
+  free(end);
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,73 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+// this fixes a rather annoying, long time bug in libjpeg :(
+#undef HAVE_STDLIB_H
+#undef HAVE_STDDEF_H
+#include <jpeglib.h>
+#undef HAVE_STDLIB_H
+#undef HAVE_STDDEF_H
+
+/*
+ * parallel jpeg coding. the image is cut into horizontal stripes of whole MCU rows, every stripe is encoded
+ * on its own (with the standard huffman tables) and the entropy coded segments are stitched together with
+ * restart markers in between. the result is a perfectly normal baseline jpeg, and files written like that
+ * (one restart interval per stripe) can be decoded in parallel again.
+ */
+
+typedef struct dt_imageio_jpeg_stripes_t dt_imageio_jpeg_stripes_t;
+
+/** sets up the compression parameters after jpeg_set_defaults(), like quality and sampling factors. */
+typedef void (*dt_imageio_jpeg_stripes_setup_t)(j_compress_ptr cinfo, void *data);
+/** writes extra markers (icc profile, exif) right after jpeg_start_compress(). */
+typedef void (*dt_imageio_jpeg_stripes_markers_t)(j_compress_ptr cinfo, void *data);
+
+/** start writing a width x height image to f. returns NULL if the image is too small to be worth it, or
+ * can't be split, the caller is expected to use plain libjpeg then. */
+dt_imageio_jpeg_stripes_t *dt_imageio_jpeg_stripes_begin(FILE *f, const int width, const int height,
+                                                         dt_imageio_jpeg_stripes_setup_t setup,
+                                                         dt_imageio_jpeg_stripes_markers_t markers,
+                                                         void *data);
+/** the same, but writes into the size bytes at out. *length is the size of the jpeg after
+ * dt_imageio_jpeg_stripes_end(), which fails if it doesn't fit. */
+dt_imageio_jpeg_stripes_t *dt_imageio_jpeg_stripes_begin_mem(uint8_t *out, const size_t size, size_t *length,
+                                                             const int width, const int height,
+                                                             dt_imageio_jpeg_stripes_setup_t setup,
+                                                             dt_imageio_jpeg_stripes_markers_t markers,
+                                                             void *data);
+/** feed the next rows of 8-bit rgbx pixels, in order. returns != 0 on error. */
+int dt_imageio_jpeg_stripes_rows(dt_imageio_jpeg_stripes_t *s, const uint8_t *in, const int rows);
+/** encode what's left and finish the file (which isn't closed). returns != 0 on error. */
+int dt_imageio_jpeg_stripes_end(dt_imageio_jpeg_stripes_t *s, const int failed);
+
+/** whether the jpeg in memory has been written by dt_imageio_jpeg_stripes_begin() and friends. the stripes
+ * are decoded without fancy upsampling, so a serial decoder has to turn that off as well to get the same
+ * pixels. */
+int dt_imageio_jpeg_stripes_tagged(const uint8_t *in, const size_t length);
+/** decode a jpeg in memory into 8-bit rgbx, if it has been written by dt_imageio_jpeg_stripes_begin() and
+ * friends, which tag their files. returns != 0 if that's not the case or decoding failed, in which case nothing is known about out. */
+int dt_imageio_jpeg_stripes_decompress(const uint8_t *in, const size_t length, uint8_t *out);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -116,6 +116,11 @@ typedef struct dt_imageio_module_format_t
   /* write to file, with exif if not NULL, and icc profile if supported. */
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
                      int exif_len, int imgid, int num, int total);
+  /* optional: write the image in bands of rows, see imageio_format_api.h */
+  void *(*write_image_begin)(dt_imageio_module_data_t *data, const char *filename, void *exif, int exif_len,
+                             int imgid, int num, int total);
+  int (*write_image_rows)(dt_imageio_module_data_t *data, void *handle, const void *in, int y, int rows);
+  int (*write_image_end)(dt_imageio_module_data_t *data, void *handle, int failed);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
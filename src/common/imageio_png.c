@@ -37,53 +37,84 @@ typedef struct dt_imageio_png_t
   int color_type, bit_depth;
   int bpp;
   FILE *f;
+  const uint8_t *mem; // the mapped file, if we don't read through f
+  size_t mem_length, mem_pos;
   png_structp png_ptr;
   png_infop info_ptr;
 } dt_imageio_png_t;
 
-
-int read_header(const char *filename, dt_imageio_png_t *png)
+static void _png_close(dt_imageio_png_t *png)
 {
-  png->f = g_fopen(filename, "rb");
+  if(png->f) fclose(png->f);
+  png->f = NULL;
+}
 
-  if(!png->f) return 1;
+static void _png_read_mem(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+  dt_imageio_png_t *png = (dt_imageio_png_t *)png_get_io_ptr(png_ptr);
+  if(length > png->mem_length - png->mem_pos) png_error(png_ptr, "read past the end of the file");
+  memcpy(data, png->mem + png->mem_pos, length);
+  png->mem_pos += length;
+}
 
+int read_header(const char *filename, const dt_imageio_map_t *map, dt_imageio_png_t *png)
+{
 #define NUM_BYTES_CHECK (8)
 
-  png_byte dat[NUM_BYTES_CHECK];
+  png->f = NULL;
+  png->mem = NULL;
+  if(map)
+  {
+    if(map->size < NUM_BYTES_CHECK || png_sig_cmp((png_bytep)map->data, (png_size_t)0, NUM_BYTES_CHECK))
+      return 1;
+    png->mem = map->data;
+    png->mem_length = map->size;
+    png->mem_pos = NUM_BYTES_CHECK;
+  }
+  else
+  {
+    png->f = g_fopen(filename, "rb");
+
+    if(!png->f) return 1;
 
-  size_t cnt = fread(dat, 1, NUM_BYTES_CHECK, png->f);
+    png_byte dat[NUM_BYTES_CHECK];
 
-  if(cnt != NUM_BYTES_CHECK || png_sig_cmp(dat, (png_size_t)0, NUM_BYTES_CHECK))
-  {
-    fclose(png->f);
-    return 1;
+    size_t cnt = fread(dat, 1, NUM_BYTES_CHECK, png->f);
+
+    if(cnt != NUM_BYTES_CHECK || png_sig_cmp(dat, (png_size_t)0, NUM_BYTES_CHECK))
+    {
+      _png_close(png);
+      return 1;
+    }
   }
 
   png->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 
   if(!png->png_ptr)
   {
-    fclose(png->f);
+    _png_close(png);
     return 1;
   }
 
   png->info_ptr = png_create_info_struct(png->png_ptr);
   if(!png->info_ptr)
   {
-    fclose(png->f);
+    _png_close(png);
     png_destroy_read_struct(&png->png_ptr, NULL, NULL);
     return 1;
   }
 
   if(setjmp(png_jmpbuf(png->png_ptr)))
   {
-    fclose(png->f);
+    _png_close(png);
     png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
     return 1;
   }
 
-  png_init_io(png->png_ptr, png->f);
+  if(png->mem)
+    png_set_read_fn(png->png_ptr, png, _png_read_mem);
+  else
+    png_init_io(png->png_ptr, png->f);
 
   // we checked some bytes
   png_set_sig_bytes(png->png_ptr, NUM_BYTES_CHECK);
@@ -130,7 +161,7 @@ int read_image(dt_imageio_png_t *png, void *out)
 {
   if(setjmp(png_jmpbuf(png->png_ptr)))
   {
-    fclose(png->f);
+    _png_close(png);
     png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
     return 1;
   }
@@ -151,13 +182,14 @@ int read_image(dt_imageio_png_t *png, void *out)
   png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
 
   free(row_pointers);
-  fclose(png->f);
+  _png_close(png);
   return 0;
 }
 
 
 
-dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *mbuf)
+dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, const dt_imageio_map_t *map,
+                                        dt_mipmap_buffer_t *mbuf)
 {
   const char *ext = filename + strlen(filename);
   while(*ext != '.' && ext > filename) ext--;
@@ -170,7 +202,7 @@ dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, d
   uint16_t bpp;
 
 
-  if(read_header(filename, &image) != 0) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(read_header(filename, map, &image) != 0) return DT_IMAGEIO_FILE_CORRUPTED;
 
   width = img->width = image.width;
   height = img->height = image.height;
@@ -182,7 +214,7 @@ dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, d
   float *mipbuf = (float *)dt_mipmap_cache_alloc(mbuf, img);
   if(!mipbuf)
   {
-    fclose(image.f);
+    _png_close(&image);
     png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
     fprintf(stderr, "[png_open] could not alloc full buffer for image `%s'\n", img->filename);
     return DT_IMAGEIO_CACHE_FULL;
@@ -192,7 +224,7 @@ dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, d
 
   if(!buf)
   {
-    fclose(image.f);
+    _png_close(&image);
     png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
     fprintf(stderr, "[png_open] could not alloc intermediate buffer for image `%s'\n", img->filename);
     return DT_IMAGEIO_CACHE_FULL;
@@ -237,7 +269,7 @@ int dt_imageio_png_read_profile(const char *filename, uint8_t **out)
 
   if(!(filename && *filename && out)) return 0;
 
-  if(read_header(filename, &image) != 0) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(read_header(filename, NULL, &image) != 0) return DT_IMAGEIO_FILE_CORRUPTED;
 
 #ifdef PNG_iCCP_SUPPORTED
   if(png_get_valid(image.png_ptr, image.info_ptr, PNG_INFO_iCCP) != 0
@@ -251,7 +283,7 @@ int dt_imageio_png_read_profile(const char *filename, uint8_t **out)
     proflen = 0;
 
   png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
-  fclose(image.f);
+  _png_close(&image);
 
   return proflen;
 }
@@ -21,7 +21,10 @@
 #include "common/image.h"
 #include "common/mipmap_cache.h"
 
-dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
+struct dt_imageio_map_t;
+/** reads the png from map if that isn't NULL, from filename otherwise. */
+dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename,
+                                        const struct dt_imageio_map_t *map, dt_mipmap_buffer_t *buf);
 int dt_imageio_png_read_profile(const char *filename, uint8_t **out);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -0,0 +1,292 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_preview.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/imageio.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// limits to get out of broken or malicious files quickly
+#define DT_PREVIEW_MAX_IFDS 32
+#define DT_PREVIEW_MAX_ENTRIES 1024
+// a jpeg which is smaller than this on its longer side is the exif thumbnail, not a preview. for orf, rw2 or
+// pef that's all the ifds have, and exiv2 finds the real one in the maker notes.
+#define DT_PREVIEW_MIN_SIZE 640
+
+typedef struct _preview_tiff_t
+{
+  const uint8_t *data; // start of the tiff header, offsets are relative to that
+  size_t size;
+  int big_endian;
+  uint32_t ifds[DT_PREVIEW_MAX_IFDS]; // to be visited
+  int num_ifds;
+  // best candidate so far
+  size_t offset, length;
+  uint64_t pixels;
+} _preview_tiff_t;
+
+static inline uint32_t _get16(const _preview_tiff_t *t, const size_t pos)
+{
+  if(pos + 2 > t->size) return 0;
+  const uint8_t *p = t->data + pos;
+  return t->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static inline uint32_t _get32(const _preview_tiff_t *t, const size_t pos)
+{
+  if(pos + 4 > t->size) return 0;
+  const uint8_t *p = t->data + pos;
+  return t->big_endian ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+                       : ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+// the value of a single SHORT or LONG entry
+static inline uint32_t _entry_value(const _preview_tiff_t *t, const size_t entry)
+{
+  return _get16(t, entry + 2) == 3 ? _get16(t, entry + 8) : _get32(t, entry + 8);
+}
+
+static void _queue_ifd(_preview_tiff_t *t, const uint32_t ifd)
+{
+  if(ifd == 0 || ifd >= t->size || t->num_ifds >= DT_PREVIEW_MAX_IFDS) return;
+  for(int k = 0; k < t->num_ifds; k++)
+    if(t->ifds[k] == ifd) return;
+  t->ifds[t->num_ifds++] = ifd;
+}
+
+// check that there is a baseline or progressive jpeg at data and get its size. that weeds out the lossless
+// jpegs holding the raw data in cr2 and dng, which also look like jpeg strips in the ifds.
+static int _jpeg_size(const uint8_t *data, const size_t size, uint32_t *width, uint32_t *height)
+{
+  if(size < 4 || data[0] != 0xff || data[1] != 0xd8) return 1;
+  size_t pos = 2;
+  while(pos + 4 <= size)
+  {
+    if(data[pos] != 0xff) return 1;
+    const uint8_t marker = data[pos + 1];
+    if(marker == 0xff)
+    {
+      pos++; // fill byte
+      continue;
+    }
+    const size_t len = (data[pos + 2] << 8) | data[pos + 3];
+    if(marker == 0xc0 || marker == 0xc1 || marker == 0xc2)
+    {
+      if(pos + 9 > size) return 1;
+      *height = (data[pos + 5] << 8) | data[pos + 6];
+      *width = (data[pos + 7] << 8) | data[pos + 8];
+      return *width == 0 || *height == 0;
+    }
+    // lossless, arithmetic coded or hierarchical: nothing we or libjpeg can show. image data without a
+    // frame header is broken.
+    if((marker >= 0xc3 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) || marker == 0xda)
+      return 1;
+    pos += 2 + len;
+  }
+  return 1;
+}
+
+static void _candidate(_preview_tiff_t *t, const size_t offset, const size_t length)
+{
+  if(offset == 0 || length == 0 || offset >= t->size || length > t->size - offset) return;
+  uint32_t width = 0, height = 0;
+  if(_jpeg_size(t->data + offset, length, &width, &height)) return;
+  const uint64_t pixels = (uint64_t)width * height;
+  if(pixels > t->pixels)
+  {
+    t->offset = offset;
+    t->length = length;
+    t->pixels = pixels;
+  }
+}
+
+static void _walk_ifd(_preview_tiff_t *t, const uint32_t ifd)
+{
+  const uint32_t entries = _get16(t, ifd);
+  if(entries == 0 || entries > DT_PREVIEW_MAX_ENTRIES) return;
+
+  uint32_t jpeg_offset = 0, jpeg_length = 0;
+  uint32_t compression = 0, strip_offset = 0, strip_length = 0;
+  for(uint32_t e = 0; e < entries; e++)
+  {
+    const size_t entry = ifd + 2 + 12 * e;
+    if(entry + 12 > t->size) return;
+    const uint32_t tag = _get16(t, entry);
+    const uint32_t count = _get32(t, entry + 4);
+    switch(tag)
+    {
+      case 0x0103: // Compression
+        compression = _entry_value(t, entry);
+        break;
+      case 0x0111: // StripOffsets, previews come in one strip
+        if(count == 1) strip_offset = _entry_value(t, entry);
+        break;
+      case 0x0117: // StripByteCounts
+        if(count == 1) strip_length = _entry_value(t, entry);
+        break;
+      case 0x0201: // JPEGInterchangeFormat
+        jpeg_offset = _entry_value(t, entry);
+        break;
+      case 0x0202: // JPEGInterchangeFormatLength
+        jpeg_length = _entry_value(t, entry);
+        break;
+      case 0x014a: // SubIFDs
+        if(count == 1)
+          _queue_ifd(t, _get32(t, entry + 8));
+        else
+        {
+          const uint32_t list = _get32(t, entry + 8);
+          for(uint32_t k = 0; k < count && k < DT_PREVIEW_MAX_IFDS; k++) _queue_ifd(t, _get32(t, list + 4 * k));
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  // next ifd in the chain
+  _queue_ifd(t, _get32(t, ifd + 2 + 12 * entries));
+
+  _candidate(t, jpeg_offset, jpeg_length);
+  // old and new style jpeg compression
+  if(compression == 6 || compression == 7) _candidate(t, strip_offset, strip_length);
+}
+
+int dt_imageio_preview_locate(const uint8_t *data, const size_t size, size_t *offset, size_t *length)
+{
+  if(size < 16) return 1;
+
+  // fuji keeps the preview in its own header
+  if(size >= 92 && !memcmp(data, "FUJIFILMCCD-RAW ", 16))
+  {
+    _preview_tiff_t t = { .data = data, .size = size, .big_endian = 1 };
+    _candidate(&t, _get32(&t, 84), _get32(&t, 88));
+    if(!t.pixels) return 1;
+    *offset = t.offset;
+    *length = t.length;
+    return 0;
+  }
+
+  _preview_tiff_t t = { .data = data, .size = size };
+  if(data[0] == 'I' && data[1] == 'I')
+    t.big_endian = 0;
+  else if(data[0] == 'M' && data[1] == 'M')
+    t.big_endian = 1;
+  else
+    return 1;
+  // tiff, olympus (IIRO, IIRS, MMOR) and panasonic have their own magic numbers, the ifds look the same
+  const uint32_t magic = _get16(&t, 2);
+  if(magic != 42 && magic != 0x4f52 && magic != 0x5352 && magic != 0x55) return 1;
+
+  _queue_ifd(&t, _get32(&t, 4));
+  for(int k = 0; k < t.num_ifds; k++) _walk_ifd(&t, t.ifds[k]);
+
+  if(!t.pixels) return 1;
+  *offset = t.offset;
+  *length = t.length;
+  return 0;
+}
+
+// whether the jpeg of length bytes at offset is large enough to be worth showing for a request of min_size
+static gboolean _preview_large_enough(const dt_imageio_map_t *map, const size_t offset, const size_t length,
+                                      const int min_size)
+{
+  uint32_t width = 0, height = 0;
+  if(_jpeg_size(map->data + offset, length, &width, &height)) return FALSE;
+  const uint32_t wanted = min_size > 0 ? MIN(min_size, DT_PREVIEW_MIN_SIZE) : DT_PREVIEW_MIN_SIZE;
+  return MAX(width, height) >= wanted;
+}
+
+int dt_imageio_preview_get(const int32_t imgid, const char *filename, const int min_size, uint8_t **buffer,
+                           size_t *size)
+{
+  dt_imageio_map_t *map = dt_imageio_map_file(filename);
+  if(!map) return 1;
+
+  sqlite3_stmt *stmt;
+  size_t offset = 0, length = 0;
+  gboolean cached = FALSE;
+  if(imgid > 0)
+  {
+    // only trust what we found before if the file didn't change size since
+    sqlite3 *handle = dt_database_get_reader(darktable.db);
+    DT_DEBUG_SQLITE3_PREPARE_V2(handle,
+                                "SELECT jpeg_offset, jpeg_length FROM main.embedded_previews WHERE imgid = ?1 AND file_size = ?2",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    DT_DEBUG_SQLITE3_BIND_INT64(stmt, 2, map->size);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      offset = sqlite3_column_int64(stmt, 0);
+      length = sqlite3_column_int64(stmt, 1);
+      cached = offset < map->size && length >= 2 && length <= map->size - offset
+               && map->data[offset] == 0xff && map->data[offset + 1] == 0xd8;
+    }
+    sqlite3_finalize(stmt);
+    dt_database_release_reader(darktable.db, handle);
+  }
+
+  if(!cached)
+  {
+    if(dt_imageio_preview_locate(map->data, map->size, &offset, &length)) offset = length = 0;
+    if(imgid > 0 && length == 0)
+    {
+      // nothing for us in here, but don't remember that: a later version might know where to look
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "DELETE FROM main.embedded_previews WHERE imgid = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+    else if(imgid > 0)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "INSERT OR REPLACE INTO main.embedded_previews (imgid, file_size, jpeg_offset, jpeg_length) "
+                                  "VALUES (?1, ?2, ?3, ?4)",
+                                  -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 2, map->size);
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 3, offset);
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 4, length);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+  }
+
+  // the best the ifds have might only be the exif thumbnail, exiv2 can do better then
+  int res = 1;
+  if(length > 0 && _preview_large_enough(map, offset, length, min_size))
+  {
+    *buffer = (uint8_t *)malloc(length);
+    if(*buffer)
+    {
+      memcpy(*buffer, map->data + offset, length);
+      *size = length;
+      res = 0;
+    }
+  }
+  dt_imageio_unmap_file(map);
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,41 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * finding the embedded jpeg previews of raw files without exiv2. a small walker over the tiff ifds (cr2, nef,
+ * arw, dng, pef, ...) and the raf header, which only looks at the places previews live in for the common
+ * containers. previews in maker notes (orf, rw2) aren't found, callers have to fall back to exiv2 then.
+ */
+
+/** find the largest baseline jpeg in the size bytes of data. returns 0 and sets offset and length on success. */
+int dt_imageio_preview_locate(const uint8_t *data, const size_t size, size_t *offset, size_t *length);
+
+/** copy the largest embedded jpeg of filename to a newly allocated buffer. the location is cached in the
+ * library for imgid, if that's > 0. returns != 0 if no preview could be found this way, or if it's smaller
+ * than min_size on its longer side and probably just the exif thumbnail. */
+int dt_imageio_preview_get(const int32_t imgid, const char *filename, const int min_size, uint8_t **buffer,
+                           size_t *size);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
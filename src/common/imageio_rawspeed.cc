@@ -110,7 +110,7 @@ uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint3
 }
 
 dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename,
-                                             dt_mipmap_buffer_t *mbuf)
+                                             const dt_imageio_map_t *map, dt_mipmap_buffer_t *mbuf)
 {
   if(!img->exif_inited) (void)dt_exif_read(img, filename);
 
@@ -125,7 +125,11 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    m = std::unique_ptr<Buffer>(f.readFile());
+    // decode from the mapped file without a copy, as long as the bit pumps can safely read over the end
+    if(map && map->padded)
+      m = std::unique_ptr<Buffer>(new Buffer(map->data, (uint32)map->size));
+    else
+      m = std::unique_ptr<Buffer>(f.readFile());
 
     RawParser t(m.get());
     d = std::unique_ptr<RawDecoder>(t.getDecoder(meta));
@@ -31,8 +31,10 @@ void dt_rawspeed_lookup_makermodel(const char *maker, const char *model,
 
 uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint32_t crop_y);
 
+struct dt_imageio_map_t;
+/** decodes the raw from map if that isn't NULL, from filename otherwise. */
 dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename,
-                                             dt_mipmap_buffer_t *buf);
+                                             const struct dt_imageio_map_t *map, dt_mipmap_buffer_t *buf);
 
 #ifdef __cplusplus
 }
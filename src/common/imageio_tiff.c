@@ -29,6 +29,12 @@
 #include <stdio.h>
 #include <strings.h>
 #include <tiffio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 typedef struct tiff_t
 {
@@ -41,101 +47,242 @@ typedef struct tiff_t
   uint32_t scanlinesize;
   dt_image_t *image;
   float *mipbuf;
-  tdata_t buf;
+  // the image is read in chunks, which are strips or tiles, independent of each other
+  int tiled;
+  uint32_t chunk_width, chunk_height;
+  uint32_t num_chunks;
+  tsize_t chunk_size;
 } tiff_t;
 
-static inline int _read_planar_8(tiff_t *t)
+// the conversions of one decoded row of w pixels with spp samples each to rgbx floats
+
+static inline void _convert_row_8(const uint8_t *in, float *out, const uint32_t w, const uint16_t spp)
 {
-  for(uint32_t row = 0; row < t->height; row++)
+  for(uint32_t i = 0; i < w; i++, in += spp, out += 4)
   {
-    uint8_t *in = ((uint8_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
-
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+    /* set rgb to first sample from scanline */
+    out[0] = ((float)in[0]) * (1.0f / 255.0f);
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+    if(spp == 1)
+    {
+      out[1] = out[2] = out[0];
+    }
+    else
     {
-      /* set rgb to first sample from scanline */
-      out[0] = ((float)in[0]) * (1.0f / 255.0f);
+      out[1] = ((float)in[1]) * (1.0f / 255.0f);
+      out[2] = ((float)in[2]) * (1.0f / 255.0f);
+    }
 
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 255.0f);
-        out[2] = ((float)in[2]) * (1.0f / 255.0f);
-      }
+    out[3] = 0;
+  }
+}
+
+static inline void _convert_row_16(const uint16_t *in, float *out, const uint32_t w, const uint16_t spp)
+{
+  for(uint32_t i = 0; i < w; i++, in += spp, out += 4)
+  {
+    out[0] = ((float)in[0]) * (1.0f / 65535.0f);
 
-      out[3] = 0;
+    if(spp == 1)
+    {
+      out[1] = out[2] = out[0];
+    }
+    else
+    {
+      out[1] = ((float)in[1]) * (1.0f / 65535.0f);
+      out[2] = ((float)in[2]) * (1.0f / 65535.0f);
     }
-  }
 
-  return 1;
+    out[3] = 0;
+  }
 }
 
-static inline int _read_planar_16(tiff_t *t)
+#if defined(__SSE2__)
+// one pixel per iteration. for 3 samples per pixel this reads one sample past the pixel, which is why the
+// chunk buffers have some slack at the end.
+static inline void _convert_row_16_sse2(const uint16_t *in, float *out, const uint32_t w, const uint16_t spp)
 {
-  for(uint32_t row = 0; row < t->height; row++)
+  if(spp == 1)
   {
-    uint16_t *in = ((uint16_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+    _convert_row_16(in, out, w, spp);
+    return;
+  }
+  const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+  const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  const __m128i zero = _mm_setzero_si128();
+  for(uint32_t i = 0; i < w; i++, in += spp, out += 4)
+  {
+    const __m128i px = _mm_loadl_epi64((const __m128i *)in);
+    const __m128 f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(px, zero));
+    _mm_store_ps(out, _mm_and_ps(_mm_mul_ps(f, scale), mask));
+  }
+}
+#endif
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+static inline void _convert_row_f(const float *in, float *out, const uint32_t w, const uint16_t spp)
+{
+  for(uint32_t i = 0; i < w; i++, in += spp, out += 4)
+  {
+    out[0] = in[0];
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+    if(spp == 1)
     {
-      out[0] = ((float)in[0]) * (1.0f / 65535.0f);
+      out[1] = out[2] = out[0];
+    }
+    else
+    {
+      out[1] = in[1];
+      out[2] = in[2];
+    }
 
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 65535.0f);
-        out[2] = ((float)in[2]) * (1.0f / 65535.0f);
-      }
+    out[3] = 0;
+  }
+}
 
-      out[3] = 0;
+// decode chunk c with tiff and convert it to its place in the mip buffer
+static int _read_chunk(const tiff_t *t, TIFF *tiff, const uint32_t c, uint8_t *buf)
+{
+  uint32_t x, y;
+  if(t->tiled)
+  {
+    const uint32_t across = (t->width + t->chunk_width - 1) / t->chunk_width;
+    x = (c % across) * t->chunk_width;
+    y = (c / across) * t->chunk_height;
+    if(TIFFReadEncodedTile(tiff, c, buf, t->chunk_size) == -1) return 1;
+  }
+  else
+  {
+    x = 0;
+    y = c * t->chunk_height;
+    if(TIFFReadEncodedStrip(tiff, c, buf, t->chunk_size) == -1) return 1;
+  }
+  const uint32_t w = MIN(t->chunk_width, t->width - x);
+  const uint32_t h = MIN(t->chunk_height, t->height - y);
+  // decoded tiles are always full size, strips are as wide as the image
+  const size_t stride = (size_t)t->chunk_width * t->spp * (t->bpp / 8);
+
+  for(uint32_t j = 0; j < h; j++)
+  {
+    const uint8_t *in = buf + j * stride;
+    float *out = t->mipbuf + (size_t)4 * ((size_t)(y + j) * t->width + x);
+    if(t->bpp == 8)
+      _convert_row_8(in, out, w, t->spp);
+    else if(t->bpp == 16)
+    {
+      if(darktable.codepath.OPENMP_SIMD)
+        _convert_row_16((const uint16_t *)in, out, w, t->spp);
+#if defined(__SSE2__)
+      else if(darktable.codepath.SSE2)
+        _convert_row_16_sse2((const uint16_t *)in, out, w, t->spp);
+#endif
+      else
+        dt_unreachable_codepath();
     }
+    else
+      _convert_row_f((const float *)in, out, w, t->spp);
   }
+  return 0;
+}
 
-  return 1;
+// read only io on a mapped file. libtiff uses the map proc to access uncompressed strips in place.
+typedef struct _tiff_mem_t
+{
+  const dt_imageio_map_t *map;
+  toff_t pos;
+} _tiff_mem_t;
+
+static tsize_t _tiff_mem_read(thandle_t handle, tdata_t buf, tsize_t size)
+{
+  _tiff_mem_t *m = (_tiff_mem_t *)handle;
+  if(m->pos >= m->map->size) return 0;
+  const tsize_t n = MIN(size, (tsize_t)(m->map->size - m->pos));
+  memcpy(buf, m->map->data + m->pos, n);
+  m->pos += n;
+  return n;
 }
 
-static inline int _read_planar_f(tiff_t *t)
+static tsize_t _tiff_mem_write(thandle_t handle, tdata_t buf, tsize_t size)
 {
-  for(uint32_t row = 0; row < t->height; row++)
-  {
-    float *in = ((float *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+  return 0;
+}
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+static toff_t _tiff_mem_seek(thandle_t handle, toff_t offset, int whence)
+{
+  _tiff_mem_t *m = (_tiff_mem_t *)handle;
+  if(whence == SEEK_CUR)
+    m->pos += offset;
+  else if(whence == SEEK_END)
+    m->pos = m->map->size + offset;
+  else
+    m->pos = offset;
+  return m->pos;
+}
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
-    {
-      out[0] = in[0];
+static int _tiff_mem_close(thandle_t handle)
+{
+  return 0;
+}
 
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = in[1];
-        out[2] = in[2];
-      }
+static toff_t _tiff_mem_size(thandle_t handle)
+{
+  return ((_tiff_mem_t *)handle)->map->size;
+}
 
-      out[3] = 0;
+static int _tiff_mem_map(thandle_t handle, tdata_t *base, toff_t *size)
+{
+  _tiff_mem_t *m = (_tiff_mem_t *)handle;
+  *base = (tdata_t)m->map->data;
+  *size = m->map->size;
+  return 1;
+}
+
+static void _tiff_mem_unmap(thandle_t handle, tdata_t base, toff_t size)
+{
+}
+
+static TIFF *_open(const char *filename, _tiff_mem_t *mem)
+{
+  if(mem->map)
+    return TIFFClientOpen(filename, "rb", (thandle_t)mem, _tiff_mem_read, _tiff_mem_write, _tiff_mem_seek,
+                          _tiff_mem_close, _tiff_mem_size, _tiff_mem_map, _tiff_mem_unmap);
+  else
+    return TIFFOpen(filename, "rb");
+}
+
+// strips and tiles are independent, so they are decoded in parallel. libtiff handles can't be shared
+// between threads, every thread opens its own, which is cheap on the mapped file.
+static int _read_chunks(tiff_t *t, const char *filename, const dt_imageio_map_t *map)
+{
+  int failed = 0;
+  const int threads = MIN(dt_get_num_threads(), (int)t->num_chunks);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads) default(none) shared(t, failed, filename, map)
+#endif
+  {
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num();
+#else
+    const int thread = 0;
+#endif
+    _tiff_mem_t mem = { map, 0 };
+    TIFF *tiff = thread == 0 ? t->tiff : _open(filename, &mem);
+    // slack for the sse code reading a bit further than the last pixel
+    uint8_t *buf = tiff ? (uint8_t *)_TIFFmalloc(t->chunk_size + 16) : NULL;
+    if(!buf) failed = 1;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for(uint32_t c = 0; c < t->num_chunks; c++)
+    {
+      if(failed) continue;
+      if(_read_chunk(t, tiff, c, buf)) failed = 1;
     }
-  }
 
-  return 1;
+    if(buf) _TIFFfree(buf);
+    if(tiff && thread != 0) TIFFClose(tiff);
+  }
+  return failed ? -1 : 1;
 }
 
 static void _warning_handler(const char* module, const char* fmt, va_list ap)
@@ -145,7 +292,8 @@ static void _warning_handler(const char* module, const char* fmt, va_list ap)
   fprintf(stderr, "\n");
 }
 
-dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *mbuf)
+dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename, const dt_imageio_map_t *map,
+                                         dt_mipmap_buffer_t *mbuf)
 {
   // doing this once would be enough, but our imageio reading code is
   // compiled into dt's core and doesn't have an init routine.
@@ -163,7 +311,9 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
 
   t.image = img;
 
-  if((t.tiff = TIFFOpen(filename, "rb")) == NULL) return DT_IMAGEIO_FILE_CORRUPTED;
+  // has to outlive t.tiff
+  _tiff_mem_t mem = { map, 0 };
+  if((t.tiff = _open(filename, &mem)) == NULL) return DT_IMAGEIO_FILE_CORRUPTED;
 
   TIFFGetField(t.tiff, TIFFTAG_IMAGEWIDTH, &t.width);
   TIFFGetField(t.tiff, TIFFTAG_IMAGELENGTH, &t.height);
@@ -172,11 +322,33 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
   TIFFGetFieldDefaulted(t.tiff, TIFFTAG_SAMPLEFORMAT, &t.sampleformat);
   TIFFGetField(t.tiff, TIFFTAG_PLANARCONFIG, &config);
 
-  if(TIFFRasterScanlineSize(t.tiff) != TIFFScanlineSize(t.tiff)) return DT_IMAGEIO_FILE_CORRUPTED;
+  if(TIFFRasterScanlineSize(t.tiff) != TIFFScanlineSize(t.tiff))
+  {
+    TIFFClose(t.tiff);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
 
   t.scanlinesize = TIFFScanlineSize(t.tiff);
 
-  dt_print(DT_DEBUG_CAMERA_SUPPORT, "[tiff_open] %dx%d %dbpp, %d samples per pixel.\n", t.width, t.height, t.bpp, t.spp);
+  t.tiled = TIFFIsTiled(t.tiff);
+  if(t.tiled)
+  {
+    TIFFGetField(t.tiff, TIFFTAG_TILEWIDTH, &t.chunk_width);
+    TIFFGetField(t.tiff, TIFFTAG_TILELENGTH, &t.chunk_height);
+    t.num_chunks = TIFFNumberOfTiles(t.tiff);
+    t.chunk_size = TIFFTileSize(t.tiff);
+  }
+  else
+  {
+    t.chunk_width = t.width;
+    TIFFGetFieldDefaulted(t.tiff, TIFFTAG_ROWSPERSTRIP, &t.chunk_height);
+    t.chunk_height = MIN(t.chunk_height, t.height);
+    t.num_chunks = TIFFNumberOfStrips(t.tiff);
+    t.chunk_size = TIFFStripSize(t.tiff);
+  }
+
+  dt_print(DT_DEBUG_CAMERA_SUPPORT, "[tiff_open] %dx%d %dbpp, %d samples per pixel, %d %s.\n", t.width, t.height,
+           t.bpp, t.spp, t.num_chunks, t.tiled ? "tiles" : "strips");
 
   // we only support 8/16 and 32 bits per pixel formats.
   if(t.bpp != 8 && t.bpp != 16 && t.bpp != 32)
@@ -192,6 +364,12 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
 
+  if(t.chunk_width == 0 || t.chunk_height == 0 || t.num_chunks == 0 || t.chunk_size <= 0)
+  {
+    TIFFClose(t.tiff);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+
   /* initialize cached image buffer */
   t.image->width = t.width;
   t.image->height = t.height;
@@ -215,27 +393,18 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
 
-  if((t.buf = _TIFFmalloc(t.scanlinesize)) == NULL)
-  {
-    TIFFClose(t.tiff);
-    return DT_IMAGEIO_CACHE_FULL;
-  }
-
   int ok = 1;
 
-  if(t.bpp == 8 && t.sampleformat == SAMPLEFORMAT_UINT && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_8(&t);
-  else if(t.bpp == 16 && t.sampleformat == SAMPLEFORMAT_UINT && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_16(&t);
-  else if(t.bpp == 32 && t.sampleformat == SAMPLEFORMAT_IEEEFP && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_f(&t);
+  if((t.bpp == 8 || t.bpp == 16) && t.sampleformat == SAMPLEFORMAT_UINT)
+    ok = _read_chunks(&t, filename, map);
+  else if(t.bpp == 32 && t.sampleformat == SAMPLEFORMAT_IEEEFP)
+    ok = _read_chunks(&t, filename, map);
   else
   {
     fprintf(stderr, "[tiff_open] error: Not a supported tiff image format.");
     ok = 0;
   }
 
-  _TIFFfree(t.buf);
   TIFFClose(t.tiff);
 
   return (ok == 1 ? DT_IMAGEIO_OK : DT_IMAGEIO_FILE_CORRUPTED);
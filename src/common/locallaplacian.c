@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/locallaplacian.h"
+#include "develop/pixelpipe_hb.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -469,7 +470,8 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    const int use_sse2)         // flag whether to use SSE version
+    const int use_sse2,         // flag whether to use SSE version
+    struct dt_dev_pixelpipe_t *pipe) // polled for early cancellation, may be NULL
 {
 #define max_levels 30
 #define num_gamma 6
@@ -520,6 +522,8 @@ void local_laplacian_internal(
   // willing to pay the cost).
   for(int k=0;k<num_gamma;k++)
   { // process images
+    // result would be discarded anyways, don't bother computing the rest:
+    if(pipe && dt_dev_pixelpipe_cancelled(pipe)) goto cancelled;
 #if defined(__SSE2__)
     if(use_sse2)
       apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
@@ -540,6 +544,7 @@ void local_laplacian_internal(
   // assemble output pyramid coarse to fine
   for(int l=num_levels-2;l >= 0; l--)
   {
+    if(pipe && dt_dev_pixelpipe_cancelled(pipe)) goto cancelled;
     const int pw = dl(w,l), ph = dl(h,l);
 
     gauss_expand(output[l+1], output[l], pw, ph);
@@ -573,6 +578,7 @@ void local_laplacian_internal(
     out[4*(j*wd+i)+1] = input[4*(j*wd+i)+1]; // copy original colour channels
     out[4*(j*wd+i)+2] = input[4*(j*wd+i)+2];
   }
+cancelled:
   // free all buffers!
   for(int l=0;l<max_levels;l++)
   {
@@ -17,6 +17,8 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+struct dt_dev_pixelpipe_t;
+
 void local_laplacian_internal(
     const float *const input,   // input buffer in some Labx or yuvx format
     float *const out,           // output buffer with colour
@@ -26,7 +28,8 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    const int use_sse2);        // switch on sse optimised version, if available
+    const int use_sse2,         // switch on sse optimised version, if available
+    struct dt_dev_pixelpipe_t *pipe); // polled for early cancellation, may be NULL
 
 void local_laplacian(
     const float *const input,   // input buffer in some Labx or yuvx format
@@ -36,9 +39,10 @@ void local_laplacian(
     const float sigma,          // user param: separate shadows/midtones/highlights
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
-    const float clarity)        // user param: increase clarity/local contrast
+    const float clarity,        // user param: increase clarity/local contrast
+    struct dt_dev_pixelpipe_t *pipe) // polled for early cancellation, may be NULL
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0, pipe);
 }
 
 #if defined(__SSE2__)
@@ -50,8 +54,9 @@ void local_laplacian_sse2(
     const float sigma,          // user param: separate shadows/midtones/highlights
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
-    const float clarity)        // user param: increase clarity/local contrast
+    const float clarity,        // user param: increase clarity/local contrast
+    struct dt_dev_pixelpipe_t *pipe) // polled for early cancellation, may be NULL
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1, pipe);
 }
 #endif
@@ -31,45 +31,43 @@ static void dt_metadata_set_xmp(int id, const char *key, const char *value)
 
   if(id == -1)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.meta_data WHERE id IN (SELECT imgid FROM main.selected_images) "
-                                "AND key = ?1",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(
+        darktable.db,
+        "DELETE FROM main.meta_data WHERE id IN (SELECT imgid FROM main.selected_images) "
+        "AND key = ?1");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keyid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
 
     if(value != NULL && value[0] != '\0')
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "INSERT INTO main.meta_data (id, key, value) SELECT imgid, ?1, ?2 FROM "
-                                  "main.selected_images",
-                                  -1, &stmt, NULL);
+      stmt = dt_database_get_statement(
+          darktable.db,
+          "INSERT INTO main.meta_data (id, key, value) SELECT imgid, ?1, ?2 FROM "
+          "main.selected_images");
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keyid);
       DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, value, -1, SQLITE_TRANSIENT);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_statement(darktable.db, stmt);
     }
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.meta_data WHERE id = ?1 AND key = ?2", -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db, "DELETE FROM main.meta_data WHERE id = ?1 AND key = ?2");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, keyid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
 
     if(value != NULL && value[0] != '\0')
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                  "INSERT INTO main.meta_data (id, key, value) VALUES (?1, ?2, ?3)", -1, &stmt,
-                                  NULL);
+      stmt = dt_database_get_statement(darktable.db,
+                                       "INSERT INTO main.meta_data (id, key, value) VALUES (?1, ?2, ?3)");
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, keyid);
       DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, value, -1, SQLITE_TRANSIENT);
       sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      dt_database_release_statement(darktable.db, stmt);
     }
   }
 }
@@ -434,11 +432,10 @@ void dt_metadata_clear(int id)
   else
   {
     sqlite3_stmt *stmt;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.meta_data WHERE id = ?1", -1,
-                                &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db, "DELETE FROM main.meta_data WHERE id = ?1");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
 }
 
@@ -22,7 +22,11 @@
 #include "common/exif.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
+#include "common/image_compression.h"
 #include "common/imageio.h"
+#ifdef HAVE_OPENEXR
+#include "common/imageio_exr.h"
+#endif
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
@@ -58,9 +62,16 @@ typedef enum dt_mipmap_buffer_dsc_flags
 {
   DT_MIPMAP_BUFFER_DSC_FLAG_NONE = 0,
   DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE = 1 << 0,
-  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1
+  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1,
+  // DT_MIPMAP_F holds 4 floats per pixel, or the downscaled mosaic of a raw in one channel:
+  DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_F = 1 << 2,
+  DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_16 = 1 << 3,
+  // packed DT_MIPMAP_F buffer in 4x4 blocks instead of half floats
+  DT_MIPMAP_BUFFER_DSC_FLAG_BLOCKS = 1 << 4
 } dt_mipmap_buffer_dsc_flags;
 
+#define DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT (DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_F | DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_16)
+
 // the embedded Exif data to tag thumbnails as sRGB or AdobeRGB
 static const uint8_t dt_mipmap_cache_exif_data_srgb[] = {
   0x45, 0x78, 0x69, 0x66, 0x00, 0x00, 0x49, 0x49, 0x2a, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01, 0x00, 0x69,
@@ -235,7 +246,7 @@ exit:
 }
 
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width, uint32_t *height, float *iscale,
-                    const uint32_t imgid);
+                    dt_mipmap_buffer_dsc_flags *flags, const uint32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
                     const dt_mipmap_size_t size);
@@ -304,6 +315,145 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+// number of samples in a DT_MIPMAP_F buffer
+static inline size_t _mip_f_samples(const struct dt_mipmap_buffer_dsc *dsc)
+{
+  const size_t channels = (dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT) ? 1 : 4;
+  return (size_t)dsc->width * dsc->height * channels;
+}
+
+// callback for the packed DT_MIPMAP_F cache: packs the buffer the mip_f cleanup is evicting right now.
+// this only ever runs inside that cleanup, with the mip_f cache locked, so mip_f_pending can't change under us.
+static void _mip_f_packed_allocate(void *data, dt_cache_entry_t *entry)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  const struct dt_mipmap_buffer_dsc *src = (const struct dt_mipmap_buffer_dsc *)cache->mip_f_pending;
+  const uint32_t wd4 = src ? (src->width + 3) & ~3 : 0, ht4 = src ? (src->height + 3) & ~3 : 0;
+
+  // the block format only knows rgb, it would mangle mosaic data
+  float *rgb = NULL;
+  if(src && cache->mip_f_packing == DT_MIPMAP_PACKING_COMPRESSED && !(src->flags & DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT))
+    rgb = dt_alloc_align(16, sizeof(float) * 3 * wd4 * ht4);
+
+  size_t payload = 0;
+  if(rgb)
+    payload = (size_t)wd4 * ht4;
+  else if(src)
+    payload = _mip_f_samples(src) * sizeof(uint16_t);
+
+  entry->data_size = sizeof(struct dt_mipmap_buffer_dsc) + payload;
+  entry->data = dt_alloc_align(16, entry->data_size);
+  if(!entry->data)
+  {
+    fprintf(stderr, "[mipmap cache] memory allocation failed!\n");
+    exit(1);
+  }
+  entry->cost = entry->data_size;
+
+  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+  if(!src)
+  {
+    // nothing to pack, leave an empty buffer which won't be unpacked
+    memset(dsc, 0, sizeof(*dsc));
+    dsc->size = entry->data_size;
+    return;
+  }
+
+  *dsc = *src;
+  dsc->size = entry->data_size;
+  dsc->flags = src->flags & DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT;
+  const float *in = (const float *)(src + 1);
+  if(rgb)
+  {
+    // pad to whole blocks by repeating the last row and column. the luma is stored as log, keep it positive.
+    for(uint32_t j = 0; j < ht4; j++)
+    {
+      const float *row = in + (size_t)4 * src->width * MIN(j, src->height - 1);
+      for(uint32_t i = 0; i < wd4; i++)
+        for(int c = 0; c < 3; c++)
+          rgb[3 * ((size_t)wd4 * j + i) + c] = fmaxf(row[4 * MIN(i, src->width - 1) + c], 1e-6f);
+    }
+    dt_image_compress(rgb, (uint8_t *)(dsc + 1), wd4, ht4);
+    dt_free_align(rgb);
+    dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_BLOCKS;
+  }
+  else if(src->flags & DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_16)
+    memcpy(dsc + 1, in, payload);
+  else
+    dt_image_compress_half(in, (uint16_t *)(dsc + 1), _mip_f_samples(src));
+}
+
+static void _mip_f_packed_deallocate(void *data, dt_cache_entry_t *entry)
+{
+  dt_free_align(entry->data);
+}
+
+// keep an evicted DT_MIPMAP_F buffer around in packed form
+static void _mip_f_pack(dt_mipmap_cache_t *cache, const uint32_t key, const struct dt_mipmap_buffer_dsc *dsc)
+{
+  if(dt_cache_contains(&cache->mip_f_packed, key)) return;
+  cache->mip_f_pending = dsc;
+  dt_cache_entry_t *entry = dt_cache_get(&cache->mip_f_packed, key, 'w');
+  cache->mip_f_pending = NULL;
+  dt_cache_release(&cache->mip_f_packed, entry);
+}
+
+// restore a DT_MIPMAP_F buffer from its packed copy, if there is one. returns non-zero on success.
+static int _mip_f_unpack(dt_mipmap_cache_t *cache, const uint32_t key, struct dt_mipmap_buffer_dsc *dsc,
+                         dt_mipmap_buffer_dsc_flags *layout)
+{
+  dt_cache_entry_t *entry = dt_cache_testget(&cache->mip_f_packed, key, 'r');
+  if(!entry) return 0;
+
+  int res = 0;
+  const struct dt_mipmap_buffer_dsc *packed = (const struct dt_mipmap_buffer_dsc *)entry->data;
+  if(packed->width > 0 && packed->height > 0
+     && sizeof(*dsc) + _mip_f_samples(packed) * sizeof(float) <= dsc->size)
+  {
+    float *out = (float *)(dsc + 1);
+    ASAN_UNPOISON_MEMORY_REGION(out, dsc->size - sizeof(*dsc));
+    if(packed->flags & DT_MIPMAP_BUFFER_DSC_FLAG_BLOCKS)
+    {
+      const uint32_t wd4 = (packed->width + 3) & ~3, ht4 = (packed->height + 3) & ~3;
+      float *rgb = dt_alloc_align(16, sizeof(float) * 3 * wd4 * ht4);
+      if(rgb)
+      {
+        dt_image_uncompress((const uint8_t *)(packed + 1), rgb, wd4, ht4);
+        for(uint32_t j = 0; j < packed->height; j++)
+          for(uint32_t i = 0; i < packed->width; i++)
+          {
+            for(int c = 0; c < 3; c++) out[4 * ((size_t)packed->width * j + i) + c] = rgb[3 * ((size_t)wd4 * j + i) + c];
+            out[4 * ((size_t)packed->width * j + i) + 3] = 0.0f;
+          }
+        dt_free_align(rgb);
+        res = 1;
+      }
+    }
+    else if(packed->flags & DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_16)
+    {
+      memcpy(out, packed + 1, _mip_f_samples(packed) * sizeof(uint16_t));
+      res = 1;
+    }
+    else
+    {
+      dt_image_uncompress_half((const uint16_t *)(packed + 1), out, _mip_f_samples(packed));
+      res = 1;
+    }
+    if(res)
+    {
+      dsc->width = packed->width;
+      dsc->height = packed->height;
+      dsc->iscale = packed->iscale;
+      dsc->color_space = packed->color_space;
+      *layout = packed->flags & DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT;
+    }
+  }
+  dt_cache_release(&cache->mip_f_packed, entry);
+  // it lives in the float cache again
+  dt_cache_remove(&cache->mip_f_packed, key);
+  return res;
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -356,7 +506,8 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 
   assert(dsc->size >= sizeof(*dsc));
 
-  int loaded_from_disk = 0;
+  int loaded = 0;
+  dt_mipmap_buffer_dsc_flags layout = DT_MIPMAP_BUFFER_DSC_FLAG_NONE;
   if(mip < DT_MIPMAP_F)
   {
     if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
@@ -391,7 +542,7 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         dsc->height = jpg.height;
         dsc->iscale = 1.0f;
         dsc->color_space = color_space;
-        loaded_from_disk = 1;
+        loaded = 1;
         if(0)
         {
 read_error:
@@ -402,10 +553,15 @@ read_error:
       }
     }
   }
+  else if(mip == DT_MIPMAP_F && cache->mip_f_packing != DT_MIPMAP_PACKING_NONE)
+  {
+    // we might have packed it away when it was evicted
+    loaded = _mip_f_unpack(cache, entry->key, dsc, &layout);
+  }
 
-  if(!loaded_from_disk)
+  if(!loaded)
     dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-  else dsc->flags = 0;
+  else dsc->flags = layout;
 
   // cost is just flat one for the buffer, as the buffers might have different sizes,
   // to make sure quota is meaningful.
@@ -496,6 +652,17 @@ write_error:
       }
     }
   }
+  else if(mip == DT_MIPMAP_F && cache->mip_f_packing != DT_MIPMAP_PACKING_NONE)
+  {
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    // don't keep skulls or buffers which never got filled
+    if(dsc->width > 8 && dsc->height > 8
+       && !(dsc->flags & (DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE | DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE)))
+    {
+      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+      _mip_f_pack(cache, entry->key, dsc);
+    }
+  }
   dt_free_align(entry->data);
 }
 
@@ -562,7 +729,22 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
 
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  // evicted float buffers get a quarter of the memory, if they are kept at all
+  gchar *packing = dt_conf_get_string("cache_mip_f_format");
+  if(packing && !strcmp(packing, "half float"))
+    cache->mip_f_packing = DT_MIPMAP_PACKING_HALF;
+  else if(packing && !strcmp(packing, "compressed"))
+    cache->mip_f_packing = DT_MIPMAP_PACKING_COMPRESSED;
+  else
+    cache->mip_f_packing = DT_MIPMAP_PACKING_NONE;
+  g_free(packing);
+  cache->mip_f_pending = NULL;
+  const size_t packed_mem = cache->mip_f_packing != DT_MIPMAP_PACKING_NONE ? max_mem / 4 : 0;
+  dt_cache_init(&cache->mip_f_packed, 0, MAX(packed_mem, 1));
+  dt_cache_set_allocate_callback(&cache->mip_f_packed, _mip_f_packed_allocate, cache);
+  dt_cache_set_cleanup_callback(&cache->mip_f_packed, _mip_f_packed_deallocate, cache);
+
+  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem - packed_mem);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
 
@@ -589,7 +771,10 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
+  // no point in packing what's left at shutdown
+  cache->mip_f_packing = DT_MIPMAP_PACKING_NONE;
   dt_cache_cleanup(&cache->mip_f.cache);
+  dt_cache_cleanup(&cache->mip_f_packed);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -604,6 +789,10 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   printf("[mipmap_cache] full  fill %d/%d slots (%.2f%%)\n",
          (uint32_t)cache->mip_full.cache.cost, (uint32_t)cache->mip_full.cache.cost_quota,
          100.0f * (float)cache->mip_full.cache.cost / (float)cache->mip_full.cache.cost_quota);
+  if(cache->mip_f_packing != DT_MIPMAP_PACKING_NONE)
+    printf("[mipmap_cache] packed fill %.2f/%.2f MB (%.2f%%)\n",
+           cache->mip_f_packed.cost / (1024.0 * 1024.0), cache->mip_f_packed.cost_quota / (1024.0 * 1024.0),
+           100.0f * (float)cache->mip_f_packed.cost / (float)cache->mip_f_packed.cost_quota);
 
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -792,7 +981,7 @@ void dt_mipmap_cache_get_with_caller(
       else if(mip == DT_MIPMAP_F)
       {
         ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
-        _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, imgid);
+        _init_f(buf, (float *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &dsc->flags, imgid);
       }
       else
       {
@@ -980,6 +1169,9 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
       dt_mipmap_cache_unlink_ondisk_thumbnail((&_get_cache(cache, k)->cache)->cleanup_data, imgid, k);
     }
   }
+
+  // a packed float buffer would be stale, too
+  dt_cache_remove(&cache->mip_f_packed, get_key(imgid, DT_MIPMAP_F));
 }
 
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
@@ -994,7 +1186,7 @@ void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
 }
 
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width, uint32_t *height, float *iscale,
-                    const uint32_t imgid)
+                    dt_mipmap_buffer_dsc_flags *flags, const uint32_t imgid)
 {
   const uint32_t wd = *width, ht = *height;
 
@@ -1046,6 +1238,11 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width,
 
   mipmap_buf->color_space = DT_COLORSPACE_NONE; // TODO: do we need that information in this buffer?
 
+  *flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_LAYOUT;
+  if(image->buf_dsc.filters)
+    *flags |= image->buf_dsc.datatype == TYPE_UINT16 ? DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_16
+                                                     : DT_MIPMAP_BUFFER_DSC_FLAG_MOSAIC_F;
+
   if(image->buf_dsc.filters)
   {
     if(image->buf_dsc.filters != 9u && image->buf_dsc.datatype == TYPE_FLOAT)
@@ -1170,11 +1367,27 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
         free(tmp);
       }
     }
+#ifdef HAVE_OPENEXR
+    else if(!strcasecmp(c, ".exr"))
+    {
+      // tiled exrs with mip levels carry their own thumbnails, only decode the level we need
+      uint8_t *tmp = 0;
+      int32_t thumb_width, thumb_height;
+      res = dt_imageio_exr_thumbnail(filename, wd, ht, &tmp, &thumb_width, &thumb_height, color_space);
+      if(!res)
+      {
+        // scale to fit
+        dt_iop_flip_and_zoom_8(tmp, thumb_width, thumb_height, buf, wd, ht, orientation, width, height);
+        free(tmp);
+      }
+    }
+#endif
     else
     {
       uint8_t *tmp = 0;
       int32_t thumb_width, thumb_height;
-      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space);
+      res = dt_imageio_large_thumbnail(filename, imgid, MAX(wd, ht), &tmp, &thumb_width, &thumb_height,
+                                       color_space);
       if(!res)
       {
         // scale to fit
@@ -1211,6 +1424,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     _dummy_data_t dat;
     format.bpp = _bpp;
     format.write_image = _write_image;
+    format.write_image_begin = NULL; // no streaming, we want the whole buffer
     format.levels = _levels;
     dat.head.max_width = wd;
     dat.head.max_height = ht;
@@ -85,6 +85,14 @@ typedef struct dt_mipmap_cache_one_t
   long int stats_standin;    // texture used as stand-in
 } dt_mipmap_cache_one_t;
 
+// how evicted DT_MIPMAP_F buffers are kept in memory
+typedef enum dt_mipmap_cache_packing_t
+{
+  DT_MIPMAP_PACKING_NONE = 0,
+  DT_MIPMAP_PACKING_HALF,      // half floats, 2 bytes per sample
+  DT_MIPMAP_PACKING_COMPRESSED // 4x4 blocks of 1 byte per pixel, falls back to half floats for raw data
+} dt_mipmap_cache_packing_t;
+
 typedef struct dt_mipmap_cache_t
 {
   // real width and height are stored per element
@@ -98,6 +106,12 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_thumbs;
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
+
+  // evicted DT_MIPMAP_F buffers, packed to a fraction of their size (see cache_mip_f_format).
+  // they are unpacked instead of reloading the raw when they are requested again.
+  dt_cache_t mip_f_packed;
+  dt_mipmap_cache_packing_t mip_f_packing;
+  const void *mip_f_pending; // buffer being evicted right now, only valid inside the mip_f cleanup
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
 } dt_mipmap_cache_t;
 
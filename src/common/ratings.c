@@ -24,7 +24,7 @@
 #include "gui/gtk.h"
 
 
-void dt_ratings_apply_to_image(int imgid, int rating)
+static void _ratings_apply_to_image(int imgid, int rating)
 {
   dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
   // one star is a toggle, so you can easily reject images by removing the last star:
@@ -36,8 +36,12 @@ void dt_ratings_apply_to_image(int imgid, int rating)
   image->flags = (image->flags & ~0x7) | (0x7 & rating);
   // synch through:
   dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+}
 
-  dt_collection_hint_message(darktable.collection);
+void dt_ratings_apply_to_image(int imgid, int rating)
+{
+  _ratings_apply_to_image(imgid, rating);
+  dt_collection_update_images(darktable.collection, imgid);
 }
 
 void dt_ratings_apply_to_selection(int rating)
@@ -50,23 +54,56 @@ void dt_ratings_apply_to_selection(int rating)
     else
       dt_control_log(ngettext("applying rating %d to %d image", "applying rating %d to %d images", count),
                      rating, count);
-#if 0 // not updating cache
-    gchar query[1024]= {0};
-    g_snprintf(query,sizeof(query), "UPDATE main.images SET flags=(flags & ~7) | (7 & %d) WHERE id IN "
-                                    "(SELECT imgid FROM main.selected_images)", rating);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-#endif
-
-    /* for each selected image update rating */
+    const int double_tap = dt_conf_get_bool("rating_one_double_tap");
     sqlite3_stmt *stmt;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images", -1, &stmt,
-                                NULL);
+
+    // the images we have in the cache get their rating through the cache, under the write lock. someone else
+    // holding one of them would otherwise write the old flags back when releasing it. work out their new
+    // ratings before the db changes, the one star toggle depends on the old one.
+    GArray *cached = g_array_new(FALSE, FALSE, sizeof(int));
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "SELECT id, flags FROM main.images "
+                                "WHERE id IN (SELECT imgid FROM main.selected_images)",
+                                -1, &stmt, NULL);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
-      dt_ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
+      const int imgid = sqlite3_column_int(stmt, 0);
+      if(!dt_image_cache_contains(darktable.image_cache, imgid)) continue;
+      const int flags = sqlite3_column_int(stmt, 1);
+      const int new_rating = (rating == 1 && !double_tap && (flags & 0x7) == 1) ? 0 : (0x7 & rating);
+      g_array_append_val(cached, imgid);
+      g_array_append_val(cached, new_rating);
     }
     sqlite3_finalize(stmt);
 
+    // one statement for all the others. the one star toggle has to be done per image, as in
+    // _ratings_apply_to_image().
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "UPDATE main.images SET flags = (flags & ~7) | "
+                                "(CASE WHEN ?1 = 1 AND ?2 = 0 AND (flags & 7) = 1 THEN 0 ELSE ?1 END) "
+                                "WHERE id IN (SELECT imgid FROM main.selected_images)",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0x7 & rating);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, double_tap);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    // the releases write the rows again, after whatever a concurrent writer put there. the sidecars are left
+    // for below.
+    for(guint i = 0; i < cached->len; i += 2)
+    {
+      const int imgid = g_array_index(cached, int, i);
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+      image->flags = (image->flags & ~0x7) | g_array_index(cached, int, i + 1);
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    }
+    g_array_free(cached, TRUE);
+
+    // and the sidecars in one go
+    dt_image_synch_xmp(-1);
+
+    dt_collection_update_images(darktable.collection, -1);
+
     /* redraw view */
     /* dt_control_queue_redraw_center() */
     /* needs to be called in the caller function */
@@ -0,0 +1,275 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/sidecar_writer.h"
+#include "common/darktable.h"
+#include "common/image.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <time.h>
+
+// the folder watches only need to recognise recent writes, don't let the table grow without bounds
+#define DT_SIDECAR_WRITER_MAX_WRITTEN 4096
+
+typedef struct dt_sidecar_writer_entry_t
+{
+  int imgid;
+  double time; // when it was queued first
+} dt_sidecar_writer_entry_t;
+
+typedef struct dt_sidecar_writer_file_t
+{
+  time_t mtime;
+  off_t size;
+} dt_sidecar_writer_file_t;
+
+// takes the entries which are due at time now (all of them if now < 0) out of the queue.
+// has to be called with w->lock held.
+static GList *_take_due(dt_sidecar_writer_t *w, const double now)
+{
+  GList *batch = NULL;
+  while(!g_queue_is_empty(&w->queue))
+  {
+    dt_sidecar_writer_entry_t *e = (dt_sidecar_writer_entry_t *)g_queue_peek_head(&w->queue);
+    if(now >= 0.0 && e->time + DT_SIDECAR_WRITER_DELAY > now) break;
+    g_queue_pop_head(&w->queue);
+    g_hash_table_remove(w->pending, GINT_TO_POINTER(e->imgid));
+    batch = g_list_prepend(batch, GINT_TO_POINTER(e->imgid));
+    g_free(e);
+  }
+  return g_list_reverse(batch);
+}
+
+// has to be called with w->write_lock held, but not w->lock.
+static void _write_batch(dt_sidecar_writer_t *w, GList *batch)
+{
+  for(GList *iter = batch; iter; iter = g_list_next(iter))
+  {
+    const double start = dt_get_wtime();
+    dt_pthread_mutex_lock(&w->history_lock);
+    dt_image_write_sidecar_file(GPOINTER_TO_INT(iter->data));
+    dt_pthread_mutex_unlock(&w->history_lock);
+    const double time = dt_get_wtime() - start;
+
+    dt_pthread_mutex_lock(&w->lock);
+    w->writes++;
+    w->write_time += time;
+    w->max_write_time = MAX(w->max_write_time, time);
+    dt_pthread_mutex_unlock(&w->lock);
+  }
+  g_list_free(batch);
+}
+
+static void *_sidecar_writer_thread(void *data)
+{
+  dt_sidecar_writer_t *w = (dt_sidecar_writer_t *)data;
+  dt_pthread_mutex_lock(&w->lock);
+  while(w->running)
+  {
+    if(g_queue_is_empty(&w->queue))
+    {
+      dt_pthread_cond_wait(&w->cond, &w->lock);
+      continue;
+    }
+
+    const double now = dt_get_wtime();
+    const dt_sidecar_writer_entry_t *e = (dt_sidecar_writer_entry_t *)g_queue_peek_head(&w->queue);
+    const double wait = e->time + DT_SIDECAR_WRITER_DELAY - now;
+    if(wait > 0.0)
+    {
+      const gint64 until = g_get_real_time() + (gint64)(wait * G_USEC_PER_SEC);
+      const struct timespec ts = { .tv_sec = until / G_USEC_PER_SEC,
+                                   .tv_nsec = (until % G_USEC_PER_SEC) * 1000 };
+      dt_pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+      continue;
+    }
+
+    // write_lock has to be taken first, see dt_sidecar_writer_flush()
+    dt_pthread_mutex_unlock(&w->lock);
+    dt_pthread_mutex_lock(&w->write_lock);
+    dt_pthread_mutex_lock(&w->lock);
+    GList *batch = _take_due(w, now);
+    dt_pthread_mutex_unlock(&w->lock);
+    _write_batch(w, batch);
+    dt_pthread_mutex_unlock(&w->write_lock);
+    dt_pthread_mutex_lock(&w->lock);
+  }
+  dt_pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+void dt_sidecar_writer_init(dt_sidecar_writer_t *w)
+{
+  memset(w, 0, sizeof(dt_sidecar_writer_t));
+  dt_pthread_mutex_init(&w->lock, NULL);
+  dt_pthread_mutex_init(&w->write_lock, NULL);
+  dt_pthread_mutex_init(&w->history_lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  g_queue_init(&w->queue);
+  w->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+  w->written = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  w->running = 1;
+  if(dt_pthread_create(&w->thread, _sidecar_writer_thread, w))
+  {
+    fprintf(stderr, "[sidecar_writer] could not start the thread, sidecar files will be written right away\n");
+    w->running = 0;
+  }
+}
+
+void dt_sidecar_writer_cleanup(dt_sidecar_writer_t *w)
+{
+  dt_pthread_mutex_lock(&w->lock);
+  const int running = w->running;
+  w->running = 0;
+  pthread_cond_signal(&w->cond);
+  dt_pthread_mutex_unlock(&w->lock);
+  if(running) pthread_join(w->thread, NULL);
+
+  dt_sidecar_writer_flush(w);
+  dt_sidecar_writer_print(w);
+
+  g_hash_table_destroy(w->pending);
+  g_hash_table_destroy(w->written);
+  pthread_cond_destroy(&w->cond);
+  dt_pthread_mutex_destroy(&w->history_lock);
+  dt_pthread_mutex_destroy(&w->write_lock);
+  dt_pthread_mutex_destroy(&w->lock);
+}
+
+void dt_sidecar_writer_queue(dt_sidecar_writer_t *w, const int imgid)
+{
+  if(imgid <= 0 || !dt_conf_get_bool("write_sidecar_files")) return;
+  if(!w)
+  {
+    dt_image_write_sidecar_file(imgid);
+    return;
+  }
+
+  dt_pthread_mutex_lock(&w->lock);
+  w->requests++;
+  if(!w->running)
+  {
+    dt_pthread_mutex_unlock(&w->lock);
+    dt_image_write_sidecar_file(imgid);
+    return;
+  }
+  if(!g_hash_table_contains(w->pending, GINT_TO_POINTER(imgid)))
+  {
+    dt_sidecar_writer_entry_t *e = g_malloc(sizeof(dt_sidecar_writer_entry_t));
+    e->imgid = imgid;
+    e->time = dt_get_wtime();
+    g_queue_push_tail(&w->queue, e);
+    g_hash_table_insert(w->pending, GINT_TO_POINTER(imgid), g_queue_peek_tail_link(&w->queue));
+    w->max_depth = MAX(w->max_depth, g_queue_get_length(&w->queue));
+    // the thread only has to wake up if it was idle, otherwise it's waiting for something older anyway
+    if(g_queue_get_length(&w->queue) == 1) pthread_cond_signal(&w->cond);
+  }
+  dt_pthread_mutex_unlock(&w->lock);
+}
+
+void dt_sidecar_writer_cancel(dt_sidecar_writer_t *w, const int imgid)
+{
+  if(!w) return;
+  dt_pthread_mutex_lock(&w->lock);
+  GList *link = (GList *)g_hash_table_lookup(w->pending, GINT_TO_POINTER(imgid));
+  if(link)
+  {
+    g_hash_table_remove(w->pending, GINT_TO_POINTER(imgid));
+    g_free(link->data);
+    g_queue_delete_link(&w->queue, link);
+  }
+  dt_pthread_mutex_unlock(&w->lock);
+
+  // a batch which is being written might contain imgid
+  dt_pthread_mutex_lock(&w->write_lock);
+  dt_pthread_mutex_unlock(&w->write_lock);
+}
+
+void dt_sidecar_writer_flush(dt_sidecar_writer_t *w)
+{
+  if(!w) return;
+  // the lock order is write_lock, then lock
+  dt_pthread_mutex_lock(&w->write_lock);
+  dt_pthread_mutex_lock(&w->lock);
+  GList *batch = _take_due(w, -1.0);
+  dt_pthread_mutex_unlock(&w->lock);
+  _write_batch(w, batch);
+  dt_pthread_mutex_unlock(&w->write_lock);
+}
+
+void dt_sidecar_writer_hold(dt_sidecar_writer_t *w)
+{
+  if(!w) return;
+  dt_pthread_mutex_lock(&w->history_lock);
+}
+
+void dt_sidecar_writer_release(dt_sidecar_writer_t *w)
+{
+  if(!w) return;
+  dt_pthread_mutex_unlock(&w->history_lock);
+}
+
+void dt_sidecar_writer_written(dt_sidecar_writer_t *w, const char *path)
+{
+  if(!w) return;
+  GStatBuf statbuf;
+  if(g_stat(path, &statbuf)) return;
+  dt_sidecar_writer_file_t *f = g_malloc(sizeof(dt_sidecar_writer_file_t));
+  f->mtime = statbuf.st_mtime;
+  f->size = statbuf.st_size;
+  dt_pthread_mutex_lock(&w->lock);
+  if(g_hash_table_size(w->written) >= DT_SIDECAR_WRITER_MAX_WRITTEN) g_hash_table_remove_all(w->written);
+  g_hash_table_insert(w->written, g_strdup(path), f);
+  dt_pthread_mutex_unlock(&w->lock);
+}
+
+gboolean dt_sidecar_writer_is_own(dt_sidecar_writer_t *w, const char *path)
+{
+  if(!w) return FALSE;
+  GStatBuf statbuf;
+  if(g_stat(path, &statbuf)) return FALSE;
+  dt_pthread_mutex_lock(&w->lock);
+  const dt_sidecar_writer_file_t *f = (dt_sidecar_writer_file_t *)g_hash_table_lookup(w->written, path);
+  const gboolean own = f && f->mtime == statbuf.st_mtime && f->size == statbuf.st_size;
+  dt_pthread_mutex_unlock(&w->lock);
+  return own;
+}
+
+uint32_t dt_sidecar_writer_get_depth(dt_sidecar_writer_t *w)
+{
+  dt_pthread_mutex_lock(&w->lock);
+  const uint32_t depth = g_queue_get_length(&w->queue);
+  dt_pthread_mutex_unlock(&w->lock);
+  return depth;
+}
+
+void dt_sidecar_writer_print(dt_sidecar_writer_t *w)
+{
+  dt_pthread_mutex_lock(&w->lock);
+  dt_print(DT_DEBUG_PERF, "[sidecar_writer] %" PRIu64 " requests, %" PRIu64 " writes, %u queued, at most %u\n",
+           w->requests, w->writes, g_queue_get_length(&w->queue), w->max_depth);
+  if(w->writes)
+    dt_print(DT_DEBUG_PERF, "[sidecar_writer] write time %.3f ms on average, %.3f ms max\n",
+             1000.0 * w->write_time / w->writes, 1000.0 * w->max_write_time);
+  dt_pthread_mutex_unlock(&w->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,88 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+/*
+ * writes the xmp sidecar files in a thread of its own, so that slow (network) file systems don't block the
+ * gui. an image is written DT_SIDECAR_WRITER_DELAY seconds after it was first queued, and queueing it again
+ * in the meantime is free. that makes a slider drag or rating a few thousand images a single write per
+ * image. whatever is still queued is written when darktable shuts down.
+ */
+
+// seconds
+#define DT_SIDECAR_WRITER_DELAY 2.0
+
+typedef struct dt_sidecar_writer_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int running;
+
+  GQueue queue;        // dt_sidecar_writer_entry_t, oldest first
+  GHashTable *pending; // imgid -> link in queue
+
+  // held while a batch is written, so that dt_sidecar_writer_cancel() can wait for it
+  dt_pthread_mutex_t write_lock;
+  // held while a single sidecar is written, so that it never sees a history which is being rewritten
+  dt_pthread_mutex_t history_lock;
+
+  // xmp path -> mtime and size of the files we wrote, to tell them apart from changes by others
+  GHashTable *written;
+
+  // statistics
+  uint64_t requests, writes;
+  uint32_t max_depth;
+  double write_time, max_write_time;
+} dt_sidecar_writer_t;
+
+void dt_sidecar_writer_init(dt_sidecar_writer_t *w);
+/** stops the thread and writes whatever is still queued. */
+void dt_sidecar_writer_cleanup(dt_sidecar_writer_t *w);
+
+/** write the sidecar of imgid soon. without a writer (w == NULL) it's written right away. */
+void dt_sidecar_writer_queue(dt_sidecar_writer_t *w, const int imgid);
+/** forget about imgid, and wait for it if it's being written right now. used before removing an image. */
+void dt_sidecar_writer_cancel(dt_sidecar_writer_t *w, const int imgid);
+/** write everything that's queued, in the calling thread. */
+void dt_sidecar_writer_flush(dt_sidecar_writer_t *w);
+
+/** keep the writer from writing a sidecar until dt_sidecar_writer_release(), while the history of an image
+ * is rewritten. waits for the sidecar which is being written right now. */
+void dt_sidecar_writer_hold(dt_sidecar_writer_t *w);
+void dt_sidecar_writer_release(dt_sidecar_writer_t *w);
+
+/** remember that darktable just wrote the sidecar file at path. */
+void dt_sidecar_writer_written(dt_sidecar_writer_t *w, const char *path);
+/** TRUE if the file at path is still what darktable wrote there. */
+gboolean dt_sidecar_writer_is_own(dt_sidecar_writer_t *w, const char *path);
+
+/** number of images waiting for their sidecar to be written. */
+uint32_t dt_sidecar_writer_get_depth(dt_sidecar_writer_t *w);
+/** prints queue and write time statistics. */
+void dt_sidecar_writer_print(dt_sidecar_writer_t *w);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
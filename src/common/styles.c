@@ -467,6 +467,88 @@ gboolean dt_styles_create_from_image(const char *name, const char *description,
   return FALSE;
 }
 
+/* the same as dt_styles_apply_to_image() for all selected images at once: the library is changed by a few
+   statements in a single transaction, xmp files are written in the background and thumbnails are recreated
+   when they are shown next. */
+static gboolean _styles_apply_to_selection(const char *name, const int id)
+{
+  sqlite3_stmt *stmt;
+  GList *imgs = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(!imgs) return FALSE;
+
+  /* copy history items from styles onto temp table, once for all images */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO memory.style_items SELECT * FROM "
+                                                             "data.style_items WHERE styleid=?1 ORDER BY "
+                                                             "multi_priority DESC",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  dt_database_start_transaction(darktable.db);
+
+  /* first trim the stacks to get rid of whatever is above the selected entry */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "DELETE FROM main.history WHERE imgid IN (SELECT imgid FROM main.selected_images) "
+                        "AND num >= (SELECT history_end FROM main.images WHERE id = imgid)",
+                        NULL, NULL, NULL);
+
+  /* append the style items to every stack, in sqlite ROWID starts at 1, while our num column starts at 0 */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "INSERT INTO main.history "
+                        "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
+                        "version,multi_priority,multi_name) SELECT "
+                        "s.imgid,(SELECT IFNULL(MAX(num), -1) FROM main.history AS h WHERE h.imgid = s.imgid)"
+                        "+i.rowid,i.module,i.operation,i.op_params,i.enabled,i.blendop_params,"
+                        "i.blendop_version,i.multi_priority,i.multi_name "
+                        "FROM main.selected_images AS s, memory.style_items AS i",
+                        NULL, NULL, NULL);
+
+  /* always make the whole stack active */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
+                        "WHERE imgid = id) WHERE id IN (SELECT imgid FROM main.selected_images)",
+                        NULL, NULL, NULL);
+
+  dt_database_release_transaction(darktable.db);
+
+  /* add tag */
+  guint tagid = 0;
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
+  if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, -1);
+  if(dt_tag_new("darktable|changed", &tagid)) dt_tag_attach(tagid, -1);
+
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+
+    /* if current image in develop reload history */
+    if(dt_dev_is_current_image(darktable.develop, imgid))
+    {
+      dt_dev_reload_history_items(darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    }
+
+    /* update xmp file */
+    dt_image_synch_xmp(imgid);
+
+    /* remove old obsolete thumbnails */
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  }
+  g_list_free(imgs);
+
+  /* redraw center view to update visible mipmaps */
+  dt_control_queue_redraw_center();
+  return TRUE;
+}
+
 void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
 {
   gboolean selected = FALSE;
@@ -477,6 +559,14 @@ void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
   const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
   if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
+  /* without duplicates all images get the same items, that's done in one go */
+  const int id = duplicate ? 0 : dt_styles_get_id_by_name(name);
+  if(id != 0)
+  {
+    if(!_styles_apply_to_selection(name, id)) dt_control_log(_("no image selected!"));
+    return;
+  }
+
   /* for each selected image apply style */
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images",
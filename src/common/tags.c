@@ -34,34 +34,30 @@ gboolean dt_tag_new(const char *name, guint *tagid)
 
   if(!name || name[0] == '\0') return FALSE; // no tagid name.
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1, &stmt,
-                              NULL);
+  stmt = dt_database_get_statement(darktable.db, "SELECT id FROM data.tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW)
   {
     // tagid already exists.
     if(tagid != NULL) *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return TRUE;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO data.tags (id, name) VALUES (NULL, ?1)",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db, "INSERT INTO data.tags (id, name) VALUES (NULL, ?1)");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  const gboolean inserted = sqlite3_step(stmt) == SQLITE_DONE;
+  dt_database_release_statement(darktable.db, stmt);
 
-  if(tagid != NULL)
-  {
-    *tagid = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
-    if(sqlite3_step(stmt) == SQLITE_ROW) *tagid = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
+  guint id = 0;
+  stmt = dt_database_get_statement(darktable.db, "SELECT id FROM data.tags WHERE name = ?1");
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+  dt_database_release_statement(darktable.db, stmt);
+  if(inserted && id) dt_tag_index_add(darktable.tag_index, id, name);
+  if(tagid != NULL) *tagid = id;
 
   return TRUE;
 }
@@ -94,6 +90,7 @@ guint dt_tag_remove(const guint tagid, gboolean final)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_tag_index_remove(darktable.tag_index, tagid);
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.used_tags WHERE id=?1", -1, &stmt,
                                 NULL);
@@ -119,12 +116,11 @@ gchar *dt_tag_get_name(const guint tagid)
   int rt;
   char *name = NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT name FROM data.tags WHERE id= ?1", -1, &stmt,
-                              NULL);
+  stmt = dt_database_get_statement(darktable.db, "SELECT name FROM data.tags WHERE id= ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW) name = g_strdup((const char *)sqlite3_column_text(stmt, 0));
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   return name;
 }
@@ -155,6 +151,7 @@ void dt_tag_reorganize(const gchar *source, const gchar *dest)
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, source_expr, -1, SQLITE_TRANSIENT);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_tag_index_reload(darktable.tag_index);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "UPDATE main.used_tags SET name=REPLACE(name,?1,?2) WHERE name LIKE ?3",
@@ -176,20 +173,19 @@ gboolean dt_tag_exists(const char *name, guint *tagid)
 {
   int rt;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM data.tags WHERE name = ?1", -1, &stmt,
-                              NULL);
+  stmt = dt_database_get_statement(darktable.db, "SELECT id FROM data.tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
 
   if(rt == SQLITE_ROW)
   {
     if(tagid != NULL) *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return TRUE;
   }
 
   *tagid = -1;
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return FALSE;
 }
 
@@ -198,29 +194,28 @@ void dt_tag_attach(guint tagid, gint imgid)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)", -1,
-                                &stmt, NULL);
+    stmt = dt_database_get_statement(
+        darktable.db,
+        "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
   else
   {
     // insert into tagged_images if not there already.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
-                                "FROM main.selected_images",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "INSERT OR REPLACE INTO main.tagged_images SELECT imgid, ?1 "
+                                     "FROM main.selected_images");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  dt_collection_update_images(darktable.collection, imgid);
 }
 
 void dt_tag_attach_list(GList *tags, gint imgid)
@@ -264,45 +259,43 @@ void dt_tag_detach(guint tagid, gint imgid)
   if(imgid > 0)
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2", -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid = ?2");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
   else
   {
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
-                                "(SELECT imgid FROM main.selected_images)",
-                                -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "DELETE FROM main.tagged_images WHERE tagid = ?1 AND imgid IN "
+                                     "(SELECT imgid FROM main.selected_images)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
   }
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  dt_collection_update_images(darktable.collection, imgid);
 }
 
 void dt_tag_detach_by_string(const char *name, gint imgid)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
-                              "data.tags WHERE name LIKE ?1) AND imgid = ?2;",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "DELETE FROM main.tagged_images WHERE tagid IN (SELECT id FROM "
+                                   "data.tags WHERE name LIKE ?1) AND imgid = ?2;");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   dt_tag_update_used_tags();
 
-  dt_collection_update_query(darktable.collection);
+  dt_collection_update_images(darktable.collection, imgid);
 }
 
 
@@ -458,38 +451,30 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
   /* Quick sanity check - is keyword empty? If so .. return 0 */
   if(keyword == 0) return 0;
 
-  gchar *keyword_expr = g_strdup_printf("%%%s%%", keyword);
-
-  /* Select tags that are similar to the keyword and are actually used to tag images*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count) SELECT tagid, 1000000+COUNT(*) "
-                              "FROM main.tagged_images "
-                              "WHERE tagid IN (SELECT id FROM data.tags WHERE name LIKE ?1) GROUP BY tagid ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  /* Find the tags that are similar to the keyword in memory instead of LIKE over all of data.tags */
+  GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint));
+  dt_tag_index_find(darktable.tag_index, keyword, ids);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "INSERT INTO memory.taglist (id, count) VALUES (?1, 1000000)");
+  for(guint k = 0; k < ids->len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(ids, guint, k));
+    sqlite3_step(stmt);
+    DT_DEBUG_SQLITE3_RESET(stmt);
+  }
+  dt_database_release_statement(darktable.db, stmt);
+  g_array_free(ids, TRUE);
 
-  /* Select tags that are similar to the keyword but were not used to tag any image*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count) SELECT id,1000000 FROM data.tags WHERE "
-                              "name LIKE ?1 AND id NOT IN (SELECT id FROM memory.taglist)",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  /* Tags that are actually used to tag images come first */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "UPDATE memory.taglist SET count = count + (SELECT COUNT(*) FROM main.tagged_images "
+                        "WHERE tagid = memory.taglist.id)", NULL, NULL, NULL);
 
   /* Select tags from tagged images when at least one tag is similar to the keyword and insert in temp table*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.tagq (id) SELECT tagid FROM main.tagged_images WHERE "
-                              "imgid IN (SELECT DISTINCT imgid FROM main.tagged_images WHERE tagid IN "
-                              "(SELECT id FROM data.tags WHERE name LIKE ?1)) ",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, keyword_expr, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  g_free(keyword_expr);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "INSERT INTO memory.tagq (id) SELECT tagid FROM main.tagged_images WHERE "
+                        "imgid IN (SELECT DISTINCT imgid FROM main.tagged_images WHERE tagid IN "
+                        "(SELECT id FROM memory.taglist))", NULL, NULL, NULL);
 
   /* Select tags from temp table that are not similar to the keyword */
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "INSERT INTO memory.taglist (id, count) SELECT id, "
@@ -701,15 +686,174 @@ ssize_t dt_tag_export(const char *filename)
 
 void dt_tag_update_used_tags()
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.used_tags WHERE id NOT IN "
-                                                       "(SELECT tagid FROM main.tagged_images GROUP BY tagid)",
-                        NULL, NULL, NULL);
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "INSERT OR IGNORE INTO main.used_tags (id, name) "
-                                                       "SELECT t.id, t.name "
-                                                       "FROM data.tags AS t, main.tagged_images AS i "
-                                                       "ON t.id = i.tagid GROUP BY t.id",
-                        NULL, NULL, NULL);
+  // this runs after every attach and detach, so don't compile it again every time
+  sqlite3_stmt *stmt;
+  stmt = dt_database_get_statement(darktable.db, "DELETE FROM main.used_tags WHERE id NOT IN "
+                                                 "(SELECT tagid FROM main.tagged_images GROUP BY tagid)");
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+
+  stmt = dt_database_get_statement(darktable.db, "INSERT OR IGNORE INTO main.used_tags (id, name) "
+                                                 "SELECT t.id, t.name "
+                                                 "FROM data.tags AS t, main.tagged_images AS i "
+                                                 "ON t.id = i.tagid GROUP BY t.id");
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+}
+
+// adds the ancestors of a tag to the closure table, "a|b|c" gets "a" and "a|b". they are in ascii lower case
+// as well, so that a branch can be looked up with =, where LIKE ignored the case.
+// has to be called with ti->lock held.
+static void _tag_index_add_closure(const guint id, const char *key)
+{
+  sqlite3_stmt *stmt = dt_database_get_statement(
+      darktable.db, "INSERT INTO memory.tag_closure (ancestor, id) VALUES (?1, ?2)");
+  for(const char *c = strchr(key, '|'); c; c = strchr(c + 1, '|'))
+  {
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, c - key, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, id);
+    sqlite3_step(stmt);
+    DT_DEBUG_SQLITE3_RESET(stmt);
+  }
+  dt_database_release_statement(darktable.db, stmt);
+}
+
+// has to be called with ti->lock held
+static void _tag_index_read(dt_tag_index_t *ti)
+{
+  g_array_set_size(ti->ids, 0);
+  g_ptr_array_set_size(ti->keys, 0);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tag_closure", NULL, NULL, NULL);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id, name FROM data.tags", -1, &stmt,
+                              NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if(!name) continue;
+    const guint id = sqlite3_column_int(stmt, 0);
+    gchar *key = g_ascii_strdown(name, -1);
+    g_array_append_val(ti->ids, id);
+    g_ptr_array_add(ti->keys, key);
+    _tag_index_add_closure(id, key);
+  }
+  sqlite3_finalize(stmt);
+}
+
+void dt_tag_index_init(dt_tag_index_t *ti)
+{
+  dt_pthread_mutex_init(&ti->lock, NULL);
+  ti->ids = g_array_new(FALSE, FALSE, sizeof(guint));
+  ti->keys = g_ptr_array_new_with_free_func(g_free);
+  dt_pthread_mutex_lock(&ti->lock);
+  _tag_index_read(ti);
+  dt_pthread_mutex_unlock(&ti->lock);
+}
+
+void dt_tag_index_cleanup(dt_tag_index_t *ti)
+{
+  g_array_free(ti->ids, TRUE);
+  g_ptr_array_free(ti->keys, TRUE);
+  dt_pthread_mutex_destroy(&ti->lock);
+}
+
+void dt_tag_index_add(dt_tag_index_t *ti, const guint id, const char *name)
+{
+  if(!ti) return;
+  gchar *key = g_ascii_strdown(name, -1);
+  dt_pthread_mutex_lock(&ti->lock);
+  g_array_append_val(ti->ids, id);
+  g_ptr_array_add(ti->keys, key);
+  _tag_index_add_closure(id, key);
+  dt_pthread_mutex_unlock(&ti->lock);
+}
+
+void dt_tag_index_remove(dt_tag_index_t *ti, const guint id)
+{
+  if(!ti) return;
+  dt_pthread_mutex_lock(&ti->lock);
+  for(guint k = 0; k < ti->ids->len; k++)
+  {
+    if(g_array_index(ti->ids, guint, k) != id) continue;
+    // the order doesn't matter, as long as both stay in step
+    g_array_remove_index_fast(ti->ids, k);
+    g_ptr_array_remove_index_fast(ti->keys, k);
+    break;
+  }
+  sqlite3_stmt *stmt
+      = dt_database_get_statement(darktable.db, "DELETE FROM memory.tag_closure WHERE id = ?1");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+  dt_pthread_mutex_unlock(&ti->lock);
+}
+
+void dt_tag_index_reload(dt_tag_index_t *ti)
+{
+  if(!ti) return;
+  dt_pthread_mutex_lock(&ti->lock);
+  _tag_index_read(ti);
+  dt_pthread_mutex_unlock(&ti->lock);
+}
+
+// LIKE semantics on the lowercased names: % is any sequence, _ is any single character
+static gboolean _tag_index_like(const char *s, const char *p)
+{
+  const char *star_p = NULL, *star_s = NULL;
+  while(*s)
+  {
+    if(*p == '_')
+    {
+      s = g_utf8_next_char(s);
+      p++;
+    }
+    else if(*p == '%')
+    {
+      star_p = ++p;
+      star_s = s;
+    }
+    else if(*p == *s)
+    {
+      s++;
+      p++;
+    }
+    else if(star_p)
+    {
+      // let the last % eat one more character and retry from there
+      star_s = g_utf8_next_char(star_s);
+      s = star_s;
+      p = star_p;
+    }
+    else
+      return FALSE;
+  }
+  while(*p == '%') p++;
+  return !*p;
+}
+
+uint32_t dt_tag_index_find(dt_tag_index_t *ti, const char *keyword, GArray *ids)
+{
+  // the keyword can be anywhere in the name, so there's no way around looking at all of them. that's still
+  // a lot quicker than sqlite doing the same with LIKE. wildcards typed by the user work as they did there.
+  gchar *key = g_ascii_strdown(keyword, -1);
+  gchar *pattern = NULL;
+  if(strpbrk(key, "%_")) pattern = g_strdup_printf("%%%s%%", key);
+  uint32_t count = 0;
+  dt_pthread_mutex_lock(&ti->lock);
+  for(guint k = 0; k < ti->keys->len; k++)
+  {
+    const char *name = (const char *)g_ptr_array_index(ti->keys, k);
+    if(pattern ? _tag_index_like(name, pattern) : strstr(name, key) != NULL)
+    {
+      g_array_append_val(ids, g_array_index(ti->ids, guint, k));
+      count++;
+    }
+  }
+  dt_pthread_mutex_unlock(&ti->lock);
+  g_free(pattern);
+  g_free(key);
+  return count;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
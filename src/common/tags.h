@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
+
 #include <glib.h>
 #include <sqlite3.h>
 #include <stdint.h>
@@ -110,6 +112,27 @@ void dt_tag_reorganize(const gchar *source, const gchar *dest);
 /** make sure that main.used_tags has everything. to be used after changes to main.tagged_images */
 void dt_tag_update_used_tags();
 
+/** an in-memory copy of the tag names for the lookups done on every keystroke, and of the hierarchy in
+ * memory.tag_closure for collecting whole branches. both are read from data.tags on startup and have to be
+ * kept in sync with it by everything that writes that table. */
+typedef struct dt_tag_index_t
+{
+  dt_pthread_mutex_t lock;
+  GArray *ids;     // guint
+  GPtrArray *keys; // the names in ascii lower case, which is all that LIKE ignores
+} dt_tag_index_t;
+
+void dt_tag_index_init(dt_tag_index_t *ti);
+void dt_tag_index_cleanup(dt_tag_index_t *ti);
+/** a tag got added to data.tags. */
+void dt_tag_index_add(dt_tag_index_t *ti, const guint id, const char *name);
+/** a tag got removed from data.tags. */
+void dt_tag_index_remove(dt_tag_index_t *ti, const guint id);
+/** reads everything again, after data.tags changed in bulk. */
+void dt_tag_index_reload(dt_tag_index_t *ti);
+/** appends the ids of all tags containing keyword, ignoring ascii case, to ids. returns their number. */
+uint32_t dt_tag_index_find(dt_tag_index_t *ti, const char *keyword, GArray *ids);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -167,8 +167,10 @@ typedef struct dt_control_t
   pthread_t *thread, kick_on_workers_thread;
   dt_job_t **job;
 
-  GList *queues[DT_JOB_QUEUE_MAX];
-  size_t queue_length[DT_JOB_QUEUE_MAX];
+  int32_t running_jobs, running_res; // jobs currently executing, to share the openmp threads between them
+
+  GQueue queues[DT_JOB_QUEUE_MAX];
+  GHashTable *queued_jobs; // jobs in the DT_JOB_QUEUE_SYSTEM_FG queue -> their GList link, for deduping
 
   dt_pthread_mutex_t res_mutex;
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
@@ -17,6 +17,7 @@
 */
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <glib/gstdio.h>
 #include <sqlite3.h>
 #include <stdio.h>
@@ -24,9 +25,15 @@
 
 #include "common/darktable.h"
 #include "common/database.h"
+#include "common/debug.h"
 #include "common/history.h"
 #include "common/image.h"
+#include "common/image_cache.h"
+#include "common/sidecar_writer.h"
 #include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
+#include "control/signal.h"
 #include "crawler.h"
 #include "gui/gtk.h"
 
@@ -51,131 +58,526 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
-GList *dt_control_crawler_run()
+// stat()ing the files is mostly waiting for the disk, a few requests in flight hide that
+#define DT_CRAWLER_MAX_WORKERS 8
+// changes in a watched folder come in bursts, wait for them to settle before looking (in ms)
+#define DT_CRAWLER_SETTLE_TIME 2000
+// every watched folder costs an inotify watch, so only the most recently used film rolls get one
+#define DT_CRAWLER_MAX_WATCHES 256
+
+typedef struct _crawler_image_t
 {
-  sqlite3_stmt *stmt, *inner_stmt;
-  GList *result = NULL;
-  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  int id, version, flags;
+  int new_flags;         // flags with the .txt and .wav bits as found on disk
+  time_t timestamp;      // write_timestamp from the library
+  time_t timestamp_xmp;  // mtime of the xmp file if that's newer, 0 otherwise
+  gchar *image_path, *xmp_path;
+} _crawler_image_t;
+
+typedef struct _crawler_batch_t
+{
+  _crawler_image_t *images;
+  int num;
+  int next; // the next image for a worker
+  gboolean look_for_xmp;
+} _crawler_batch_t;
+
+typedef struct _crawler_roll_t
+{
+  int id;
+  time_t timestamp; // mtime of the folder when we last found nothing to report in it
+  gchar *folder;
+} _crawler_roll_t;
+
+typedef struct _crawler_job_t
+{
+  int film_id;    // -1 for all film rolls
+  gboolean crawl; // compare the files with the library
+  GList *files;   // names of the changed files in the folder of film_id, NULL to look at all images
+  gboolean watch; // find the folders to watch
+} _crawler_job_t;
+
+static void _crawler_job_free(void *data)
+{
+  _crawler_job_t *params = (_crawler_job_t *)data;
+  g_list_free_full(params->files, g_free);
+  free(params);
+}
 
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT i.id, write_timestamp, version, folder || '/' || filename, flags "
-                     "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
-                     -1, &stmt, NULL);
-  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
+static void _crawler_roll_free(gpointer data)
+{
+  _crawler_roll_t *roll = (_crawler_roll_t *)data;
+  g_free(roll->folder);
+  g_free(roll);
+}
 
-  // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+static void _crawler_result_free(GList *result)
+{
+  for(GList *iter = result; iter; iter = g_list_next(iter))
+  {
+    dt_control_crawler_result_t *item = (dt_control_crawler_result_t *)iter->data;
+    g_free(item->image_path);
+    g_free(item->xmp_path);
+  }
+  g_list_free_full(result, g_free);
+}
 
+// only looks at the disk, so it can run in parallel. the library gets updated by the caller.
+static void _crawler_check_image(_crawler_image_t *img, const gboolean look_for_xmp)
+{
+  const gchar *image_path = img->image_path;
+  img->new_flags = img->flags;
+
+  // no need to look for xmp files if none get written anyway.
+  if(look_for_xmp)
+  {
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(img->version, xmp_path, sizeof(xmp_path));
+    size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return;
+    xmp_path[len++] = '.';
+    xmp_path[len++] = 'x';
+    xmp_path[len++] = 'm';
+    xmp_path[len++] = 'p';
+    xmp_path[len] = '\0';
+
+    struct stat statbuf;
+    if(stat(xmp_path, &statbuf) == -1) return; // TODO: shall we report these?
+
+    // step 1: check if the xmp is newer than our db entry
+    // FIXME: allow for a few seconds difference?
+    if(img->timestamp < statbuf.st_mtime)
+    {
+      img->timestamp_xmp = statbuf.st_mtime;
+      img->xmp_path = g_strdup(xmp_path);
+    }
+    // older timestamps are the case for all images after the db upgrade. better not report these
+    //       else if(timestamp > statbuf.st_mtime)
+    //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
+  }
+
+  // step 2: check if the image has associated files (.txt, .wav)
+  const char *c = strrchr(image_path, '.');
+  const size_t len = c ? c - image_path + 1 : strlen(image_path);
+
+  char *extra_path = g_malloc0(len + 4);
+  memcpy(extra_path, image_path, len);
+
+  extra_path[len] = 't';
+  extra_path[len + 1] = 'x';
+  extra_path[len + 2] = 't';
+  gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_txt)
+  {
+    extra_path[len] = 'T';
+    extra_path[len + 1] = 'X';
+    extra_path[len + 2] = 'T';
+    has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  extra_path[len] = 'w';
+  extra_path[len + 1] = 'a';
+  extra_path[len + 2] = 'v';
+  gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_wav)
+  {
+    extra_path[len] = 'W';
+    extra_path[len + 1] = 'A';
+    extra_path[len + 2] = 'V';
+    has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
+  // else cases)
+  if(has_txt)
+    img->new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    img->new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    img->new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    img->new_flags &= ~DT_IMAGE_HAS_WAV;
+
+  g_free(extra_path);
+}
+
+// could one of the changed files belong to the image? all of them start with its name without the extension.
+static gboolean _crawler_image_changed(const char *filename, const GList *files)
+{
+  const char *ext = strrchr(filename, '.');
+  const size_t len = ext ? ext - filename : strlen(filename);
+  for(const GList *iter = files; iter; iter = g_list_next(iter))
+    if(!strncmp((const char *)iter->data, filename, len)) return TRUE;
+  return FALSE;
+}
+
+static void *_crawler_worker(void *arg)
+{
+  _crawler_batch_t *b = (_crawler_batch_t *)arg;
+  int k;
+  while((k = g_atomic_int_add(&b->next, 1)) < b->num) _crawler_check_image(&b->images[k], b->look_for_xmp);
+  return NULL;
+}
+
+// checks the images of one film roll, all of them or the ones files belongs to, and prepends the ones with a
+// newer xmp file to result, found is set to their number.
+static GList *_crawler_crawl_roll(const _crawler_roll_t *roll, const gboolean look_for_xmp,
+                                  const GList *files, GList *result, int *found)
+{
+  GArray *images = g_array_new(FALSE, TRUE, sizeof(_crawler_image_t));
+  sqlite3 *handle = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "SELECT id, write_timestamp, version, filename, flags FROM main.images "
+                                      "WHERE film_id = ?1 ORDER BY filename",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, roll->id);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    gchar *image_path = (gchar *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
+    if(files && !_crawler_image_changed((const char *)sqlite3_column_text(stmt, 3), files)) continue;
+    _crawler_image_t img = { 0 };
+    img.id = sqlite3_column_int(stmt, 0);
+    img.timestamp = sqlite3_column_int(stmt, 1);
+    img.version = sqlite3_column_int(stmt, 2);
+    img.image_path = g_strdup_printf("%s/%s", roll->folder, (const char *)sqlite3_column_text(stmt, 3));
+    img.flags = sqlite3_column_int(stmt, 4);
+    g_array_append_val(images, img);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, handle);
+
+  _crawler_batch_t b = { 0 };
+  b.images = (_crawler_image_t *)images->data;
+  b.num = images->len;
+  b.look_for_xmp = look_for_xmp;
+
+  // the workers and this thread take the images one by one
+  const int num_workers = MIN(b.num - 1, DT_CRAWLER_MAX_WORKERS - 1);
+  pthread_t workers[DT_CRAWLER_MAX_WORKERS];
+  int started = 0;
+  for(int k = 0; k < num_workers; k++)
+    if(!dt_pthread_create(&workers[started], _crawler_worker, &b)) started++;
+  _crawler_worker(&b);
+  for(int k = 0; k < started; k++) pthread_join(workers[k], NULL);
+
+  *found = 0;
+  for(int k = 0; k < b.num; k++)
+  {
+    _crawler_image_t *img = &b.images[k];
+    if(img->flags != img->new_flags)
     {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      if(stat(xmp_path, &statbuf) == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
+      // go through the cache, the image might be in use. only the bits we looked at are touched.
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, img->id, 'w');
+      if(image)
       {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
+        image->flags = (image->flags & ~(DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV))
+                       | (img->new_flags & (DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV));
+        dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
       }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
     }
+    if(img->xmp_path)
+    {
+      dt_control_crawler_result_t *item
+          = (dt_control_crawler_result_t *)g_malloc(sizeof(dt_control_crawler_result_t));
+      item->id = img->id;
+      item->timestamp_xmp = img->timestamp_xmp;
+      item->timestamp_db = img->timestamp;
+      item->image_path = img->image_path;
+      item->xmp_path = img->xmp_path;
+      result = g_list_prepend(result, item);
+      (*found)++;
+      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", item->xmp_path, img->id);
+    }
+    else
+      g_free(img->image_path);
+  }
+  g_array_free(images, TRUE);
+  return result;
+}
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) *c-- = '\0';
-    len = c - image_path + 1;
+// looks at the film rolls which changed since the last time, or at the images files belong to
+static GList *_crawler_crawl(dt_job_t *job, const int film_id, const GList *files)
+{
+  const gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  // the folder mtime doesn't change when files are rewritten in place, but then we know what changed
+  const gboolean skip_unchanged = !files && dt_conf_get_bool("crawler_skip_unchanged_folders");
+  const double start = dt_get_wtime();
+  GList *result = NULL;
+
+  // get the folders first, nothing should hold a reader while the images are checked
+  GList *rolls = NULL;
+  sqlite3 *handle = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "SELECT id, folder, crawl_timestamp FROM main.film_rolls "
+                                      "WHERE ?1 = -1 OR id = ?1 ORDER BY id",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _crawler_roll_t *roll = (_crawler_roll_t *)g_malloc(sizeof(_crawler_roll_t));
+    roll->id = sqlite3_column_int(stmt, 0);
+    roll->folder = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+    roll->timestamp = sqlite3_column_int64(stmt, 2);
+    rolls = g_list_prepend(rolls, roll);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, handle);
+  rolls = g_list_reverse(rolls);
 
-    char *extra_path = g_strndup(image_path, len + 3);
+  int crawled = 0, skipped = 0;
+  for(GList *iter = rolls; iter && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED;
+      iter = g_list_next(iter))
+  {
+    const _crawler_roll_t *roll = (_crawler_roll_t *)iter->data;
 
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+    // folders on drives that aren't mounted right now can't tell us anything
+    struct stat statbuf;
+    if(stat(roll->folder, &statbuf) == -1 || !S_ISDIR(statbuf.st_mode)) continue;
 
-    if(!has_txt)
+    // adding, removing or renaming files changes the mtime of the folder. files rewritten in place by
+    // other programs don't, see the description of crawler_skip_unchanged_folders.
+    if(skip_unchanged && statbuf.st_mtime == roll->timestamp)
     {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      skipped++;
+      continue;
     }
 
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+    int found = 0;
+    result = _crawler_crawl_roll(roll, look_for_xmp, files, result, &found);
+    crawled++;
 
-    if(!has_wav)
+    // only remember the folder as seen when there's nothing left for the user to decide about. otherwise
+    // the images would be asked about again next time, like before. a look at some files doesn't count.
+    if(!found && !files)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      stmt = dt_database_get_statement(darktable.db,
+                                       "UPDATE main.film_rolls SET crawl_timestamp = ?1 WHERE id = ?2");
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 1, statbuf.st_mtime);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, roll->id);
+      sqlite3_step(stmt);
+      dt_database_release_statement(darktable.db, stmt);
     }
+  }
+  g_list_free_full(rolls, _crawler_roll_free);
 
-    // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
-    // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
+  dt_print(DT_DEBUG_PERF, "[crawler] looked at %d folders and skipped %d unchanged ones in %.3f secs\n",
+           crawled, skipped, dt_get_wtime() - start);
+
+  return g_list_reverse(result);
+}
+
+// the local folders of the most recently used film rolls. they are only watched by the gui thread, but the
+// file system queries could block it.
+static GList *_crawler_watched_folders()
+{
+  GList *rolls = NULL;
+  sqlite3 *handle = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "SELECT id, folder FROM main.film_rolls "
+                                      "ORDER BY datetime_accessed DESC LIMIT ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, DT_CRAWLER_MAX_WATCHES);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _crawler_roll_t *roll = (_crawler_roll_t *)g_malloc0(sizeof(_crawler_roll_t));
+    roll->id = sqlite3_column_int(stmt, 0);
+    roll->folder = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+    rolls = g_list_prepend(rolls, roll);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, handle);
+
+  // nobody tells us what other machines do on network shares, and polling them is what we wanted to avoid
+  GList *iter = rolls;
+  while(iter)
+  {
+    GList *next = g_list_next(iter);
+    _crawler_roll_t *roll = (_crawler_roll_t *)iter->data;
+    GFile *file = g_file_new_for_path(roll->folder);
+    GFileInfo *info = g_file_query_filesystem_info(file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE, NULL, NULL);
+    if(!info || g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE))
+    {
+      _crawler_roll_free(roll);
+      rolls = g_list_delete_link(rolls, iter);
+    }
+    if(info) g_object_unref(info);
+    g_object_unref(file);
+    iter = next;
+  }
+  return rolls;
+}
+
+static gboolean _crawler_show_gui_thread(gpointer user_data)
+{
+  GList *result = (GList *)user_data;
+  if(darktable.crawler)
+    dt_control_crawler_show_image_list(result);
+  else
+    _crawler_result_free(result);
+  return FALSE;
+}
+
+static void _crawler_add_job(const int film_id, const gboolean crawl, GList *files, const gboolean watch);
+
+static gboolean _crawler_settled(gpointer user_data)
+{
+  dt_control_crawler_t *c = (dt_control_crawler_t *)user_data;
+  c->timeout = 0;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, c->pending);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    GList *files = NULL;
+    GHashTableIter file_iter;
+    gpointer name;
+    g_hash_table_iter_init(&file_iter, (GHashTable *)value);
+    while(g_hash_table_iter_next(&file_iter, &name, NULL)) files = g_list_prepend(files, g_strdup(name));
+    _crawler_add_job(GPOINTER_TO_INT(key), TRUE, files, FALSE);
+  }
+  g_hash_table_remove_all(c->pending);
+  return FALSE;
+}
+
+static void _crawler_folder_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                    GFileMonitorEvent event_type, gpointer user_data)
+{
+  dt_control_crawler_t *c = darktable.crawler;
+  if(!c) return;
+
+  // wait for writes to be done, created and deleted files are complete already
+  if(event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event_type != G_FILE_MONITOR_EVENT_CREATED
+     && event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  gchar *name = g_file_get_basename(file);
+  const char *ext = name ? strrchr(name, '.') : NULL;
+  gboolean interesting = ext && (!g_ascii_strcasecmp(ext, ".xmp") || !g_ascii_strcasecmp(ext, ".txt")
+                                 || !g_ascii_strcasecmp(ext, ".wav"));
+  if(interesting && !g_ascii_strcasecmp(ext, ".xmp"))
+  {
+    // a deleted xmp can't be newer than the library, and the ones we wrote ourselves aren't news either
+    gchar *path = g_file_get_path(file);
+    if(event_type == G_FILE_MONITOR_EVENT_DELETED || !path
+       || dt_sidecar_writer_is_own(darktable.sidecar_writer, path))
+      interesting = FALSE;
+    g_free(path);
+  }
+  if(!interesting)
+  {
+    g_free(name);
+    return;
+  }
+
+  GHashTable *files = (GHashTable *)g_hash_table_lookup(c->pending, user_data);
+  if(!files)
+  {
+    files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(c->pending, user_data, files);
+  }
+  g_hash_table_add(files, name);
+  if(c->timeout) g_source_remove(c->timeout);
+  c->timeout = g_timeout_add(DT_CRAWLER_SETTLE_TIME, _crawler_settled, c);
+}
+
+static gboolean _crawler_watch_gui_thread(gpointer user_data)
+{
+  GList *rolls = (GList *)user_data;
+  dt_control_crawler_t *c = darktable.crawler;
+  if(c)
+  {
+    // on linux gio does this with inotify
+    g_hash_table_remove_all(c->monitors);
+    for(GList *iter = rolls; iter; iter = g_list_next(iter))
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
+      const _crawler_roll_t *roll = (_crawler_roll_t *)iter->data;
+      GFile *file = g_file_new_for_path(roll->folder);
+      GFileMonitor *monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
+      if(monitor)
+      {
+        g_signal_connect(G_OBJECT(monitor), "changed", G_CALLBACK(_crawler_folder_changed),
+                         GINT_TO_POINTER(roll->id));
+        g_hash_table_insert(c->monitors, GINT_TO_POINTER(roll->id), monitor);
+      }
+      g_object_unref(file);
     }
+    dt_print(DT_DEBUG_CONTROL, "[crawler] watching %u folders\n", g_hash_table_size(c->monitors));
+  }
+  g_list_free_full(rolls, _crawler_roll_free);
+  return FALSE;
+}
 
-    g_free(extra_path);
+static int32_t _crawler_job_run(dt_job_t *job)
+{
+  const _crawler_job_t *params = (_crawler_job_t *)dt_control_job_get_params(job);
+  if(params->crawl)
+  {
+    GList *result = _crawler_crawl(job, params->film_id, params->files);
+    if(result) g_main_context_invoke(NULL, _crawler_show_gui_thread, result);
   }
+  if(params->watch) g_main_context_invoke(NULL, _crawler_watch_gui_thread, _crawler_watched_folders());
+  return 0;
+}
 
-  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+// takes ownership of files
+static void _crawler_add_job(const int film_id, const gboolean crawl, GList *files, const gboolean watch)
+{
+  dt_job_t *job = dt_control_job_create(&_crawler_job_run, "crawler");
+  if(!job)
+  {
+    g_list_free_full(files, g_free);
+    return;
+  }
+  _crawler_job_t *params = (_crawler_job_t *)calloc(1, sizeof(_crawler_job_t));
+  if(!params)
+  {
+    g_list_free_full(files, g_free);
+    dt_control_job_dispose(job);
+    return;
+  }
+  params->film_id = film_id;
+  params->crawl = crawl;
+  params->files = files;
+  params->watch = watch;
+  dt_control_job_set_params(job, params, _crawler_job_free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
 
-  sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+// film rolls got added, removed or moved, watch the right folders
+static void _crawler_filmrolls_changed(gpointer instance, gpointer user_data)
+{
+  _crawler_add_job(-1, FALSE, NULL, TRUE);
+}
 
-  return result;
+void dt_control_crawler_init(dt_control_crawler_t *c)
+{
+  c->monitors = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+  c->pending
+      = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+  c->timeout = 0;
+  c->gui = NULL;
+}
+
+void dt_control_crawler_cleanup(dt_control_crawler_t *c)
+{
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_crawler_filmrolls_changed), c);
+  if(c->timeout) g_source_remove(c->timeout);
+  c->timeout = 0;
+  g_hash_table_destroy(c->monitors);
+  g_hash_table_destroy(c->pending);
+}
+
+void dt_control_crawler_start(dt_control_crawler_t *c)
+{
+  const gboolean crawl = dt_conf_get_bool("run_crawler_on_start");
+  const gboolean watch = dt_conf_get_bool("crawler_watch_folders");
+  if(watch)
+    dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
+                              G_CALLBACK(_crawler_filmrolls_changed), c);
+  if(crawl || watch) _crawler_add_job(-1, crawl, NULL, watch);
 }
 
 
@@ -192,6 +594,7 @@ typedef struct dt_control_crawler_gui_t
 static void dt_control_crawler_response_callback(GtkWidget *dialog, gint response_id, gpointer user_data)
 {
   dt_control_crawler_gui_t *gui = (dt_control_crawler_gui_t *)user_data;
+  if(darktable.crawler && darktable.crawler->gui == gui) darktable.crawler->gui = NULL;
   g_object_unref(G_OBJECT(gui->model));
   gtk_widget_destroy(dialog);
   free(gui);
@@ -290,12 +693,55 @@ void _overwrite_button_clicked(GtkButton *button, gpointer user_data)
   _clear_select_all(gui);
 }
 
+// appends the images which aren't in the list yet and frees them
+static void _crawler_gui_add(GtkListStore *store, GList *images)
+{
+  GHashTable *listed = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GtkTreeIter iter;
+  gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter);
+  while(valid)
+  {
+    int id;
+    gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, DT_CONTROL_CRAWLER_COL_ID, &id, -1);
+    g_hash_table_add(listed, GINT_TO_POINTER(id));
+    valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter);
+  }
+
+  GList *list_iter = g_list_first(images);
+  while(list_iter)
+  {
+    dt_control_crawler_result_t *item = list_iter->data;
+    if(!g_hash_table_contains(listed, GINT_TO_POINTER(item->id)))
+    {
+      char timestamp_db[64], timestamp_xmp[64];
+      strftime(timestamp_db, sizeof(timestamp_db), "%c", localtime(&item->timestamp_db));
+      strftime(timestamp_xmp, sizeof(timestamp_xmp), "%c", localtime(&item->timestamp_xmp));
+      gtk_list_store_append(store, &iter);
+      gtk_list_store_set(store, &iter, DT_CONTROL_CRAWLER_COL_SELECTED, 0, DT_CONTROL_CRAWLER_COL_ID,
+                         item->id, DT_CONTROL_CRAWLER_COL_IMAGE_PATH, item->image_path,
+                         DT_CONTROL_CRAWLER_COL_XMP_PATH, item->xmp_path, DT_CONTROL_CRAWLER_COL_TS_XMP,
+                         timestamp_xmp, DT_CONTROL_CRAWLER_COL_TS_DB, timestamp_db, -1);
+      g_hash_table_add(listed, GINT_TO_POINTER(item->id));
+    }
+    list_iter = g_list_next(list_iter);
+  }
+  g_hash_table_destroy(listed);
+  _crawler_result_free(images);
+}
+
 // show a popup window with a list of updated images/xmp files and allow the user to tell dt what to do about
 // them
 void dt_control_crawler_show_image_list(GList *images)
 {
   if(!images) return;
 
+  // a later look at the folders found more, don't stack dialogs on top of each other
+  if(darktable.crawler && darktable.crawler->gui)
+  {
+    _crawler_gui_add(GTK_LIST_STORE(darktable.crawler->gui->model), images);
+    return;
+  }
+
   dt_control_crawler_gui_t *gui = (dt_control_crawler_gui_t *)malloc(sizeof(dt_control_crawler_gui_t));
 
   // a list with all the images
@@ -312,25 +758,7 @@ void dt_control_crawler_show_image_list(GList *images)
                                            );
 
   gui->model = GTK_TREE_MODEL(store);
-
-  GList *list_iter = g_list_first(images);
-  while(list_iter)
-  {
-    GtkTreeIter iter;
-    dt_control_crawler_result_t *item = list_iter->data;
-    char timestamp_db[64], timestamp_xmp[64];
-    strftime(timestamp_db, sizeof(timestamp_db), "%c", localtime(&item->timestamp_db));
-    strftime(timestamp_xmp, sizeof(timestamp_xmp), "%c", localtime(&item->timestamp_xmp));
-    gtk_list_store_append(store, &iter);
-    gtk_list_store_set(store, &iter, DT_CONTROL_CRAWLER_COL_SELECTED, 0, DT_CONTROL_CRAWLER_COL_ID, item->id,
-                       DT_CONTROL_CRAWLER_COL_IMAGE_PATH, item->image_path, DT_CONTROL_CRAWLER_COL_XMP_PATH,
-                       item->xmp_path, DT_CONTROL_CRAWLER_COL_TS_XMP, timestamp_xmp,
-                       DT_CONTROL_CRAWLER_COL_TS_DB, timestamp_db, -1);
-    g_free(item->image_path);
-    g_free(item->xmp_path);
-    list_iter = g_list_next(list_iter);
-  }
-  g_list_free_full(images, g_free);
+  _crawler_gui_add(store, images);
 
   GtkWidget *tree = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
 
@@ -392,6 +820,7 @@ void dt_control_crawler_show_image_list(GList *images)
   gtk_widget_show_all(dialog);
 
   g_signal_connect(dialog, "response", G_CALLBACK(dt_control_crawler_response_callback), gui);
+  if(darktable.crawler) darktable.crawler->gui = gui;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -20,20 +20,33 @@
 
 #include <glib.h>
 
-/** this isn't a background job on purpose. it has to be really fast so it shouldn't
- *  require locking from image cache or anything like that.
- *  should we find out that we want to have a background job that crawls over all images
- *  we can maybe refactor this, but for now it's good the way it is.
+/** looks for images whose xmp file is newer than the library entry, and notes which images have an
+ *  associated .txt or .wav file. this runs as a background job: once on startup if run_crawler_on_start is
+ *  set, over the folders that changed since the last time, and for every change in the folders of the
+ *  recent film rolls, which are watched while darktable runs if crawler_watch_folders is set. for those
+ *  only the images whose files changed are looked at, and the sidecars darktable writes itself are ignored.
+ *  images with a (supposedly) updated xmp file are shown to the user to let them decide.
  */
 
-// this function iterates over ALL images from the database and checks whether
-// - the XMP file on disk is newer than the timestamp from db
-// - there is a .txt or .wav file associated with the image and mark so in the db
-//   or if such a file no longer exists
-// it returns the list of images with a (supposedly) updated xmp file to let the user decide
-GList *dt_control_crawler_run();
+struct dt_control_crawler_gui_t;
 
-// show a popup with the images, let the user decide what to do and free the list afterwards
+typedef struct dt_control_crawler_t
+{
+  // all of this is only touched by the gui thread
+  GHashTable *monitors; // film id -> GFileMonitor of its folder
+  GHashTable *pending;  // film id -> set of the names of changed files that weren't looked at yet
+  guint timeout;        // waits for the changes to settle
+  struct dt_control_crawler_gui_t *gui; // the open dialog, later results are added to it
+} dt_control_crawler_t;
+
+void dt_control_crawler_init(dt_control_crawler_t *c);
+void dt_control_crawler_cleanup(dt_control_crawler_t *c);
+
+// queue the startup crawl and start watching, depending on the config
+void dt_control_crawler_start(dt_control_crawler_t *c);
+
+// show a popup with the images, or add them to the one that's open already, let the user decide what to do
+// and free the list afterwards
 void dt_control_crawler_show_image_list(GList *images);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -50,6 +50,7 @@ typedef struct _dt_job_t
   dt_job_state_t state;
   unsigned char priority;
   dt_job_queue_t queue;
+  guint hash; // of what dt_control_job_equal() compares, set when the job gets added to a queue
 
   dt_job_state_change_callback state_changed_cb;
 
@@ -67,13 +68,40 @@ typedef struct _dt_job_t
 static inline int dt_control_job_equal(_dt_job_t *j1, _dt_job_t *j2)
 {
   if(!j1 || !j2) return 0;
-  if(j1->params_size != 0 && j1->params_size == j2->params_size)
+  // jobs with sized params are only compared by those, the description is for the others. that's what keeps
+  // dt_control_job_compute_hash() in line with this.
+  if(j1->params_size != j2->params_size) return 0;
+  if(j1->params_size != 0)
     return (j1->execute == j2->execute && j1->state_changed_cb == j2->state_changed_cb
             && j1->queue == j2->queue && (memcmp(j1->params, j2->params, j1->params_size) == 0));
   return (j1->execute == j2->execute && j1->state_changed_cb == j2->state_changed_cb && j1->queue == j2->queue
           && (g_strcmp0(j1->description, j2->description) == 0));
 }
 
+/** fnv-1a over what dt_control_job_equal() compares: the params if they are sized, the description
+ * otherwise, execute, state_changed_cb and the queue. so equal jobs hash equal. */
+static guint dt_control_job_compute_hash(const _dt_job_t *job)
+{
+  const unsigned char *data = job->params_size != 0 ? (const unsigned char *)job->params
+                                                    : (const unsigned char *)job->description;
+  const size_t size = job->params_size != 0 ? job->params_size : strlen(job->description);
+  guint hash = 2166136261u;
+  for(size_t k = 0; k < size; k++) hash = (hash ^ data[k]) * 16777619u;
+  hash ^= (guint)(guintptr)job->execute;
+  hash ^= (guint)(guintptr)job->state_changed_cb * 31u;
+  return hash ^ job->queue;
+}
+
+static guint dt_control_job_hash_func(gconstpointer key)
+{
+  return ((const _dt_job_t *)key)->hash;
+}
+
+static gboolean dt_control_job_equal_func(gconstpointer a, gconstpointer b)
+{
+  return dt_control_job_equal((_dt_job_t *)a, (_dt_job_t *)b);
+}
+
 static void dt_control_job_set_state(_dt_job_t *job, dt_job_state_t state)
 {
   if(!job) return;
@@ -184,6 +212,20 @@ void dt_control_job_wait(_dt_job_t *job)
   }
 }
 
+/** every job is free to open openmp parallel regions. instead of letting each of them spawn a full team,
+ *  oversubscribing the cores as soon as a few thumbnails and an export run along with the darkroom, the
+ *  background jobs split the cores among themselves. the darkroom pipes on the reserved workers always get the
+ *  full team and leave only half of the cores to the background while they are busy. */
+static void dt_control_job_set_omp_threads(dt_control_t *control)
+{
+#ifdef _OPENMP
+  const int busy_res = __sync_fetch_and_add(&control->running_res, 0);
+  const int busy = MAX(1, __sync_fetch_and_add(&control->running_jobs, 0));
+  const int available = busy_res ? MAX(1, darktable.num_openmp_threads / 2) : darktable.num_openmp_threads;
+  omp_set_num_threads(MAX(1, available / busy));
+#endif
+}
+
 static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
 {
   if(((unsigned int)res) >= DT_CTL_WORKER_RESERVED) return -1;
@@ -210,7 +252,9 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
     dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    __sync_fetch_and_add(&control->running_res, 1);
     job->result = job->execute(job);
+    __sync_fetch_and_sub(&control->running_res, 1);
 
     dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
     dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
@@ -237,15 +281,15 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
 
   dt_pthread_mutex_lock(&control->queue_mutex);
 
-  // find the job
+  // find the job. only the queue heads take part, so this doesn't depend on the number of queued jobs.
   _dt_job_t *job = NULL;
   int winner_queue = DT_JOB_QUEUE_MAX;
   int max_priority = -1;
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
-    if(control->queues[i] == NULL) continue;
+    if(g_queue_is_empty(&control->queues[i])) continue;
     if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
-    _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
+    _dt_job_t *_job = (_dt_job_t *)g_queue_peek_head(&control->queues[i]);
     if(_job->priority > max_priority)
     {
       max_priority = _job->priority;
@@ -265,19 +309,19 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
   // invariant -> job is the one we are looking for
 
   // remove the to be scheduled job from its queue
-  GList **queue = &control->queues[winner_queue];
-  *queue = g_list_delete_link(*queue, *queue);
-  control->queue_length[winner_queue]--;
+  if(winner_queue == DT_JOB_QUEUE_SYSTEM_FG) g_hash_table_remove(control->queued_jobs, job);
+  g_queue_pop_head(&control->queues[winner_queue]);
   if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
 
   // and place it in scheduled job array (for job deduping)
   control->job[dt_control_get_threadid()] = job;
 
-  // increment the priorities of the others
+  // increment the priorities of the others. aging only the heads is enough: a job only competes once it
+  // got to the head of its queue.
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
-    if(i == winner_queue || control->queues[i] == NULL) continue;
-    ((_dt_job_t *)control->queues[i]->data)->priority++;
+    if(i == winner_queue || g_queue_is_empty(&control->queues[i])) continue;
+    ((_dt_job_t *)g_queue_peek_head(&control->queues[i]))->priority++;
   }
 
   dt_pthread_mutex_unlock(&control->queue_mutex);
@@ -295,7 +339,10 @@ static void dt_control_job_execute(_dt_job_t *job)
   dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
   /* execute job */
+  __sync_fetch_and_add(&darktable.control->running_jobs, 1);
+  dt_control_job_set_omp_threads(darktable.control);
   job->result = job->execute(job);
+  __sync_fetch_and_sub(&darktable.control->running_jobs, 1);
 
   dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
 
@@ -385,15 +432,15 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   }
 
   job->queue = queue_id;
+  job->hash = dt_control_job_compute_hash(job);
 
   _dt_job_t *job_for_disposal = NULL;
 
   dt_pthread_mutex_lock(&control->queue_mutex);
 
-  GList **queue = &control->queues[queue_id];
-  size_t length = control->queue_length[queue_id];
+  GQueue *queue = &control->queues[queue_id];
 
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", length);
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %u | ", g_queue_get_length(queue));
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
@@ -422,40 +469,35 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     }
 
     // if the job is already in the queue -> move it to the top
-    for(GList *iter = *queue; iter; iter = g_list_next(iter))
+    GList *link = (GList *)g_hash_table_lookup(control->queued_jobs, job);
+    if(link)
     {
-      _dt_job_t *other_job = (_dt_job_t *)iter->data;
-      if(dt_control_job_equal(job, other_job))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
-
-        *queue = g_list_delete_link(*queue, iter);
-        length--;
+      _dt_job_t *other_job = (_dt_job_t *)link->data;
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
+      dt_control_job_print(other_job);
+      dt_print(DT_DEBUG_CONTROL, "\n");
 
-        job_for_disposal = job;
+      g_queue_unlink(queue, link);
+      g_queue_push_head_link(queue, link);
 
-        job = other_job;
-        break; // there can't be any further copy in the list
-      }
+      job_for_disposal = job;
+      job = other_job;
+    }
+    else
+    {
+      // now we can add the new job to the list
+      g_queue_push_head(queue, job);
+      g_hash_table_insert(control->queued_jobs, job, queue->head);
     }
-
-    // now we can add the new job to the list
-    *queue = g_list_prepend(*queue, job);
-    length++;
 
     // and take care of the maximal queue size
-    if(length > DT_CONTROL_MAX_JOBS)
+    if(g_queue_get_length(queue) > DT_CONTROL_MAX_JOBS)
     {
-      GList *last = g_list_last(*queue);
-      dt_control_job_set_state((_dt_job_t *)last->data, DT_JOB_STATE_DISCARDED);
-      dt_control_job_dispose((_dt_job_t *)last->data);
-      *queue = g_list_delete_link(*queue, last);
-      length--;
+      _dt_job_t *last = (_dt_job_t *)g_queue_pop_tail(queue);
+      g_hash_table_remove(control->queued_jobs, last);
+      dt_control_job_set_state(last, DT_JOB_STATE_DISCARDED);
+      dt_control_job_dispose(last);
     }
-
-    control->queue_length[queue_id] = length;
   }
   else
   {
@@ -466,8 +508,7 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
       job->priority = 0;
     else
       job->priority = DT_CONTROL_FG_PRIORITY;
-    *queue = g_list_append(*queue, job);
-    control->queue_length[queue_id]++;
+    g_queue_push_tail(queue, job);
   }
   dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
   dt_pthread_mutex_unlock(&control->queue_mutex);
@@ -599,6 +640,8 @@ void dt_control_jobs_init(dt_control_t *control)
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
   control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  for(int k = 0; k < DT_JOB_QUEUE_MAX; k++) g_queue_init(&control->queues[k]);
+  control->queued_jobs = g_hash_table_new(dt_control_job_hash_func, dt_control_job_equal_func);
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -628,6 +671,7 @@ void dt_control_jobs_init(dt_control_t *control)
 
 void dt_control_jobs_cleanup(dt_control_t *control)
 {
+  g_hash_table_destroy(control->queued_jobs);
   free(control->job);
   free(control->thread);
 }
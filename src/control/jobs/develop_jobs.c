@@ -49,6 +49,37 @@ dt_job_t *dt_dev_process_image_job_create(dt_develop_t *dev)
   return job;
 }
 
+typedef struct dt_dev_prefetch_t
+{
+  dt_develop_t *dev;
+  int32_t imgid;
+  uint32_t serial;
+} dt_dev_prefetch_t;
+
+static int32_t dt_dev_prefetch_job_run(dt_job_t *job)
+{
+  dt_dev_prefetch_t *params = dt_control_job_get_params(job);
+  dt_dev_prefetch_job(params->dev, params->imgid, params->serial);
+  return 0;
+}
+
+dt_job_t *dt_dev_prefetch_job_create(dt_develop_t *dev, const int32_t imgid, const uint32_t serial)
+{
+  dt_job_t *job = dt_control_job_create(&dt_dev_prefetch_job_run, "develop prefetch neighbours");
+  if(!job) return NULL;
+  dt_dev_prefetch_t *params = (dt_dev_prefetch_t *)calloc(1, sizeof(dt_dev_prefetch_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  params->dev = dev;
+  params->imgid = imgid;
+  params->serial = serial;
+  dt_control_job_set_params_with_size(job, params, sizeof(dt_dev_prefetch_t), free);
+  return job;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -29,6 +29,9 @@ dt_job_t *dt_dev_process_preview_job_create(dt_develop_t *dev);
 /** process image */
 dt_job_t *dt_dev_process_image_job_create(dt_develop_t *dev);
 
+/** prefetch the filmstrip neighbours of imgid */
+dt_job_t *dt_dev_prefetch_job_create(dt_develop_t *dev, const int32_t imgid, const uint32_t serial);
+
 dt_job_t *dt_dev_export_create();
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
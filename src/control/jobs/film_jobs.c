@@ -17,9 +17,18 @@
 */
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
+#include "common/debug.h"
 #include "common/film.h"
+#include "common/image.h"
 #include <stdlib.h>
 
+// images added to the library per transaction at most
+#define DT_FILM_IMPORT_BATCH 64
+// reading the metadata is mostly waiting for the disk or the network, so more threads than cores can help
+#define DT_FILM_IMPORT_MAX_WORKERS 16
+// how many files the workers may read ahead of what has been added to the library
+#define DT_FILM_IMPORT_AHEAD 128
+
 typedef struct dt_film_import1_t
 {
   dt_film_t *film;
@@ -68,7 +77,7 @@ dt_job_t *dt_film_import1_create(dt_film_t *film)
     dt_control_job_dispose(job);
     return NULL;
   }
-  dt_control_job_add_progress(job, _("import images"), FALSE);
+  dt_control_job_add_progress(job, _("import images"), TRUE);
   dt_control_job_set_params(job, params, dt_film_import1_cleanup);
   params->film = film;
   dt_pthread_mutex_lock(&film->images_mutex);
@@ -133,6 +142,115 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+/* the import is a pipeline: a few workers check the files and parse their metadata and sidecars, which
+   doesn't need the library, while this thread adds the results to the library in the original order, in
+   large transactions. */
+typedef struct _film_import_pipeline_t
+{
+  gchar **files;
+  gboolean *known; // in the library already, the metadata won't be needed
+  dt_image_import_prefetch_t **results;
+  gboolean *done;
+  int num;
+  int next;     // the next file for a worker
+  int consumed; // everything before this has been taken by the writer
+  int stop;
+  int workers;
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} _film_import_pipeline_t;
+
+static void *_film_import_worker(void *arg)
+{
+  _film_import_pipeline_t *pl = (_film_import_pipeline_t *)arg;
+  dt_pthread_mutex_lock(&pl->mutex);
+  for(;;)
+  {
+    while(!pl->stop && pl->next < pl->num && pl->next >= pl->consumed + DT_FILM_IMPORT_AHEAD)
+      dt_pthread_cond_wait(&pl->cond, &pl->mutex);
+    if(pl->stop || pl->next >= pl->num) break;
+    const int k = pl->next++;
+    dt_pthread_mutex_unlock(&pl->mutex);
+
+    dt_image_import_prefetch_t *p = dt_image_import_prefetch(pl->files[k], FALSE, pl->known[k]);
+
+    dt_pthread_mutex_lock(&pl->mutex);
+    pl->results[k] = p;
+    pl->done[k] = TRUE;
+    pthread_cond_broadcast(&pl->cond);
+  }
+  dt_pthread_mutex_unlock(&pl->mutex);
+  return NULL;
+}
+
+// wait for file k to be prefetched and take it. NULL if it can't be imported.
+static dt_image_import_prefetch_t *_film_import_take(_film_import_pipeline_t *pl, const int k)
+{
+  // no threads, no pipeline
+  if(!pl->workers) return dt_image_import_prefetch(pl->files[k], FALSE, pl->known[k]);
+
+  dt_pthread_mutex_lock(&pl->mutex);
+  while(!pl->done[k]) dt_pthread_cond_wait(&pl->cond, &pl->mutex);
+  dt_image_import_prefetch_t *p = pl->results[k];
+  pl->results[k] = NULL;
+  pl->consumed = k + 1;
+  pthread_cond_broadcast(&pl->cond);
+  dt_pthread_mutex_unlock(&pl->mutex);
+  return p;
+}
+
+// whether file k has been prefetched already, so that taking it doesn't wait
+static gboolean _film_import_ready(_film_import_pipeline_t *pl, const int k)
+{
+  if(!pl->workers) return FALSE;
+  dt_pthread_mutex_lock(&pl->mutex);
+  const gboolean ready = pl->done[k];
+  dt_pthread_mutex_unlock(&pl->mutex);
+  return ready;
+}
+
+// commit the open batch and only then tell everyone about its images
+static void _film_import_commit(GArray *imported)
+{
+  dt_database_release_transaction(darktable.db);
+  for(guint i = 0; i < imported->len; i++)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, g_array_index(imported, uint32_t, i));
+  g_array_set_size(imported, 0);
+}
+
+// look up which of the files are in the library already, one query per directory.
+static void _film_import_find_known(_film_import_pipeline_t *pl)
+{
+  GHashTable *known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  GHashTable *folders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT i.filename FROM main.images AS i, main.film_rolls AS f "
+                              "WHERE i.film_id = f.id AND f.folder = ?1",
+                              -1, &stmt, NULL);
+  for(int k = 0; k < pl->num; k++)
+  {
+    gchar *folder = g_path_get_dirname(pl->files[k]);
+    if(g_hash_table_contains(folders, folder))
+    {
+      g_free(folder);
+      continue;
+    }
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, folder, -1, SQLITE_TRANSIENT);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      g_hash_table_add(known, g_build_filename(folder, (const char *)sqlite3_column_text(stmt, 0), NULL));
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    g_hash_table_add(folders, folder);
+  }
+  sqlite3_finalize(stmt);
+
+  for(int k = 0; k < pl->num; k++) pl->known[k] = g_hash_table_contains(known, pl->files[k]);
+
+  g_hash_table_destroy(folders);
+  g_hash_table_destroy(known);
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -200,16 +318,50 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
   dt_control_job_set_progress_message(job, message);
 
 
+  /* set up the pipeline and start reading ahead */
+  _film_import_pipeline_t pl = { 0 };
+  pl.num = total;
+  pl.files = (gchar **)calloc(total, sizeof(gchar *));
+  pl.known = (gboolean *)calloc(total, sizeof(gboolean));
+  pl.results = (dt_image_import_prefetch_t **)calloc(total, sizeof(dt_image_import_prefetch_t *));
+  pl.done = (gboolean *)calloc(total, sizeof(gboolean));
+  {
+    int k = 0;
+    for(GList *image = images; image; image = g_list_next(image)) pl.files[k++] = (gchar *)image->data;
+  }
+  _film_import_find_known(&pl);
+  dt_pthread_mutex_init(&pl.mutex, NULL);
+  pthread_cond_init(&pl.cond, NULL);
+
+  const double start = dt_get_wtime();
+  const int num_workers = MIN(MAX(2, dt_get_num_threads()), DT_FILM_IMPORT_MAX_WORKERS);
+  pthread_t workers[DT_FILM_IMPORT_MAX_WORKERS];
+  for(int k = 0; k < num_workers; k++)
+    if(!dt_pthread_create(&workers[pl.workers], _film_import_worker, &pl)) pl.workers++;
+
+  /* the library connection is shared with the gui and other jobs, so the transactions only ever hold images
+     that have been read already, and never wait for the disk. the other side only learns about the images
+     once they are committed. */
+  gboolean in_transaction = FALSE;
+  int batch = 0;
+  GArray *imported = g_array_sized_new(FALSE, FALSE, sizeof(uint32_t), DT_FILM_IMPORT_BATCH);
+
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  for(int k = 0; k < pl.num && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED; k++)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    gchar *cdn = g_path_get_dirname(pl.files[k]);
 
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
     {
+      if(in_transaction)
+      {
+        _film_import_commit(imported);
+        in_transaction = FALSE;
+        batch = 0;
+      }
+
       // FIXME: maybe refactor into function and call it?
       if(cfr && cfr->dir)
       {
@@ -252,14 +404,50 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
     g_free(cdn);
 
+    /* make the images visible to everyone before waiting for the next one, or when the batch is full */
+    if(in_transaction && (batch >= DT_FILM_IMPORT_BATCH || !_film_import_ready(&pl, k)))
+    {
+      _film_import_commit(imported);
+      in_transaction = FALSE;
+      batch = 0;
+    }
+
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    dt_image_import_prefetch_t *p = _film_import_take(&pl, k);
+    if(p)
+    {
+      if(!in_transaction)
+      {
+        dt_database_start_transaction(darktable.db);
+        in_transaction = TRUE;
+      }
+      dt_image_import_prefetched(cfr->id, p, imported);
+      dt_image_import_prefetch_free(p);
+      batch++;
+    }
 
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
+  }
 
-
-  } while((image = g_list_next(image)) != NULL);
+  if(in_transaction) _film_import_commit(imported);
+  g_array_free(imported, TRUE);
+  dt_print(DT_DEBUG_PERF, "[film_import] %u images in %.3f secs with %d workers\n", total, dt_get_wtime() - start,
+           pl.workers);
+
+  // stop the workers, in case we were cancelled, and throw away what they read ahead
+  dt_pthread_mutex_lock(&pl.mutex);
+  pl.stop = 1;
+  pthread_cond_broadcast(&pl.cond);
+  dt_pthread_mutex_unlock(&pl.mutex);
+  for(int k = 0; k < pl.workers; k++) pthread_join(workers[k], NULL);
+  for(int k = 0; k < pl.num; k++) dt_image_import_prefetch_free(pl.results[k]);
+  pthread_cond_destroy(&pl.cond);
+  dt_pthread_mutex_destroy(&pl.mutex);
+  free(pl.files);
+  free(pl.known);
+  free(pl.results);
+  free(pl.done);
 
   g_list_free_full(images, g_free);
 
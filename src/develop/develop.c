@@ -25,11 +25,13 @@
 #include <strings.h>
 #include <unistd.h>
 
+#include "common/collection.h"
 #include "common/debug.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
+#include "common/sidecar_writer.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -46,9 +48,13 @@
 #define DT_DEV_AVERAGE_DELAY_START 250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START 50
 #define DT_DEV_AVERAGE_DELAY_COUNT 5
+#define DT_DEV_PROGRESSIVE_TILE_SIZE 512
+#define DT_DEV_PROGRESSIVE_TILE_MARGIN 32
 
 const gchar *dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
 
+static void _dev_history_written_free(gpointer data);
+
 void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
 {
   memset(dev, 0, sizeof(dt_develop_t));
@@ -63,6 +69,7 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dt_pthread_mutex_init(&dev->history_mutex, NULL);
   dev->history_end = 0;
   dev->history = NULL; // empty list
+  dev->history_written = g_ptr_array_new_with_free_func(_dev_history_written_free);
 
   dev->gui_attached = gui_attached;
   dev->width = -1;
@@ -77,6 +84,10 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->pipe = dev->preview_pipe = NULL;
   dt_pthread_mutex_init(&dev->pipe_mutex, NULL);
   dt_pthread_mutex_init(&dev->preview_pipe_mutex, NULL);
+  dt_pthread_mutex_init(&dev->progressive.mutex, NULL);
+  dt_pthread_mutex_init(&dev->prefetch.mutex, NULL);
+  dev->prefetch.done = -1;
+  dev->prefetch.standin[0].imgid = dev->prefetch.standin[1].imgid = -1;
   //   dt_pthread_mutex_init(&dev->histogram_waveform_mutex, NULL);
   dev->histogram = NULL;
   dev->histogram_pre_tonecurve = NULL;
@@ -144,11 +155,19 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dt_dev_pixelpipe_cleanup(dev->preview_pipe);
     free(dev->preview_pipe);
   }
+  // the pipe might have pointed its backbuf here, so free only after the pipe is gone:
+  dt_pthread_mutex_destroy(&dev->progressive.mutex);
+  free(dev->progressive.buf);
+  free(dev->progressive.done);
+  dt_pthread_mutex_destroy(&dev->prefetch.mutex);
+  free(dev->prefetch.standin[0].buf);
+  free(dev->prefetch.standin[1].buf);
   while(dev->history)
   {
     dt_dev_free_history_item(((dt_dev_history_item_t *)dev->history->data));
     dev->history = g_list_delete_link(dev->history, dev->history);
   }
+  g_ptr_array_free(dev->history_written, TRUE);
   while(dev->iop)
   {
     dt_iop_cleanup_module((dt_iop_module_t *)dev->iop->data);
@@ -190,6 +209,161 @@ void dt_dev_process_preview(dt_develop_t *dev)
   if(err) fprintf(stderr, "[dev_process_preview] job queue exceeded!\n");
 }
 
+void dt_dev_prefetch(dt_develop_t *dev)
+{
+  if(!dev->gui_attached || !dt_conf_get_bool("darkroom/ui/prefetch_neighbours")) return;
+  const int32_t imgid = dev->image_storage.id;
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  const int start = !dev->prefetch.queued && dev->prefetch.done != imgid;
+  if(start) dev->prefetch.queued = 1;
+  const uint32_t serial = dev->prefetch.serial;
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+  if(start)
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, dt_dev_prefetch_job_create(dev, imgid, serial));
+}
+
+void dt_dev_prefetch_cancel(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  dev->prefetch.serial++;
+  dev->prefetch.queued = 0;
+  if(dev->prefetch.pipe) dev->prefetch.pipe->shutdown = 1;
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+}
+
+static inline int _dev_prefetch_cancelled(dt_develop_t *dev, const uint32_t serial)
+{
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  const int cancelled = dev->prefetch.serial != serial;
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+  return cancelled || dev->gui_leaving || !dt_control_running();
+}
+
+// the full and f caches only hold a handful of buffers each, the image being edited is one of them. only
+// load a neighbour into a free slot, it would evict that image otherwise.
+static inline int _dev_prefetch_have_room_in(dt_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const int room = cache->cost + 1 <= cache->cost_quota;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return room;
+}
+
+static inline int _dev_prefetch_have_room()
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  return _dev_prefetch_have_room_in(&cache->mip_full.cache) && _dev_prefetch_have_room_in(&cache->mip_f.cache);
+}
+
+static void _dev_prefetch_render(dt_develop_t *dev, const int32_t imgid, const int slot, const uint32_t serial)
+{
+  // this loads the raw into the full mipmap cache, which is what dt_dev_change_image() would block on
+  dt_develop_t nb;
+  dt_dev_init(&nb, 0);
+  dt_dev_load_image(&nb, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf || !buf.width || !buf.height) goto error_early;
+
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_preview(&pipe)) goto error;
+
+  dt_dev_pixelpipe_set_input(&pipe, &nb, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &nb);
+  dt_dev_pixelpipe_synch_all(&pipe, &nb);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &nb, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  // no need to go beyond what fits into the center view
+  const float scale = fminf(1.0f, fminf(dev->width * darktable.gui->ppd / (float)pipe.processed_width,
+                                        dev->height * darktable.gui->ppd / (float)pipe.processed_height));
+  const int wd = pipe.processed_width * scale;
+  const int ht = pipe.processed_height * scale;
+
+  // publish the pipe, so dt_dev_prefetch_cancel() can shut it down
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  const int cancelled = dev->prefetch.serial != serial;
+  if(!cancelled) dev->prefetch.pipe = &pipe;
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+  if(cancelled) goto error;
+
+  const int failed = dt_dev_pixelpipe_process(&pipe, &nb, 0, 0, wd, ht, scale);
+
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  dev->prefetch.pipe = NULL;
+  if(!failed && pipe.backbuf && dev->prefetch.serial == serial)
+  {
+    const size_t size = (size_t)pipe.backbuf_width * pipe.backbuf_height * 4 * sizeof(uint8_t);
+    free(dev->prefetch.standin[slot].buf);
+    dev->prefetch.standin[slot].buf = (uint8_t *)malloc(size);
+    dev->prefetch.standin[slot].imgid = dev->prefetch.standin[slot].buf ? imgid : -1;
+    if(dev->prefetch.standin[slot].buf)
+    {
+      memcpy(dev->prefetch.standin[slot].buf, pipe.backbuf, size);
+      dev->prefetch.standin[slot].width = pipe.backbuf_width;
+      dev->prefetch.standin[slot].height = pipe.backbuf_height;
+    }
+  }
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+
+error:
+  dt_dev_pixelpipe_cleanup(&pipe);
+error_early:
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  dt_dev_cleanup(&nb);
+}
+
+void dt_dev_prefetch_job(dt_develop_t *dev, const int32_t imgid, const uint32_t serial)
+{
+  if(_dev_prefetch_cancelled(dev, serial)) return;
+
+  // find the neighbours in the current collection, the next one first: culling mostly goes forward.
+  int32_t neighbours[2] = { -1, -1 };
+  const gchar *query = dt_collection_get_query(darktable.collection);
+  if(query)
+  {
+    const int offset = dt_collection_image_offset(imgid);
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, MAX(0, offset - 1));
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offset > 0 ? 3 : 2);
+    int found = 0;
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const int32_t id = sqlite3_column_int(stmt, 0);
+      if(id == imgid)
+        found = 1;
+      else
+        neighbours[found ? 0 : 1] = id;
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  for(int k = 0; k < 2; k++)
+  {
+    if(neighbours[k] < 0) continue;
+    if(_dev_prefetch_cancelled(dev, serial)) return;
+    if(!_dev_prefetch_have_room())
+    {
+      dt_print(DT_DEBUG_DEV, "[dev_prefetch] mipmap cache is full, not prefetching image %d\n", neighbours[k]);
+      break;
+    }
+    dt_times_t start;
+    dt_get_times(&start);
+    _dev_prefetch_render(dev, neighbours[k], k, serial);
+    dt_show_times(&start, "[dev_prefetch]", "to prefetch image %d", neighbours[k]);
+  }
+
+  dt_pthread_mutex_lock(&dev->prefetch.mutex);
+  if(dev->prefetch.serial == serial)
+  {
+    dev->prefetch.done = imgid;
+    dev->prefetch.queued = 0;
+  }
+  dt_pthread_mutex_unlock(&dev->prefetch.mutex);
+}
+
 void dt_dev_invalidate(dt_develop_t *dev)
 {
   dev->image_status = DT_DEV_PIXELPIPE_DIRTY;
@@ -296,6 +470,113 @@ restart:
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 }
 
+typedef struct _progressive_tile_t
+{
+  int tx, ty;
+  float dist;
+} _progressive_tile_t;
+
+static int _progressive_tile_cmp(const void *a, const void *b)
+{
+  const float da = ((const _progressive_tile_t *)a)->dist, db = ((const _progressive_tile_t *)b)->dist;
+  return (da > db) - (da < db);
+}
+
+// process the viewport of the full pipe in tiles, nearest to the pointer first, and publish every finished
+// tile for expose() to draw on top of the preview. the assembled buffer then becomes the backbuf. modules
+// looking at their neighbourhood (blurs, local contrast, ...) would leave seams between the tiles, so every
+// tile is processed with a margin which is thrown away. returns 1 if the pipe got interrupted, just as
+// dt_dev_pixelpipe_process() does.
+static int _dev_process_image_progressive(dt_develop_t *dev, const int x, const int y, const int wd,
+                                          const int ht, const float scale)
+{
+  dt_dev_pixelpipe_t *pipe = dev->pipe;
+  const int ts = DT_DEV_PROGRESSIVE_TILE_SIZE * darktable.gui->ppd;
+  const int margin = DT_DEV_PROGRESSIVE_TILE_MARGIN * darktable.gui->ppd;
+  const int tiles_x = (wd + ts - 1) / ts, tiles_y = (ht + ts - 1) / ts;
+  const size_t size = (size_t)4 * sizeof(uint8_t) * wd * ht;
+
+  // pipe->backbuf might still point to our buffer from the last run:
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  dt_pthread_mutex_lock(&dev->progressive.mutex);
+  if(dev->progressive.size < size)
+  {
+    if(pipe->backbuf == dev->progressive.buf) pipe->backbuf = NULL;
+    free(dev->progressive.buf);
+    dev->progressive.buf = (uint8_t *)malloc(size);
+    dev->progressive.size = dev->progressive.buf ? size : 0;
+  }
+  free(dev->progressive.done);
+  dev->progressive.done = (uint8_t *)calloc((size_t)tiles_x * tiles_y, sizeof(uint8_t));
+  dev->progressive.width = wd;
+  dev->progressive.height = ht;
+  dev->progressive.tiles_x = tiles_x;
+  dev->progressive.tiles_y = tiles_y;
+  dev->progressive.tile_size = ts;
+  dev->progressive.zoom = dt_control_get_dev_zoom();
+  dev->progressive.closeup = dt_control_get_dev_closeup();
+  dev->progressive.zoom_x = dt_control_get_dev_zoom_x();
+  dev->progressive.zoom_y = dt_control_get_dev_zoom_y();
+  const int have_buffers = dev->progressive.buf && dev->progressive.done;
+  // where is the pointer on our buffer? the image is drawn centered, closeup doubles its size on screen.
+  const float ps = darktable.gui->ppd / (dev->progressive.closeup ? 2.0f : 1.0f);
+  const float px = .5f * wd + dev->progressive.pointer_x * ps;
+  const float py = .5f * ht + dev->progressive.pointer_y * ps;
+  dt_pthread_mutex_unlock(&dev->progressive.mutex);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+  if(!have_buffers) return dt_dev_pixelpipe_process(pipe, dev, x, y, wd, ht, scale);
+
+  _progressive_tile_t *order = (_progressive_tile_t *)malloc(sizeof(_progressive_tile_t) * tiles_x * tiles_y);
+  for(int ty = 0; ty < tiles_y; ty++)
+    for(int tx = 0; tx < tiles_x; tx++)
+    {
+      const float cx = (tx + .5f) * ts - px, cy = (ty + .5f) * ts - py;
+      order[ty * tiles_x + tx] = (_progressive_tile_t){ tx, ty, cx * cx + cy * cy };
+    }
+  qsort(order, (size_t)tiles_x * tiles_y, sizeof(_progressive_tile_t), _progressive_tile_cmp);
+
+  for(int k = 0; k < tiles_x * tiles_y; k++)
+  {
+    const int ox = order[k].tx * ts, oy = order[k].ty * ts;
+    const int tw = MIN(ts, wd - ox), th = MIN(ts, ht - oy);
+    // the margin stays inside the viewport, its borders are the same as for one pass over all of it
+    const int mx0 = MIN(margin, ox), my0 = MIN(margin, oy);
+    const int mx1 = MIN(margin, wd - ox - tw), my1 = MIN(margin, ht - oy - th);
+    const int pw = mx0 + tw + mx1;
+
+    if(dt_dev_pixelpipe_process(pipe, dev, x + ox - mx0, y + oy - my0, pw, my0 + th + my1, scale))
+    {
+      free(order);
+      return 1;
+    }
+
+    // copy the 8-bit output of this tile without the margin to its place and tell the gui about it
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    dt_pthread_mutex_lock(&dev->progressive.mutex);
+    for(int j = 0; j < th; j++)
+      memcpy(dev->progressive.buf + (size_t)4 * ((oy + j) * wd + ox),
+             pipe->backbuf + (size_t)4 * ((my0 + j) * pw + mx0), (size_t)4 * tw);
+    dev->progressive.done[order[k].ty * tiles_x + order[k].tx] = 1;
+    dev->progressive.serial++;
+    dt_pthread_mutex_unlock(&dev->progressive.mutex);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+    if(dev->gui_attached) dt_control_queue_redraw_center();
+  }
+  free(order);
+
+  // all tiles are there, so the assembled buffer becomes the backbuf.
+  dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, wd, ht, scale };
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
+  pipe->backbuf = dev->progressive.buf;
+  pipe->backbuf_width = wd;
+  pipe->backbuf_height = ht;
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  return 0;
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
@@ -394,8 +675,16 @@ restart:
   x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
   y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
 
+  // render progressively on load, zoom and pan only. on history changes the pixelpipe cache holding the
+  // whole viewport gets us there faster than processing all tiles from scratch would.
+  const int progressive = dev->gui_attached && (zoom == DT_ZOOM_1 || closeup)
+                          && (dev->image_loading
+                              || !(pipe_changed & (DT_DEV_PIPE_TOP_CHANGED | DT_DEV_PIPE_REMOVE | DT_DEV_PIPE_SYNCH)))
+                          && dt_conf_get_bool("darkroom/ui/progressive_rendering");
+
   dt_get_times(&start);
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
+  if(progressive ? _dev_process_image_progressive(dev, x, y, wd, ht, scale)
+                 : dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
   {
     // interrupted because image changed?
     if(dev->image_force_reload)
@@ -425,6 +714,9 @@ restart:
   if(dev->gui_attached) dt_control_queue_redraw();
   dt_control_log_busy_leave();
   dt_pthread_mutex_unlock(&dev->pipe_mutex);
+
+  // the user now sees this image, use the idle time to get its neighbours ready.
+  dt_dev_prefetch(dev);
 }
 
 // load the raw and get the new image struct, blocking in gui thread
@@ -521,32 +813,85 @@ void dt_dev_configure(dt_develop_t *dev, int wd, int ht)
   }
 }
 
+// a copy of what the library holds for a history item, so unchanged items needn't be written again
+typedef struct _dev_history_written_t
+{
+  char *op;
+  int32_t enabled;
+  int multi_priority;
+  char multi_name[128];
+  int params_size;
+  void *params;
+  dt_develop_blend_params_t blend_params;
+} _dev_history_written_t;
+
+static void _dev_history_written_free(gpointer data)
+{
+  _dev_history_written_t *w = (_dev_history_written_t *)data;
+  if(!w) return;
+  g_free(w->op);
+  free(w->params);
+  free(w);
+}
+
+static _dev_history_written_t *_dev_history_written_new(const dt_dev_history_item_t *h)
+{
+  _dev_history_written_t *w = (_dev_history_written_t *)malloc(sizeof(_dev_history_written_t));
+  w->op = g_strdup(h->module->op);
+  w->enabled = h->enabled;
+  w->multi_priority = h->multi_priority;
+  g_strlcpy(w->multi_name, h->multi_name, sizeof(w->multi_name));
+  w->params_size = h->module->params_size;
+  w->params = malloc(w->params_size);
+  memcpy(w->params, h->params, w->params_size);
+  memcpy(&w->blend_params, h->blend_params, sizeof(dt_develop_blend_params_t));
+  return w;
+}
+
+// remember that the library holds h at position num
+static void _dev_history_written_set(dt_develop_t *dev, const dt_dev_history_item_t *h, const int32_t num)
+{
+  if(dev->history_written->len <= (guint)num) g_ptr_array_set_size(dev->history_written, num + 1);
+  _dev_history_written_free(g_ptr_array_index(dev->history_written, num));
+  g_ptr_array_index(dev->history_written, num) = _dev_history_written_new(h);
+}
+
+// does the library hold exactly h at position num?
+static int _dev_history_written_equal(const dt_develop_t *dev, const dt_dev_history_item_t *h,
+                                      const int32_t num)
+{
+  if(dev->history_written->len <= (guint)num) return 0;
+  const _dev_history_written_t *w = g_ptr_array_index(dev->history_written, num);
+  return w && !strcmp(w->op, h->module->op) && w->enabled == h->enabled
+         && w->multi_priority == h->multi_priority && !strcmp(w->multi_name, h->multi_name)
+         && w->params_size == h->module->params_size && !memcmp(w->params, h->params, w->params_size)
+         && !memcmp(&w->blend_params, h->blend_params, sizeof(dt_develop_blend_params_t));
+}
+
 // helper used to synch a single history item with db
 int dt_dev_write_history_item(const dt_image_t *image, dt_dev_history_item_t *h, int32_t num)
 {
   if(!image) return 1;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT num FROM main.history WHERE imgid = ?1 AND num = ?2", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT num FROM main.history WHERE imgid = ?1 AND num = ?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, image->id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
   if(sqlite3_step(stmt) != SQLITE_ROW)
   {
-    sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history (imgid, num) VALUES (?1, ?2)", -1, &stmt, NULL);
+    dt_database_release_statement(darktable.db, stmt);
+    stmt = dt_database_get_statement(darktable.db, "INSERT INTO main.history (imgid, num) VALUES (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, image->id);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
     sqlite3_step(stmt);
   }
   // printf("[dev write history item] writing %d - %s params %f %f\n", h->module->instance, h->module->op,
   // *(float *)h->params, *(((float *)h->params)+1));
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE main.history SET operation = ?1, op_params = ?2, module = ?3, enabled = ?4, "
-                              "blendop_params = ?7, blendop_version = ?8, multi_priority = ?9, multi_name = "
-                              "?10 WHERE imgid = ?5 AND num = ?6",
-                              -1, &stmt, NULL);
+  dt_database_release_statement(darktable.db, stmt);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "UPDATE main.history SET operation = ?1, op_params = ?2, module = ?3, "
+                                   "enabled = ?4, blendop_params = ?7, blendop_version = ?8, "
+                                   "multi_priority = ?9, multi_name = ?10 WHERE imgid = ?5 AND num = ?6");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, h->module->op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 2, h->params, h->module->params_size, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, h->module->version());
@@ -559,13 +904,14 @@ int dt_dev_write_history_item(const dt_image_t *image, dt_dev_history_item_t *h,
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, h->multi_name, -1, SQLITE_TRANSIENT);
 
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return 0;
 }
 
 void dt_dev_add_history_item(dt_develop_t *dev, dt_iop_module_t *module, gboolean enable)
 {
   if(darktable.gui->reset) return;
+  dt_dev_prefetch_cancel(dev);
   dt_pthread_mutex_lock(&dev->history_mutex);
   if(dev->gui_attached)
   {
@@ -826,20 +1172,33 @@ void dt_dev_write_history(dt_develop_t *dev)
 {
   sqlite3_stmt *stmt;
 
+  // the sidecar writer must not see the history between the delete and the inserts
+  dt_sidecar_writer_hold(darktable.sidecar_writer);
+  dt_database_start_transaction(darktable.db);
+
   gboolean changed = FALSE;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
-                              &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  // only items which aren't in the library like this yet are written. when editing that's the last one or
+  // two, so this doesn't get slower with the length of the history.
   GList *history = dev->history;
-  for(int i = 0; history; i++)
+  int i = 0;
+  for(; history; i++)
   {
     dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
-    (void)dt_dev_write_history_item(&dev->image_storage, hist, i);
+    if(!_dev_history_written_equal(dev, hist, i))
+    {
+      (void)dt_dev_write_history_item(&dev->image_storage, hist, i);
+      _dev_history_written_set(dev, hist, i);
+    }
     history = g_list_next(history);
     changed = TRUE;
   }
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.history WHERE imgid = ?1 AND num >= ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, i);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if(dev->history_written->len > i) g_ptr_array_set_size(dev->history_written, i);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "UPDATE main.images SET history_end = ?1 WHERE id = ?2", -1,
@@ -856,6 +1215,9 @@ void dt_dev_write_history(dt_develop_t *dev)
     dt_tag_attach(tagid, dev->image_storage.id);
   else
     dt_tag_detach(tagid, dev->image_storage.id);
+
+  dt_database_release_transaction(darktable.db);
+  dt_sidecar_writer_release(darktable.sidecar_writer);
 }
 
 static void auto_apply_presets(dt_develop_t *dev)
@@ -949,7 +1311,7 @@ static void auto_apply_presets(dt_develop_t *dev)
                                     "UPDATE memory.history SET num=?1 WHERE rowid=?2", -1, &stmt, NULL);
 
         // let's wrap this into a transaction, it might make it a little faster.
-        sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+        dt_database_start_transaction(darktable.db);
         do
         {
           DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
@@ -963,7 +1325,7 @@ static void auto_apply_presets(dt_develop_t *dev)
           r = g_list_next(r);
         } while((sqlite3_step(stmt) == SQLITE_DONE) && r);
 
-        sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+        dt_database_release_transaction(darktable.db);
 
         g_list_free(rowids);
         sqlite3_finalize(stmt);
@@ -1027,6 +1389,8 @@ void dt_dev_read_history(dt_develop_t *dev)
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
   dev->history_end = 0;
+  int32_t pos = g_list_length(dev->history);
+  g_ptr_array_set_size(dev->history_written, 0);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
     // db record:
@@ -1182,6 +1546,15 @@ void dt_dev_read_history(dt_develop_t *dev)
       hist->enabled = 1;
     }
 
+    // items read back unchanged and in place needn't be written again
+    if(sqlite3_column_int(stmt, 1) == pos && modversion == hist->module->version()
+       && hist->enabled == sqlite3_column_int(stmt, 5) && multi_name && !strcmp(hist->multi_name, multi_name)
+       && sqlite3_column_bytes(stmt, 4) == hist->module->params_size
+       && !memcmp(hist->params, sqlite3_column_blob(stmt, 4), hist->module->params_size)
+       && blendop_version == dt_develop_blend_version() && bl_length == sizeof(dt_develop_blend_params_t)
+       && !memcmp(hist->blend_params, blendop_params, sizeof(dt_develop_blend_params_t)))
+      _dev_history_written_set(dev, hist, pos);
+
     // memcpy(hist->module->params, hist->params, hist->module->params_size);
     // hist->module->enabled = hist->enabled;
     // printf("[dev read history] img %d number %d for operation %d - %s params %f %f\n",
@@ -1189,6 +1562,7 @@ void dt_dev_read_history(dt_develop_t *dev)
     // *)hist->params, *(((float*)hist->params)+1));
     dev->history = g_list_append(dev->history, hist);
     dev->history_end++;
+    pos++;
   }
   sqlite3_finalize(stmt);
 
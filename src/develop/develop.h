@@ -125,6 +125,8 @@ typedef struct dt_develop_t
   dt_pthread_mutex_t history_mutex;
   int32_t history_end;
   GList *history;
+  // what the library holds for the history of this image, per position. NULL where it isn't known.
+  GPtrArray *history_written;
 
   // operations pipeline
   int32_t iop_instance;
@@ -222,6 +224,43 @@ typedef struct dt_develop_t
     float threshold;
   } rawoverexposed;
 
+  // progressive rendering of the zoomed in center view: the full pipe processes the viewport in tiles,
+  // nearest to the pointer first, and the finished tiles are drawn on top of the upscaled preview.
+  struct
+  {
+    dt_pthread_mutex_t mutex;
+    uint8_t *buf;            // assembled 8-bit output of the tiles, same layout as pipe->backbuf
+    size_t size;
+    int width, height;       // dimensions of the processed viewport
+    uint8_t *done;           // tiles_x * tiles_y flags of finished tiles
+    int tiles_x, tiles_y, tile_size;
+    uint32_t serial;         // bumped on every published tile, to trigger redraws
+    // zoom state the tiles are valid for
+    dt_dev_zoom_t zoom;
+    int closeup;
+    float zoom_x, zoom_y;
+    // pointer offset from the center of the view, in gui pixels
+    float pointer_x, pointer_y;
+  } progressive;
+
+  // speculative loading of the filmstrip neighbours while the user is editing this image: their raws go
+  // into the full mipmap cache and a stand-in is rendered by a private preview pipe, to be shown right away
+  // when switching images.
+  struct
+  {
+    dt_pthread_mutex_t mutex;
+    uint32_t serial;                  // bumped to cancel the pending job
+    int queued;                       // a job with the current serial is queued or running
+    int32_t done;                     // image whose neighbours have been prefetched completely
+    struct dt_dev_pixelpipe_t *pipe;  // pipe of the running job, to shut it down on cancel
+    struct
+    {
+      int32_t imgid;
+      uint8_t *buf;                   // 8-bit output of the preview pipe, fitted to the center view
+      int width, height;
+    } standin[2];
+  } prefetch;
+
   // the display profile related things (softproof, gamut check, profiles ...)
   struct
   {
@@ -240,6 +279,13 @@ void dt_dev_process_preview_job(dt_develop_t *dev);
 void dt_dev_process_image(dt_develop_t *dev);
 void dt_dev_process_preview(dt_develop_t *dev);
 
+/** load the filmstrip neighbours of imgid and render their stand-ins, run by the prefetch job */
+void dt_dev_prefetch_job(dt_develop_t *dev, const int32_t imgid, const uint32_t serial);
+/** queue the prefetch job for the current image, if not yet done */
+void dt_dev_prefetch(dt_develop_t *dev);
+/** cancel the prefetch job, the user is interacting with the current image */
+void dt_dev_prefetch_cancel(dt_develop_t *dev);
+
 void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid);
 void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid);
 /** checks if provided imgid is the image currently in develop */
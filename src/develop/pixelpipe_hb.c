@@ -142,6 +142,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
+  pipe->cancelled = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
   pipe->mask_display = 0;
@@ -559,6 +560,28 @@ error:
 #endif
 
 
+int dt_dev_pixelpipe_cancelled(dt_dev_pixelpipe_t *pipe)
+{
+  int cancel = pipe->shutdown;
+  const dt_dev_pixelpipe_change_t changed = pipe->changed;
+  // same rules as dt_iop_breakpoint(): the preview pipe processes the whole image, zooming doesn't matter there.
+  if(changed == DT_DEV_PIPE_ZOOMED)
+    cancel |= (pipe->type != DT_DEV_PIXELPIPE_PREVIEW);
+  else if(changed != DT_DEV_PIPE_UNCHANGED)
+    cancel = 1;
+  if(cancel) pipe->cancelled = 1;
+  return cancel;
+}
+
+// the module may have stopped early on dt_dev_pixelpipe_cancelled(), leaving its output unfinished.
+// make sure such a buffer will never be picked up from the cache again.
+static int _process_cancelled(dt_dev_pixelpipe_t *pipe, void *output)
+{
+  if(!pipe->cancelled) return 0;
+  dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), output);
+  return 1;
+}
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -1297,7 +1320,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
           }
 
-          if(pipe->shutdown)
+          if(pipe->shutdown || _process_cancelled(pipe, *output))
           {
             dt_pthread_mutex_unlock(&pipe->busy_mutex);
             return 1;
@@ -1430,7 +1453,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
         }
 
-        if(pipe->shutdown)
+        if(pipe->shutdown || _process_cancelled(pipe, *output))
         {
           dt_pthread_mutex_unlock(&pipe->busy_mutex);
           return 1;
@@ -1528,7 +1551,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
       }
 
-      if(pipe->shutdown)
+      if(pipe->shutdown || _process_cancelled(pipe, *output))
       {
         dt_pthread_mutex_unlock(&pipe->busy_mutex);
         return 1;
@@ -1613,7 +1636,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
     }
 
-    if(pipe->shutdown)
+    if(pipe->shutdown || _process_cancelled(pipe, *output))
     {
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
@@ -2262,6 +2285,7 @@ restart:
 
   // mask display off as a starting point
   pipe->mask_display = 0;
+  pipe->cancelled = 0;
 
   void *buf = NULL;
   void *cl_mem_out = NULL;
@@ -108,6 +108,8 @@ typedef struct dt_dev_pixelpipe_t
   int processing;
   // shutting down?
   int shutdown;
+  // set once a module stopped processing early because of dt_dev_pixelpipe_cancelled()
+  int cancelled;
   // opencl enabled for this pixelpipe?
   int opencl_enabled;
   // opencl error detected?
@@ -176,6 +178,12 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
 
+// cheap cancellation token, to be polled per tile or row band in expensive process() loops. returns non-zero if
+// the output of the running pipe will be discarded anyways (history changed, zoomed or shut down). the module
+// may then return early, its incomplete output will not be cached and the pipe restarts from the last valid
+// cache line.
+int dt_dev_pixelpipe_cancelled(dt_dev_pixelpipe_t *pipe);
+
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
 // disable given op and all that comes before it in the pipe:
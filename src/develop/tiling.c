@@ -726,6 +726,9 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
+      /* no use in processing more tiles if the pipe output is going to be discarded anyways */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto finish;
+
       piece->pipe->tiling = 1;
 
       size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
@@ -800,6 +803,7 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
                (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
     }
 
+finish:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
@@ -984,6 +988,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
+      /* no use in processing more tiles if the pipe output is going to be discarded anyways */
+      if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto finish;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -1135,6 +1142,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
       input = output = NULL;
     }
 
+finish:
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
@@ -29,6 +29,7 @@
 #include <OpenEXR/ImfStandardAttributes.h>
 #include <OpenEXR/ImfThreading.h>
 #include <OpenEXR/ImfTiledOutputFile.h>
+#include <OpenEXR/OpenEXRConfig.h>
 
 extern "C" {
 #include "bauhaus/bauhaus.h"
@@ -47,7 +48,12 @@ extern "C" {
 extern "C" {
 #endif
 
-DT_MODULE(4)
+DT_MODULE(5)
+
+// dwa compression was added in OpenEXR 2.2
+#if OPENEXR_VERSION_MAJOR > 2 || (OPENEXR_VERSION_MAJOR == 2 && OPENEXR_VERSION_MINOR >= 2)
+#define DT_EXR_HAVE_DWA
+#endif
 
 enum dt_imageio_exr_compression_t
 {
@@ -61,6 +67,13 @@ enum dt_imageio_exr_compression_t
                           // fixed compression rate
   B44A_COMPRESSION = 7,   // lossy 4-by-4 pixel block compression,
                           // flat fields are compressed more
+  DWAA_COMPRESSION = 8,   // lossy DCT based compression, in blocks
+                          // of 32 scanlines. more efficient for partial
+                          // buffer access.
+  DWAB_COMPRESSION = 9,   // lossy DCT based compression, in blocks
+                          // of 256 scanlines. more efficient space
+                          // wise and faster to decode full frames
+                          // than DWAA_COMPRESSION.
   NUM_COMPRESSION_METHODS // number of different compression methods
 };                        // copy of Imf::Compression
 
@@ -71,11 +84,13 @@ typedef struct dt_imageio_exr_t
   char style[128];
   gboolean style_append;
   dt_imageio_exr_compression_t compression;
+  gboolean mipmaps; // write a tiled mipmap, so readers can decode a small level for previews
 } dt_imageio_exr_t;
 
 typedef struct dt_imageio_exr_gui_t
 {
   GtkWidget *compression;
+  GtkWidget *mipmaps;
 } dt_imageio_exr_gui_t;
 
 void init(dt_imageio_module_format_t *self)
@@ -90,6 +105,10 @@ void init(dt_imageio_module_format_t *self)
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, PXR24_COMPRESSION, "pxr24");
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, B44_COMPRESSION, "b44");
   luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, B44A_COMPRESSION, "b44a");
+#ifdef DT_EXR_HAVE_DWA
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, DWAA_COMPRESSION, "dwaa");
+  luaA_enum_value_name(darktable.lua_state.state, dt_imageio_exr_compression_t, DWAB_COMPRESSION, "dwab");
+#endif
 
   dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_exr_t, compression,
                                 dt_imageio_exr_compression_t);
@@ -101,8 +120,93 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
-int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+#define DT_EXR_TILE_SIZE 100
+
+typedef struct dt_imageio_exr_handle_t
+{
+  Imf::TiledOutputFile *file;
+  float *buf; // one row of tiles, filled up in write_image_rows()
+  int tile_y; // the row of tiles that's currently being collected
+  float *level1; // the whole second mip level, built up while the first one streams through
+  int level1_width, level1_height;
+} dt_imageio_exr_handle_t;
+
+// point the frame buffer at rgbx floats, with base being where pixel (0, 0) of the level would be
+static void _exr_set_frame_buffer(Imf::TiledOutputFile *file, char *base, const size_t stride)
+{
+  Imf::FrameBuffer data;
+  data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, base + 0 * sizeof(float), 4 * sizeof(float), stride));
+  data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, base + 1 * sizeof(float), 4 * sizeof(float), stride));
+  data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, base + 2 * sizeof(float), 4 * sizeof(float), stride));
+  file->setFrameBuffer(data);
+}
+
+// write the collected row of tiles to the file
+static void _exr_write_tile_row(const dt_imageio_exr_t *exr, dt_imageio_exr_handle_t *h)
+{
+  const size_t stride = 4 * sizeof(float) * exr->width;
+  // the frame buffer is addressed in image coordinates, shift it so the current tile row lands in buf
+  char *base = (char *)h->buf - (size_t)h->tile_y * DT_EXR_TILE_SIZE * stride;
+  _exr_set_frame_buffer(h->file, base, stride);
+  h->file->writeTiles(0, h->file->numXTiles(0) - 1, h->tile_y, h->tile_y, 0);
+}
+
+// 2x2 box filter of in (in_width wide) into rows x width pixels of out. with openexr's default ROUND_DOWN
+// levels the last odd row and column are dropped.
+static void _exr_downsample(const float *in, const int in_width, float *out, const int width, const int rows)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(in, out)
+#endif
+  for(int j = 0; j < rows; j++)
+  {
+    const float *in0 = in + (size_t)4 * 2 * j * in_width;
+    const float *in1 = in0 + (size_t)4 * in_width;
+    float *o = out + (size_t)4 * j * width;
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < 4; c++)
+        o[4 * i + c] = 0.25f * (in0[8 * i + c] + in0[8 * i + 4 + c] + in1[8 * i + c] + in1[8 * i + 4 + c]);
+  }
+}
+
+// write the remaining mip levels, from level 1 on
+static void _exr_write_levels(dt_imageio_exr_handle_t *h)
+{
+  Imf::TiledOutputFile *file = h->file;
+  float *level = h->level1;
+  int width = h->level1_width;
+  for(int l = 1; l < file->numLevels(); l++)
+  {
+    if(l > 1)
+    {
+      const int w = file->levelWidth(l), ht = file->levelHeight(l);
+      float *next = (float *)dt_alloc_align(16, (size_t)4 * sizeof(float) * w * ht);
+      if(!next)
+      {
+        if(level != h->level1) dt_free_align(level);
+        throw std::bad_alloc();
+      }
+      _exr_downsample(level, width, next, w, ht);
+      if(level != h->level1) dt_free_align(level);
+      level = next;
+      width = w;
+    }
+    _exr_set_frame_buffer(file, (char *)level, 4 * sizeof(float) * width);
+    try
+    {
+      file->writeTiles(0, file->numXTiles(l) - 1, 0, file->numYTiles(l) - 1, l);
+    }
+    catch(...)
+    {
+      if(level != h->level1) dt_free_align(level);
+      throw;
+    }
+  }
+  if(level != h->level1) dt_free_align(level);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *tmp, const char *filename, void *exif, int exif_len,
+                        int imgid, int num, int total)
 {
   const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
 
@@ -198,27 +302,123 @@ icc_end:
   header.channels().insert("G", Imf::Channel(Imf::PixelType::FLOAT));
   header.channels().insert("B", Imf::Channel(Imf::PixelType::FLOAT));
 
-  header.setTileDescription(Imf::TileDescription(100, 100, Imf::ONE_LEVEL));
+  // tiny images don't get a mipmap, there'd be nothing to gain
+  const gboolean mipmaps = exr->mipmaps && exr->width > DT_EXR_TILE_SIZE && exr->height > DT_EXR_TILE_SIZE;
+  header.setTileDescription(Imf::TileDescription(DT_EXR_TILE_SIZE, DT_EXR_TILE_SIZE,
+                                                 mipmaps ? Imf::MIPMAP_LEVELS : Imf::ONE_LEVEL));
 
-  Imf::TiledOutputFile file(filename, header);
-
-  Imf::FrameBuffer data;
+  dt_imageio_exr_handle_t *h = (dt_imageio_exr_handle_t *)calloc(1, sizeof(dt_imageio_exr_handle_t));
+  try
+  {
+    h->file = new Imf::TiledOutputFile(filename, header);
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    free(h);
+    return NULL;
+  }
+  h->buf = (float *)dt_alloc_align(16, (size_t)4 * sizeof(float) * exr->width * DT_EXR_TILE_SIZE);
+  if(mipmaps)
+  {
+    h->level1_width = h->file->levelWidth(1);
+    h->level1_height = h->file->levelHeight(1);
+    h->level1 = (float *)dt_alloc_align(16, (size_t)4 * sizeof(float) * h->level1_width * h->level1_height);
+  }
+  if(!h->buf || (mipmaps && !h->level1))
+  {
+    try
+    {
+      delete h->file;
+    }
+    catch(...)
+    {
+    }
+    dt_free_align(h->buf);
+    dt_free_align(h->level1);
+    free(h);
+    return NULL;
+  }
+  return h;
+}
 
+int write_image_rows(dt_imageio_module_data_t *tmp, void *handle, const void *in_tmp, int y, int rows)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  dt_imageio_exr_handle_t *h = (dt_imageio_exr_handle_t *)handle;
   const float *in = (const float *)in_tmp;
+  const size_t stride = (size_t)4 * exr->width;
 
-  data.insert("R", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 0), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
-
-  data.insert("G", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 1), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
-
-  data.insert("B", Imf::Slice(Imf::PixelType::FLOAT, (char *)(in + 2), 4 * sizeof(float),
-                              4 * sizeof(float) * exr->width));
+  try
+  {
+    // tiles can only be written once they are complete, so collect the incoming rows until a row of tiles is
+    // full (or the image ends)
+    for(int j = y; j < y + rows;)
+    {
+      const int tile_end = MIN((h->tile_y + 1) * DT_EXR_TILE_SIZE, exr->height);
+      const int n = MIN(tile_end, y + rows) - j;
+      memcpy(h->buf + stride * (j - h->tile_y * DT_EXR_TILE_SIZE), in + stride * (j - y),
+             sizeof(float) * stride * n);
+      j += n;
+      if(j == tile_end)
+      {
+        if(h->level1)
+        {
+          // the tile height is even, so the rows of the next level never straddle two tile rows
+          const int first = h->tile_y * DT_EXR_TILE_SIZE / 2;
+          const int rows = MIN(tile_end / 2, h->level1_height) - first;
+          if(rows > 0)
+            _exr_downsample(h->buf, exr->width, h->level1 + (size_t)4 * first * h->level1_width,
+                            h->level1_width, rows);
+        }
+        _exr_write_tile_row(exr, h);
+        h->tile_y++;
+      }
+    }
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
 
-  file.setFrameBuffer(data);
-  file.writeTiles(0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
+int write_image_end(dt_imageio_module_data_t *tmp, void *handle, int failed)
+{
+  dt_imageio_exr_handle_t *h = (dt_imageio_exr_handle_t *)handle;
+  int rc = failed ? 1 : 0;
+  try
+  {
+    if(!rc && h->level1) _exr_write_levels(h);
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    rc = 1;
+  }
+  try
+  {
+    delete h->file;
+  }
+  catch(const std::exception &e)
+  {
+    fprintf(stderr, "[exr export] %s\n", e.what());
+    rc = 1;
+  }
+  dt_free_align(h->buf);
+  dt_free_align(h->level1);
+  free(h);
+  return rc;
+}
 
-  return 0;
+int write_image(dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(tmp, filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  const int failed = write_image_rows(tmp, handle, in_tmp, 0, tmp->height);
+  return write_image_end(tmp, handle, failed);
 }
 
 size_t params_size(dt_imageio_module_format_t *self)
@@ -230,16 +430,17 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 4)
+  if(old_version == 1 && new_version == 5)
   {
     dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
     memcpy(new_params, old_params, old_params_size);
     new_params->compression = (dt_imageio_exr_compression_t)PIZ_COMPRESSION;
     new_params->style_append = 0;
+    new_params->mipmaps = FALSE;
     *new_size = self->params_size(self);
     return new_params;
   }
-  if(old_version == 2 && new_version == 4)
+  if(old_version == 2 && new_version == 5)
   {
     enum dt_imageio_exr_pixeltype_t
     {
@@ -265,11 +466,12 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     memcpy(new_params, old_params, sizeof(old_params_size));
     new_params->style_append = 0;
     new_params->compression = o->compression;
+    new_params->mipmaps = FALSE;
 
     *new_size = self->params_size(self);
     return new_params;
   }
-  if(old_version == 3 && new_version == 4)
+  if(old_version == 3 && new_version == 5)
   {
     struct dt_imageio_exr_v3_t
     {
@@ -282,9 +484,29 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     const dt_imageio_exr_v3_t *o = (dt_imageio_exr_v3_t *)old_params;
     dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
 
-    memcpy(new_params, old_params, sizeof(dt_imageio_exr_t));
+    memcpy(new_params, old_params, sizeof(dt_imageio_exr_v3_t));
     new_params->style_append = 0;
     new_params->compression = o->compression;
+    new_params->mipmaps = FALSE;
+
+    *new_size = self->params_size(self);
+    return new_params;
+  }
+  if(old_version == 4 && new_version == 5)
+  {
+    struct dt_imageio_exr_v4_t
+    {
+      int max_width, max_height;
+      int width, height;
+      char style[128];
+      gboolean style_append;
+      dt_imageio_exr_compression_t compression;
+    };
+
+    dt_imageio_exr_t *new_params = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
+
+    memcpy(new_params, old_params, sizeof(dt_imageio_exr_v4_t));
+    new_params->mipmaps = FALSE;
 
     *new_size = self->params_size(self);
     return new_params;
@@ -296,6 +518,7 @@ void *get_params(dt_imageio_module_format_t *self)
 {
   dt_imageio_exr_t *d = (dt_imageio_exr_t *)calloc(1, sizeof(dt_imageio_exr_t));
   d->compression = (dt_imageio_exr_compression_t)dt_conf_get_int("plugins/imageio/format/exr/compression");
+  d->mipmaps = dt_conf_get_bool("plugins/imageio/format/exr/mipmaps");
   return d;
 }
 
@@ -310,6 +533,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   dt_imageio_exr_t *d = (dt_imageio_exr_t *)params;
   dt_imageio_exr_gui_t *g = (dt_imageio_exr_gui_t *)self->gui_data;
   dt_bauhaus_combobox_set(g->compression, d->compression);
+  dt_bauhaus_combobox_set(g->mipmaps, d->mipmaps ? 1 : 0);
   return 0;
 }
 
@@ -344,6 +568,11 @@ static void combobox_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/exr/compression", compression);
 }
 
+static void mipmaps_changed(GtkWidget *widget, gpointer user_data)
+{
+  dt_conf_set_bool("plugins/imageio/format/exr/mipmaps", dt_bauhaus_combobox_get(widget) == 1);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   self->gui_data = malloc(sizeof(dt_imageio_exr_gui_t));
@@ -364,9 +593,21 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_combobox_add(gui->compression, _("PXR24 (lossy)"));
   dt_bauhaus_combobox_add(gui->compression, _("B44 (lossy)"));
   dt_bauhaus_combobox_add(gui->compression, _("B44A (lossy)"));
+#ifdef DT_EXR_HAVE_DWA
+  dt_bauhaus_combobox_add(gui->compression, _("DWAA (lossy)"));
+  dt_bauhaus_combobox_add(gui->compression, _("DWAB (lossy)"));
+#endif
   dt_bauhaus_combobox_set(gui->compression, compression_last);
   gtk_box_pack_start(GTK_BOX(self->widget), gui->compression, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(combobox_changed), NULL);
+
+  gui->mipmaps = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->mipmaps, NULL, _("mip levels"));
+  dt_bauhaus_combobox_add(gui->mipmaps, _("no"));
+  dt_bauhaus_combobox_add(gui->mipmaps, _("yes"));
+  dt_bauhaus_combobox_set(gui->mipmaps, dt_conf_get_bool("plugins/imageio/format/exr/mipmaps") ? 1 : 0);
+  gtk_box_pack_start(GTK_BOX(self->widget), gui->mipmaps, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->mipmaps), "value-changed", G_CALLBACK(mipmaps_changed), NULL);
 }
 
 void gui_cleanup(dt_imageio_module_format_t *self)
@@ -76,6 +76,14 @@ int bpp(struct dt_imageio_module_data_t *data);
 /* write to file, with exif if not NULL, and icc profile if supported. */
 int write_image(struct dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif,
                 int exif_len, int imgid, int num, int total);
+/* optional: streaming version of write_image(), for images too large to hold in memory at once.
+ * begin opens the file and returns a handle (or NULL on fail), data->width/height have to be set already.
+ * rows gets called in order with `rows' lines of the image starting at line y, in the same layout as
+ * write_image(). exif has to stay valid until end, which closes the file. return != 0 on fail. */
+void *write_image_begin(struct dt_imageio_module_data_t *data, const char *filename, void *exif,
+                        int exif_len, int imgid, int num, int total);
+int write_image_rows(struct dt_imageio_module_data_t *data, void *handle, const void *in, int y, int rows);
+int write_image_end(struct dt_imageio_module_data_t *data, void *handle, int failed);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 int levels(struct dt_imageio_module_data_t *data);
 
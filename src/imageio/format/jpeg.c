@@ -25,6 +25,7 @@
 #include "common/darktable.h"
 #include "common/exif.h"
 #include "common/imageio.h"
+#include "common/imageio_jpeg_stripes.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
 #include "imageio/format/imageio_format_api.h"
@@ -313,59 +314,80 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_jpeg_handle_t
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
   struct dt_imageio_jpeg_error_mgr jerr;
+  FILE *f;
+  char *filename;
+  void *exif;
+  int exif_len;
+  uint8_t *row;
+  int quality;
+  int resolution;
+  uint8_t *icc;
+  uint32_t icc_len;
+  dt_imageio_jpeg_stripes_t *stripes; // if the image is encoded in parallel
+} dt_imageio_jpeg_handle_t;
 
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if(setjmp(jerr.setjmp_buffer))
-  {
-    jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
-  }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
+static void _jpeg_handle_free(dt_imageio_jpeg_handle_t *h)
+{
+  if(h->f) fclose(h->f);
+  free(h->row);
+  free(h->icc);
+  g_free(h->filename);
+  free(h);
+}
 
-  jpg->cinfo.image_width = jpg->width;
-  jpg->cinfo.image_height = jpg->height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+// the compression parameters, after jpeg_set_defaults()
+static void _jpeg_setup(j_compress_ptr cinfo, void *data)
+{
+  const dt_imageio_jpeg_handle_t *h = (dt_imageio_jpeg_handle_t *)data;
+  jpeg_set_quality(cinfo, h->quality, TRUE);
+  if(h->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(h->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(h->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(h->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(h->quality < 80) cinfo->smoothing_factor = 20;
+  if(h->quality < 60) cinfo->smoothing_factor = 40;
+  if(h->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
 
   // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
   // describes an image with unknown unit and square pixels.
   // however, some applications (like the Telekom cloud thingy) seem to be confused by that, so let's set
   // these calues to the same as stored in exiv :/
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  if(resolution > 0)
+  if(h->resolution > 0)
   {
-    jpg->cinfo.density_unit = 1;
-    jpg->cinfo.X_density = resolution;
-    jpg->cinfo.Y_density = resolution;
+    cinfo->density_unit = 1;
+    cinfo->X_density = h->resolution;
+    cinfo->Y_density = h->resolution;
   }
   else
   {
-    jpg->cinfo.density_unit = 0;
-    jpg->cinfo.X_density = 1;
-    jpg->cinfo.Y_density = 1;
+    cinfo->density_unit = 0;
+    cinfo->X_density = 1;
+    cinfo->Y_density = 1;
   }
+}
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
+// markers that go right after jpeg_start_compress()
+static void _jpeg_markers(j_compress_ptr cinfo, void *data)
+{
+  const dt_imageio_jpeg_handle_t *h = (dt_imageio_jpeg_handle_t *)data;
+  if(h->icc) write_icc_profile(cinfo, h->icc, h->icc_len);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *jpg_tmp, const char *filename, void *exif, int exif_len,
+                        int imgid, int num, int total)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  // the error manager has to stay around until the image is done, so it lives in the handle
+  dt_imageio_jpeg_handle_t *h = (dt_imageio_jpeg_handle_t *)calloc(1, sizeof(dt_imageio_jpeg_handle_t));
+  if(!h) return NULL;
+  h->exif = exif;
+  h->exif_len = exif_len;
+  h->quality = jpg->quality;
+  h->resolution = dt_conf_get_int("metadata/resolution");
 
   if(imgid > 0)
   {
@@ -374,32 +396,115 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
     cmsSaveProfileToMem(out_profile, 0, &len);
     if(len > 0)
     {
-      unsigned char *buf = malloc(len * sizeof(unsigned char));
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
+      h->icc = malloc(len * sizeof(unsigned char));
+      cmsSaveProfileToMem(out_profile, h->icc, &len);
+      h->icc_len = len;
     }
   }
 
-  uint8_t *row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+  h->f = g_fopen(filename, "wb");
+  if(!h->f)
+  {
+    _jpeg_handle_free(h);
+    return NULL;
+  }
+  h->filename = g_strdup(filename);
+
+  // encode stripes of the image on all cores. they need to share the huffman tables, so this costs the
+  // optimized ones and makes the file a bit larger.
+  if(dt_conf_get_bool("plugins/imageio/format/jpeg/parallel"))
+  {
+    h->stripes = dt_imageio_jpeg_stripes_begin(h->f, jpg->width, jpg->height, _jpeg_setup, _jpeg_markers, h);
+    if(h->stripes) return h;
+  }
+
+  jpg->cinfo.err = jpeg_std_error(&h->jerr.pub);
+  h->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(h->jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    _jpeg_handle_free(h);
+    return NULL;
+  }
+  jpeg_create_compress(&(jpg->cinfo));
+  jpeg_stdio_dest(&(jpg->cinfo), h->f);
+
+  jpg->cinfo.image_width = jpg->width;
+  jpg->cinfo.image_height = jpg->height;
+  jpg->cinfo.input_components = 3;
+  jpg->cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&(jpg->cinfo));
+  _jpeg_setup(&(jpg->cinfo), h);
+
+  jpeg_start_compress(&(jpg->cinfo), TRUE);
+
+  _jpeg_markers(&(jpg->cinfo), h);
+
+  h->row = malloc((size_t)3 * jpg->width * sizeof(uint8_t));
+  return h;
+}
+
+int write_image_rows(dt_imageio_module_data_t *jpg_tmp, void *handle, const void *in_tmp, int y, int rows)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_handle_t *h = (dt_imageio_jpeg_handle_t *)handle;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+
+  if(h->stripes) return dt_imageio_jpeg_stripes_rows(h->stripes, in, rows);
+
+  // libjpeg errors longjmp back to here, cleanup is done in write_image_end()
+  if(setjmp(h->jerr.setjmp_buffer)) return 1;
+
   const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  for(int j = 0; j < rows; j++)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+    buf = in + (size_t)j * jpg->cinfo.image_width * 4;
     for(int i = 0; i < jpg->width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
+      for(int k = 0; k < 3; k++) h->row[3 * i + k] = buf[4 * i + k];
+    tmp[0] = h->row;
     jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
   }
-  jpeg_finish_compress(&(jpg->cinfo));
-  free(row);
-  jpeg_destroy_compress(&(jpg->cinfo));
-  fclose(f);
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *jpg_tmp, void *handle, int failed)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  dt_imageio_jpeg_handle_t *h = (dt_imageio_jpeg_handle_t *)handle;
+  int rc = failed ? 1 : 0;
+
+  if(h->stripes)
+  {
+    rc = dt_imageio_jpeg_stripes_end(h->stripes, rc);
+  }
+  else
+  {
+    if(!failed)
+    {
+      if(setjmp(h->jerr.setjmp_buffer))
+        rc = 1;
+      else
+        jpeg_finish_compress(&(jpg->cinfo));
+    }
+    jpeg_destroy_compress(&(jpg->cinfo));
+  }
+  fclose(h->f);
+  h->f = NULL;
 
-  dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(!rc) dt_exif_write_blob(h->exif, h->exif_len, h->filename, 1);
 
-  return 0;
+  _jpeg_handle_free(h);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(jpg_tmp, filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  const int failed = write_image_rows(jpg_tmp, handle, in_tmp, 0, jpg_tmp->height);
+  return write_image_end(jpg_tmp, handle, failed);
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_jpeg_t *jpg)
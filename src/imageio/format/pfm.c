@@ -28,49 +28,85 @@
 
 DT_MODULE(1)
 
-int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif,
-                int exif_len, int imgid, int num, int total)
+typedef struct dt_imageio_pfm_handle_t
+{
+  FILE *f;
+  long data_offset;
+  float *buf_line;
+} dt_imageio_pfm_handle_t;
+
+void *write_image_begin(dt_imageio_module_data_t *data, const char *filename, void *exif, int exif_len,
+                        int imgid, int num, int total)
 {
   const dt_imageio_module_data_t *const pfm = data;
-  int status = 0;
   FILE *f = g_fopen(filename, "wb");
-  if(f)
+  if(!f) return NULL;
+  // align pfm header to sse, assuming the file will
+  // be mmapped to page boundaries.
+  char header[1024];
+  snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  size_t len = strlen(header);
+  fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  ssize_t off = 0;
+  while((len + 1 + off) & 0xf) off++;
+  while(off-- > 0) fprintf(f, "0");
+  fprintf(f, "\n");
+
+  dt_imageio_pfm_handle_t *h = (dt_imageio_pfm_handle_t *)malloc(sizeof(dt_imageio_pfm_handle_t));
+  float *buf_line = dt_alloc_align(16, 3 * sizeof(float) * pfm->width);
+  if(!h || !buf_line)
   {
-    // align pfm header to sse, assuming the file will
-    // be mmapped to page boundaries.
-    char header[1024];
-    snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    size_t len = strlen(header);
-    fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    ssize_t off = 0;
-    while((len + 1 + off) & 0xf) off++;
-    while(off-- > 0) fprintf(f, "0");
-    fprintf(f, "\n");
-    void *buf_line = dt_alloc_align(16, 3 * sizeof(float) * pfm->width);
-    for(int j = 0; j < pfm->height; j++)
-    {
-      // NOTE: pfm has rows in reverse order
-      const int row_in = pfm->height - 1 - j;
-      const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * row_in;
-      float *out = (float *)buf_line;
-      for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-      // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
-      int cnt = fwrite(buf_line, 3 * sizeof(float), pfm->width, f);
-      if(cnt != pfm->width)
-        status = 1;
-      else
-        status = 0;
-    }
+    free(h);
     dt_free_align(buf_line);
-    buf_line = NULL;
     fclose(f);
+    return NULL;
   }
+  h->f = f;
+  h->data_offset = ftell(f);
+  h->buf_line = buf_line;
+  return h;
+}
+
+int write_image_rows(dt_imageio_module_data_t *data, void *handle, const void *ivoid, int y, int rows)
+{
+  const dt_imageio_module_data_t *const pfm = data;
+  dt_imageio_pfm_handle_t *h = (dt_imageio_pfm_handle_t *)handle;
+  // NOTE: pfm has rows in reverse order, so the band ends up as one contiguous block, bottom row first
+  const size_t line_size = 3 * sizeof(float) * pfm->width;
+  if(fseek(h->f, h->data_offset + (long)(pfm->height - y - rows) * line_size, SEEK_SET)) return 1;
+  for(int j = rows - 1; j >= 0; j--)
+  {
+    const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * j;
+    float *out = h->buf_line;
+    for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
+    {
+      memcpy(out, in, 3 * sizeof(float));
+    }
+    // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
+    int cnt = fwrite(h->buf_line, 3 * sizeof(float), pfm->width, h->f);
+    if(cnt != pfm->width) return 1;
+  }
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *data, void *handle, int failed)
+{
+  dt_imageio_pfm_handle_t *h = (dt_imageio_pfm_handle_t *)handle;
+  const int status = fclose(h->f) != 0;
+  dt_free_align(h->buf_line);
+  free(h);
   return status;
 }
 
+int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(data, filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  const int failed = write_image_rows(data, handle, ivoid, 0, data->height);
+  return write_image_end(data, handle, failed) || failed;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_module_data_t);
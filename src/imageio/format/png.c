@@ -26,6 +26,7 @@
 #include <png.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 #include "bauhaus/bauhaus.h"
@@ -120,13 +121,204 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
-int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid, void *exif,
-                int exif_len, int imgid, int num, int total)
+// uncompressed size of the chunks of image data that get deflated in parallel
+#define DT_PNG_CHUNK_SIZE (256 * 1024)
+// deflate window, chunks get primed with that much of the data before them
+#define DT_PNG_DICT_SIZE 32768
+
+typedef struct dt_imageio_png_handle_t
+{
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+
+  // the image data is filtered and deflated by us, pigz style: every chunk of rows is its own raw deflate
+  // stream, primed with the preceding 32k and ended on a byte boundary, so they can just be concatenated.
+  int bytes_pp;      // bytes per pixel, 3 or 6
+  size_t rawsize;    // bytes per unfiltered row
+  int chunk_rows;    // rows per chunk
+  int batch_chunks;  // chunks compressed in parallel
+  int pending_rows;  // rows waiting in raw
+  int have_prev;     // prev holds the last row of the previous batch
+  int header_written;
+  uint8_t *raw;      // batch_chunks * chunk_rows unfiltered rows
+  uint8_t *filtered; // the same rows, filtered, with the filter type byte in front
+  uint8_t *prev;
+  uint8_t dict[DT_PNG_DICT_SIZE];
+  size_t dict_len;
+  uLong adler;
+  size_t zsize;      // size of one compressed chunk slot in zbuf
+  uint8_t *zbuf;
+  size_t *zlen;
+  uLong *zadler;
+} dt_imageio_png_handle_t;
+
+static inline int _png_paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+// filter one row, trying all filter types and keeping the one with the smallest sum of absolute values like
+// libpng does. prev is NULL for the first row of the image, out gets the filter type byte plus the row.
+static void _png_filter_row(const uint8_t *cur, const uint8_t *prev, uint8_t *out, uint8_t *tmp,
+                            const size_t len, const int bpp)
+{
+  uint64_t best_sum = UINT64_MAX;
+  for(int type = 0; type < 5; type++)
+  {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < len; i++)
+    {
+      const int x = cur[i];
+      const int a = i >= bpp ? cur[i - bpp] : 0;
+      const int b = prev ? prev[i] : 0;
+      const int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+      int pred = 0;
+      switch(type)
+      {
+        case 1:
+          pred = a;
+          break;
+        case 2:
+          pred = b;
+          break;
+        case 3:
+          pred = (a + b) / 2;
+          break;
+        case 4:
+          pred = _png_paeth(a, b, c);
+          break;
+      }
+      tmp[i] = (uint8_t)(x - pred);
+      sum += abs((int8_t)tmp[i]);
+    }
+    if(sum < best_sum)
+    {
+      best_sum = sum;
+      out[0] = type;
+      memcpy(out + 1, tmp, len);
+    }
+  }
+}
+
+// filter and deflate all pending rows in parallel and write them as IDAT chunks. the final call also
+// terminates the deflate stream and appends the checksum.
+static int _png_flush_chunks(dt_imageio_png_handle_t *h, const int final)
+{
+  const size_t rawsize = h->rawsize;
+  const size_t rowsize = rawsize + 1;
+  const int rows = h->pending_rows;
+  // the final stream needs a last block, even if there's no data left for it
+  const int chunks = MAX(final ? 1 : 0, (rows + h->chunk_rows - 1) / h->chunk_rows);
+  int failed = 0;
+
+  // one scratch row per thread
+  uint8_t *const tmp_buf = dt_alloc_align(64, rawsize * dt_get_num_threads());
+  if(!tmp_buf) return 1;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(h)
+#endif
+  for(int j = 0; j < rows; j++)
+  {
+    uint8_t *tmp = tmp_buf + rawsize * dt_get_thread_num();
+    const uint8_t *prev = j > 0 ? h->raw + (j - 1) * rawsize : (h->have_prev ? h->prev : NULL);
+    _png_filter_row(h->raw + j * rawsize, prev, h->filtered + j * rowsize, tmp, rawsize, h->bytes_pp);
+  }
+  dt_free_align(tmp_buf);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(h, failed)
+#endif
+  for(int k = 0; k < chunks; k++)
+  {
+    const size_t start = (size_t)k * h->chunk_rows * rowsize;
+    const size_t len = (size_t)MIN(h->chunk_rows, rows - k * h->chunk_rows) * rowsize;
+    const uint8_t *in = h->filtered + start;
+
+    z_stream zs = { 0 };
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      failed = 1;
+      continue;
+    }
+    if(k > 0)
+      deflateSetDictionary(&zs, in - DT_PNG_DICT_SIZE, DT_PNG_DICT_SIZE);
+    else if(h->dict_len)
+      deflateSetDictionary(&zs, h->dict, h->dict_len);
+
+    const int last = final && k == chunks - 1;
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = len;
+    zs.next_out = h->zbuf + k * h->zsize;
+    zs.avail_out = h->zsize;
+    const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if((last && ret != Z_STREAM_END) || (!last && (ret != Z_OK || zs.avail_in)) || !zs.avail_out) failed = 1;
+    h->zlen[k] = h->zsize - zs.avail_out;
+    h->zadler[k] = adler32(adler32(0L, Z_NULL, 0), in, len);
+    deflateEnd(&zs);
+  }
+  if(failed) return 1;
+
+  for(int k = 0; k < chunks; k++)
+  {
+    const size_t len = (size_t)MIN(h->chunk_rows, rows - k * h->chunk_rows) * rowsize;
+    h->adler = adler32_combine(h->adler, h->zadler[k], len);
+
+    const int first = !h->header_written;
+    const int last = final && k == chunks - 1;
+    png_write_chunk_start(h->png_ptr, (png_bytep) "IDAT", h->zlen[k] + (first ? 2 : 0) + (last ? 4 : 0));
+    if(first)
+    {
+      // zlib header: deflate with 32k window, maximum compression
+      const uint8_t header[2] = { 0x78, 0xda };
+      png_write_chunk_data(h->png_ptr, (png_bytep)header, 2);
+      h->header_written = 1;
+    }
+    png_write_chunk_data(h->png_ptr, h->zbuf + k * h->zsize, h->zlen[k]);
+    if(last)
+    {
+      const uint8_t trailer[4] = { h->adler >> 24, h->adler >> 16, h->adler >> 8, h->adler };
+      png_write_chunk_data(h->png_ptr, (png_bytep)trailer, 4);
+    }
+    png_write_chunk_end(h->png_ptr);
+  }
+
+  // keep what the next batch needs: the last row to filter against and the last 32k to prime deflate with
+  if(rows > 0)
+  {
+    memcpy(h->prev, h->raw + (rows - 1) * rawsize, rawsize);
+    h->have_prev = 1;
+    const size_t total = (size_t)rows * rowsize;
+    const size_t keep = MIN(total, DT_PNG_DICT_SIZE);
+    if(keep < DT_PNG_DICT_SIZE)
+    {
+      // short batch, shift the old dictionary down
+      const size_t old = MIN(h->dict_len, DT_PNG_DICT_SIZE - keep);
+      memmove(h->dict, h->dict + h->dict_len - old, old);
+      memcpy(h->dict + old, h->filtered + total - keep, keep);
+      h->dict_len = old + keep;
+    }
+    else
+    {
+      memcpy(h->dict, h->filtered + total - keep, keep);
+      h->dict_len = keep;
+    }
+  }
+  h->pending_rows = 0;
+  return 0;
+}
+
+void *write_image_begin(dt_imageio_module_data_t *p_tmp, const char *filename, void *exif, int exif_len,
+                        int imgid, int num, int total)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->width, height = p->height;
   FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f) return NULL;
 
   png_structp png_ptr;
   png_infop info_ptr;
@@ -135,7 +327,7 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   if(!png_ptr)
   {
     fclose(f);
-    return 1;
+    return NULL;
   }
 
   info_ptr = png_create_info_struct(png_ptr);
@@ -143,24 +335,19 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    return NULL;
   }
 
   if(setjmp(png_jmpbuf(png_ptr)))
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
+    return NULL;
   }
 
   png_init_io(png_ptr, f);
 
-  png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-  png_set_compression_mem_level(png_ptr, 8);
-  png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
-  png_set_compression_window_bits(png_ptr, 15);
-  png_set_compression_method(png_ptr, 8);
-  png_set_compression_buffer_size(png_ptr, 8192);
+  // the image data doesn't go through libpng's compression, see _png_flush_chunks()
 
   png_set_IHDR(png_ptr, info_ptr, width, height, p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
@@ -196,35 +383,100 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
 
   png_write_info(png_ptr, info_ptr);
 
-  /*
-   * Get rid of filler (OR ALPHA) bytes, pack XRGB/RGBX/ARGB/RGBA into
-   * RGB (4 channels -> 3 channels). The second parameter is not used.
-   */
-  png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
+  dt_imageio_png_handle_t *h = (dt_imageio_png_handle_t *)calloc(1, sizeof(dt_imageio_png_handle_t));
+  h->f = f;
+  h->png_ptr = png_ptr;
+  h->info_ptr = info_ptr;
+  h->bytes_pp = p->bpp > 8 ? 6 : 3;
+  h->rawsize = (size_t)h->bytes_pp * width;
+  h->chunk_rows = MAX(1, DT_PNG_CHUNK_SIZE / (h->rawsize + 1));
+  h->batch_chunks = 2 * dt_get_num_threads();
+  h->adler = adler32(0L, Z_NULL, 0);
+  // room for the worst case of a stored chunk plus the sync flush marker
+  h->zsize = compressBound((h->rawsize + 1) * h->chunk_rows) + 16;
+  h->raw = malloc(h->rawsize * h->chunk_rows * h->batch_chunks);
+  h->filtered = malloc((h->rawsize + 1) * h->chunk_rows * h->batch_chunks);
+  h->prev = malloc(h->rawsize);
+  h->zbuf = malloc(h->zsize * h->batch_chunks);
+  h->zlen = malloc(sizeof(size_t) * h->batch_chunks);
+  h->zadler = malloc(sizeof(uLong) * h->batch_chunks);
+  if(!h->raw || !h->filtered || !h->prev || !h->zbuf || !h->zlen || !h->zadler)
+  {
+    write_image_end(p_tmp, h, 1);
+    return NULL;
+  }
+  return h;
+}
 
-  png_bytep *row_pointers = malloc((size_t)height * sizeof(png_bytep));
+int write_image_rows(dt_imageio_module_data_t *p_tmp, void *handle, const void *ivoid, int y, int rows)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  dt_imageio_png_handle_t *h = (dt_imageio_png_handle_t *)handle;
+  const int width = p->width;
+  const int batch_rows = h->chunk_rows * h->batch_chunks;
 
-  if(p->bpp > 8)
-  {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
+  // libpng errors longjmp back to here, the handle gets cleaned up in write_image_end()
+  if(setjmp(png_jmpbuf(h->png_ptr))) return 1;
 
-    for(unsigned i = 0; i < height; i++)
-      row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
-  }
-  else
+  for(int j = 0; j < rows; j++)
   {
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+    // pack rgba into rgb, 16 bit samples go most significant byte first
+    uint8_t *out = h->raw + h->pending_rows * h->rawsize;
+    if(p->bpp > 8)
+    {
+      const uint16_t *in = (const uint16_t *)ivoid + (size_t)4 * j * width;
+      for(int i = 0; i < width; i++, in += 4, out += 6)
+        for(int k = 0; k < 3; k++)
+        {
+          out[2 * k] = in[k] >> 8;
+          out[2 * k + 1] = in[k] & 0xff;
+        }
+    }
+    else
+    {
+      const uint8_t *in = (const uint8_t *)ivoid + (size_t)4 * j * width;
+      for(int i = 0; i < width; i++, in += 4, out += 3) memcpy(out, in, 3);
+    }
+    if(++h->pending_rows == batch_rows && _png_flush_chunks(h, 0)) return 1;
   }
+  return 0;
+}
 
-  png_write_image(png_ptr, row_pointers);
+int write_image_end(dt_imageio_module_data_t *p_tmp, void *handle, int failed)
+{
+  dt_imageio_png_handle_t *h = (dt_imageio_png_handle_t *)handle;
+  int rc = failed ? 1 : 0;
 
-  free(row_pointers);
+  if(!failed)
+  {
+    if(setjmp(png_jmpbuf(h->png_ptr)))
+      rc = 1;
+    else if(_png_flush_chunks(h, 1))
+      rc = 1;
+    else
+      // we wrote the IDATs behind libpng's back, so png_write_end() would complain. nothing comes after the
+      // image data, just finish the file.
+      png_write_chunk(h->png_ptr, (png_bytep) "IEND", NULL, 0);
+  }
+  png_destroy_write_struct(&h->png_ptr, &h->info_ptr);
+  fclose(h->f);
+  free(h->raw);
+  free(h->filtered);
+  free(h->prev);
+  free(h->zbuf);
+  free(h->zlen);
+  free(h->zadler);
+  free(h);
+  return rc;
+}
 
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
-  return 0;
+int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(p_tmp, filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  const int failed = write_image_rows(p_tmp, handle, ivoid, 0, p_tmp->height);
+  return write_image_end(p_tmp, handle, failed);
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 DT_MODULE(2)
 
@@ -51,19 +52,116 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
-int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif,
-                int exif_len, int imgid, int num, int total)
+// uncompressed size we aim for per strip when deflating them in parallel
+#define DT_TIFF_STRIP_SIZE (256 * 1024)
+
+typedef struct dt_imageio_tiff_handle_t
 {
-  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  TIFF *tif;
+  char *filename;
+  void *exif;
+  int exif_len;
+  uint8_t *profile;
+  void *rowdata;
+
+  // deflate compression is done by us, a batch of strips at a time, and written out raw
+  size_t rowsize;
+  int predictor;
+  int strip_rows;    // rows per strip
+  int batch_strips;  // strips compressed in parallel
+  int pending_rows;  // rows waiting in pending
+  uint32_t next_strip;
+  uint8_t *pending;  // batch_strips * strip_rows rows of packed rgb
+  size_t zsize;      // size of one compressed strip slot in zbuf
+  uint8_t *zbuf;
+  uLongf *zlen;
+} dt_imageio_tiff_handle_t;
+
+// apply the tiff predictor to one row of packed rgb, like libtiff would do it
+static void _tiff_predict(uint8_t *row, uint8_t *tmp, const int width, const int bpp, const int predictor)
+{
+  const size_t wc = (size_t)3 * width; // samples per row
+  if(predictor == 2)
+  {
+    // horizontal differencing of the samples
+    if(bpp == 8)
+      for(size_t i = wc - 1; i >= 3; i--) row[i] -= row[i - 3];
+    else if(bpp == 16)
+    {
+      uint16_t *r = (uint16_t *)row;
+      for(size_t i = wc - 1; i >= 3; i--) r[i] -= r[i - 3];
+    }
+    else
+    {
+      uint32_t *r = (uint32_t *)row;
+      for(size_t i = wc - 1; i >= 3; i--) r[i] -= r[i - 3];
+    }
+  }
+  else if(predictor == 3)
+  {
+    // floating point predictor: split the floats into byte planes, most significant first, then
+    // difference the bytes
+    memcpy(tmp, row, wc * 4);
+    for(size_t k = 0; k < wc; k++)
+      for(int b = 0; b < 4; b++)
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+        row[b * wc + k] = tmp[4 * k + b];
+#else
+        row[(3 - b) * wc + k] = tmp[4 * k + b];
+#endif
+    for(size_t i = 4 * wc - 1; i >= 3; i--) row[i] -= row[i - 3];
+  }
+}
 
-  uint8_t *profile = NULL;
-  uint32_t profile_len = 0;
+// compress the pending rows in parallel, one zlib stream per strip, and write the strips in order
+static int _tiff_flush_strips(const dt_imageio_tiff_t *d, dt_imageio_tiff_handle_t *h)
+{
+  const int strips = (h->pending_rows + h->strip_rows - 1) / h->strip_rows;
+  const int swab = TIFFIsByteSwapped(h->tif) && h->predictor != 3;
+  const size_t strip_size = h->rowsize * h->strip_rows;
+  int failed = 0;
 
-  TIFF *tif = NULL;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) default(none) shared(d, h, failed)
+#endif
+  for(int s = 0; s < strips; s++)
+  {
+    const int rows = MIN(h->strip_rows, h->pending_rows - s * h->strip_rows);
+    uint8_t *strip = h->pending + s * strip_size;
+    uint8_t *tmp = h->predictor == 3 ? malloc(h->rowsize) : NULL;
+    for(int j = 0; j < rows; j++)
+    {
+      uint8_t *row = strip + j * h->rowsize;
+      _tiff_predict(row, tmp, d->width, d->bpp, h->predictor);
+      if(swab && d->bpp == 16)
+        TIFFSwabArrayOfShort((uint16_t *)row, 3 * d->width);
+      else if(swab && d->bpp == 32)
+        TIFFSwabArrayOfLong((uint32_t *)row, 3 * d->width);
+    }
+    free(tmp);
+    h->zlen[s] = h->zsize;
+    if(compress2(h->zbuf + s * h->zsize, &h->zlen[s], strip, rows * h->rowsize, 9) != Z_OK) failed = 1;
+  }
 
-  void *rowdata = NULL;
+  for(int s = 0; !failed && s < strips; s++)
+    if(TIFFWriteRawStrip(h->tif, h->next_strip++, h->zbuf + s * h->zsize, h->zlen[s]) == -1) failed = 1;
 
-  int rc = 1; // default to error
+  h->pending_rows = 0;
+  return failed;
+}
+
+void *write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename, void *exif, int exif_len,
+                        int imgid, int num, int total)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  dt_imageio_tiff_handle_t *h = (dt_imageio_tiff_handle_t *)calloc(1, sizeof(dt_imageio_tiff_handle_t));
+  if(!h) return NULL;
+  h->exif = exif;
+  h->exif_len = exif_len;
+
+  uint32_t profile_len = 0;
+  uint16_t predictor = 1;
 
   if(imgid > 0)
   {
@@ -71,23 +169,16 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     cmsSaveProfileToMem(out_profile, 0, &profile_len);
     if(profile_len > 0)
     {
-      profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
-      cmsSaveProfileToMem(out_profile, profile, &profile_len);
+      h->profile = malloc(profile_len);
+      if(!h->profile) goto error;
+      cmsSaveProfileToMem(out_profile, h->profile, &profile_len);
     }
   }
 
   // Create little endian tiff image
-  tif = TIFFOpen(filename, "wl");
-  if(!tif)
-  {
-    rc = 1;
-    goto exit;
-  }
+  h->tif = TIFFOpen(filename, "wl");
+  if(!h->tif) goto error;
+  h->filename = g_strdup(filename);
 
   // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
   // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
@@ -96,6 +187,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   // "write the official compression code (0x0008)."
   // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
   // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
+  TIFF *tif = h->tif;
   if(d->compress == 1)
   {
     TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
@@ -123,9 +215,9 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   }
 
   TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
-  if(profile != NULL)
+  if(h->profile != NULL)
   {
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, h->profile);
   }
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
@@ -134,7 +226,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->height);
   TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
   TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
   TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
 
   int resolution = dt_conf_get_int("metadata/resolution");
@@ -145,95 +236,104 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
   }
 
-  const size_t rowsize = (d->width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  h->rowsize = (d->width * 3) * d->bpp / 8;
+  if(d->compress > 0)
   {
-    rc = 1;
-    goto exit;
+    // deflating is what takes the time, so we do it ourselves for several strips at once.
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PREDICTOR, &predictor);
+    h->predictor = predictor;
+    h->strip_rows = MAX(1, DT_TIFF_STRIP_SIZE / h->rowsize);
+    h->batch_strips = 2 * dt_get_num_threads();
+    h->zsize = compressBound(h->rowsize * h->strip_rows);
+    h->pending = malloc(h->rowsize * h->strip_rows * h->batch_strips);
+    h->zbuf = malloc(h->zsize * h->batch_strips);
+    h->zlen = malloc(sizeof(uLongf) * h->batch_strips);
+    if(!h->pending || !h->zbuf || !h->zlen) goto error;
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)h->strip_rows);
   }
-
-  if(d->bpp == 32)
+  else
   {
-    for(int y = 0; y < d->height; y++)
-    {
-      float *in = (float *)in_void + (size_t)4 * y * d->width;
-      float *out = (float *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
+    if((h->rowdata = malloc(h->rowsize)) == NULL) goto error;
   }
-  else if(d->bpp == 16)
+
+  return h;
+
+error:
+  write_image_end(d_tmp, h, 1);
+  return NULL;
+}
+
+int write_image_rows(dt_imageio_module_data_t *d_tmp, void *handle, const void *in_void, int y, int rows)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_handle_t *h = (dt_imageio_tiff_handle_t *)handle;
+
+  // input is 4 channels of 8, 16 or 32 bits, we only write the first 3 of them
+  const size_t bytes = d->bpp / 8;
+  const int batch_rows = h->strip_rows * h->batch_strips;
+  for(int j = 0; j < rows; j++)
   {
-    for(int y = 0; y < d->height; y++)
+    const uint8_t *in = (const uint8_t *)in_void + (size_t)4 * bytes * j * d->width;
+    uint8_t *out = h->pending ? h->pending + h->pending_rows * h->rowsize : (uint8_t *)h->rowdata;
+
+    for(int x = 0; x < d->width; x++, in += 4 * bytes, out += 3 * bytes)
     {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint16_t));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      memcpy(out, in, 3 * bytes);
     }
-  }
-  else
-  {
-    for(int y = 0; y < d->height; y++)
+
+    if(!h->pending)
     {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->width;
-      uint8_t *out = (uint8_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint8_t));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(TIFFWriteScanline(h->tif, h->rowdata, y + j, 0) == -1) return 1;
     }
+    else if(++h->pending_rows == batch_rows && _tiff_flush_strips(d, h))
+      return 1;
   }
+  return 0;
+}
 
-  // success
-  rc = 0;
+int write_image_end(dt_imageio_module_data_t *d_tmp, void *handle, int failed)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  dt_imageio_tiff_handle_t *h = (dt_imageio_tiff_handle_t *)handle;
+
+  int rc = failed ? 1 : 0;
+
+  // the last (partial) batch of strips
+  if(!rc && h->pending_rows > 0) rc = _tiff_flush_strips(d, h);
 
-exit:
   // close the file before adding exif data
-  if(tif)
+  if(h->tif)
   {
-    TIFFClose(tif);
-    tif = NULL;
+    TIFFClose(h->tif);
+    h->tif = NULL;
   }
-  if(!rc && exif)
+  if(!rc && h->exif)
   {
-    rc = dt_exif_write_blob(exif, exif_len, filename, d->compress > 0);
+    rc = dt_exif_write_blob(h->exif, h->exif_len, h->filename, d->compress > 0);
     // Until we get symbolic error status codes, if rc is 1, return 0
     rc = (rc == 1) ? 0 : 1;
   }
-  free(profile);
-  profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
+  free(h->profile);
+  free(h->rowdata);
+  free(h->pending);
+  free(h->zbuf);
+  free(h->zlen);
+  g_free(h->filename);
+  free(h);
 
   return rc;
 }
 
+int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  void *handle = write_image_begin(d_tmp, filename, exif, exif_len, imgid, num, total);
+  if(!handle) return 1;
+  const int failed = write_image_rows(d_tmp, handle, in_void, 0, d_tmp->height);
+  return write_image_end(d_tmp, handle, failed);
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
@@ -320,14 +320,32 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
            relthumbfilename,
            num, num-1, title ? title : "&nbsp;", description ? description : "&nbsp;");
 
-  // export image to file. need this to be able to access meaningful
-  // fdata->width and height below.
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, FALSE, self, sdata, num, total) != 0)
+  // the thumbnail goes next to the image, with -thumb appended:
+  char thumbfilename[PATH_MAX] = { 0 };
+  snprintf(thumbfilename, sizeof(thumbfilename), "%s", filename);
+  c = thumbfilename + strlen(thumbfilename);
+  for(; c > thumbfilename && *c != '.' && *c != '/'; c--)
+    ;
+  if(c <= thumbfilename || *c == '/') c = thumbfilename + strlen(thumbfilename);
+  sprintf(c, "-thumb.%s", ext);
+
+  // export image and thumbnail to file in one go, the thumbnail is downscaled from the processed image.
+  // need this to be able to access meaningful width and height below.
+  dt_imageio_rendition_t renditions[2] = {
+    { .filename = filename, .format = format, .format_params = fdata,
+      .max_width = fdata->max_width, .max_height = fdata->max_height },
+    { .filename = thumbfilename, .format = format, .format_params = fdata, .max_width = 200, .max_height = 200 }
+  };
+  if(dt_imageio_export_renditions(imgid, renditions, 2, high_quality, upscale, FALSE, self, sdata, num, total)
+     != 0)
   {
     fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
     return 1;
   }
+  // both renditions share fdata, which holds the thumbnail's size now. put back the one of the image.
+  fdata->width = renditions[0].width;
+  fdata->height = renditions[0].height;
 
   snprintf(pair->item, sizeof(pair->item),
            "{\n"
@@ -336,36 +354,13 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
            "h: %d,\n"
            "msrc: '%s',\n"
            "},\n",
-           relfilename, fdata->width, fdata->height, relthumbfilename);
+           relfilename, renditions[0].width, renditions[0].height, relthumbfilename);
 
   pair->pos = num;
   if(res_title) g_list_free_full(res_title, &g_free);
   if(res_desc) g_list_free_full(res_desc, &g_free);
   d->l = g_list_insert_sorted(d->l, pair, (GCompareFunc)sort_pos);
 
-  /* also export thumbnail: */
-  // write with reduced resolution:
-  const int max_width = fdata->max_width;
-  const int max_height = fdata->max_height;
-  fdata->max_width = 200;
-  fdata->max_height = 200;
-  // alter filename with -thumb:
-  c = filename + strlen(filename);
-  for(; c > filename && *c != '.' && *c != '/'; c--)
-    ;
-  if(c <= filename || *c == '/') c = filename + strlen(filename);
-  ext = format->extension(fdata);
-  sprintf(c, "-thumb.%s", ext);
-  if(dt_imageio_export(imgid, filename, format, fdata, FALSE, TRUE, FALSE, self, sdata, num, total) != 0)
-  {
-    fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
-    dt_control_log(_("could not export to file `%s'!"), filename);
-    return 1;
-  }
-  // restore for next image:
-  fdata->max_width = max_width;
-  fdata->max_height = max_height;
-
   printf("[export_job] exported to `%s'\n", filename);
   char *trunc = filename + strlen(filename) - 32;
   if(trunc < filename) trunc = filename;
@@ -803,6 +803,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   for(int scale = 0; scale < max_scale; scale++)
   {
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
@@ -835,6 +837,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   // now do everything backwards, so the result will end up in *ovoid
   for(int scale = max_scale - 1; scale >= 0; scale--)
   {
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
 #if 1
     // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
@@ -872,6 +876,7 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   backtransform((float *)ovoid, width, height, aa, bb);
 
+cancelled:
   for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
   dt_free_align(tmp);
 
@@ -913,6 +918,9 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   // for each shift vector
   for(int kj = -K; kj <= K; kj++)
   {
+    // the pipe will throw away our result anyways, don't waste time on it.
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
     for(int ki = -K; ki <= K; ki++)
     {
       // TODO: adaptive K tests here!
@@ -1027,6 +1035,11 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+  return;
+
+cancelled:
+  dt_free_align(Sa);
+  dt_free_align(in);
 }
 
 #if defined(__SSE2__)
@@ -1061,6 +1074,9 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   // for each shift vector
   for(int kj = -K; kj <= K; kj++)
   {
+    // the pipe will throw away our result anyways, don't waste time on it.
+    if(dt_dev_pixelpipe_cancelled(piece->pipe)) goto cancelled;
+
     for(int ki = -K; ki <= K; ki++)
     {
       // TODO: adaptive K tests here!
@@ -1224,6 +1240,11 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+  return;
+
+cancelled:
+  dt_free_align(Sa);
+  dt_free_align(in);
 }
 #endif
 
@@ -34,7 +34,9 @@ DT_MODULE(1)
 
 typedef struct dt_undo_history_t
 {
-  GList *snapshot;
+  GList *snapshot;     // dt_dev_history_item_t, params and blend_params point into the blobs below
+  GList *params;       // GBytes, shared with the snapshot before as long as they didn't change
+  GList *blend_params; // GBytes, the same
   int end;
 } dt_undo_history_t;
 
@@ -46,6 +48,9 @@ typedef struct dt_lib_history_t
 //   GtkWidget *apply_button;
   GtkWidget *compress_button;
   gboolean record_undo;
+  // the blobs of the last snapshot, to share the unchanged ones with the next
+  GList *last_params;
+  GList *last_blend_params;
 } dt_lib_history_t;
 
 /* compress history stack */
@@ -143,6 +148,9 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_change_callback), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_module_remove_callback), self);
+  dt_lib_history_t *d = (dt_lib_history_t *)self->data;
+  g_list_free_full(d->last_params, (GDestroyNotify)g_bytes_unref);
+  g_list_free_full(d->last_blend_params, (GDestroyNotify)g_bytes_unref);
   g_free(self->data);
   self->data = NULL;
 }
@@ -179,10 +187,30 @@ static GtkWidget *_lib_history_create_button(dt_lib_module_t *self, int num, con
   return widget;
 }
 
-static GList *_duplicate_history(GList *hist)
+// the same params as the item at the same position in the last snapshot, or a new blob
+static GBytes *_history_blob(GList **last, const void *data, const size_t size)
 {
-  GList *result = NULL;
+  GBytes *blob = NULL;
+  if(*last)
+  {
+    gsize last_size = 0;
+    const void *last_data = g_bytes_get_data((GBytes *)(*last)->data, &last_size);
+    if(last_size == size && !memcmp(last_data, data, size)) blob = g_bytes_ref((GBytes *)(*last)->data);
+    *last = g_list_next(*last);
+  }
+  return blob ? blob : g_bytes_new(data, size);
+}
+
+// a snapshot for undo only takes new memory for the params which changed since the last one. with long
+// histories (brushes, liquify) that's one item per step instead of all of them.
+static dt_undo_history_t *_history_snapshot(dt_lib_history_t *d, GList *hist, const int end)
+{
+  dt_undo_history_t *result = (dt_undo_history_t *)malloc(sizeof(dt_undo_history_t));
+  result->snapshot = result->params = result->blend_params = NULL;
+  result->end = end;
 
+  GList *last_params = d->last_params;
+  GList *last_blend_params = d->last_blend_params;
   GList *h = g_list_first(hist);
   while(h)
   {
@@ -192,15 +220,57 @@ static GList *_duplicate_history(GList *hist)
 
     memcpy(new, old, sizeof(dt_dev_history_item_t));
 
-    new->params = malloc(old->module->params_size);
-    new->blend_params = malloc(sizeof(dt_develop_blend_params_t));
+    GBytes *params = _history_blob(&last_params, old->params, old->module->params_size);
+    GBytes *blend_params
+        = _history_blob(&last_blend_params, old->blend_params, sizeof(dt_develop_blend_params_t));
+    new->params = (dt_iop_params_t *)g_bytes_get_data(params, NULL);
+    new->blend_params = (dt_develop_blend_params_t *)g_bytes_get_data(blend_params, NULL);
+
+    result->snapshot = g_list_prepend(result->snapshot, new);
+    result->params = g_list_prepend(result->params, params);
+    result->blend_params = g_list_prepend(result->blend_params, blend_params);
+
+    h = g_list_next(h);
+  }
+  result->snapshot = g_list_reverse(result->snapshot);
+  result->params = g_list_reverse(result->params);
+  result->blend_params = g_list_reverse(result->blend_params);
+
+  g_list_free_full(d->last_params, (GDestroyNotify)g_bytes_unref);
+  g_list_free_full(d->last_blend_params, (GDestroyNotify)g_bytes_unref);
+  d->last_params = g_list_copy_deep(result->params, (GCopyFunc)g_bytes_ref, NULL);
+  d->last_blend_params = g_list_copy_deep(result->blend_params, (GCopyFunc)g_bytes_ref, NULL);
+  return result;
+}
+
+// back to real history items, which the develop module owns
+static GList *_history_restore(const dt_undo_history_t *hist)
+{
+  GList *result = NULL;
 
-    memcpy(new->params, old->params, old->module->params_size);
-    memcpy(new->blend_params, old->blend_params, sizeof(dt_develop_blend_params_t));
+  GList *h = g_list_first(hist->snapshot);
+  GList *p = g_list_first(hist->params);
+  GList *b = g_list_first(hist->blend_params);
+  while(h)
+  {
+    const dt_dev_history_item_t *old = (dt_dev_history_item_t *)(h->data);
+
+    dt_dev_history_item_t *new = (dt_dev_history_item_t *)malloc(sizeof(dt_dev_history_item_t));
+
+    memcpy(new, old, sizeof(dt_dev_history_item_t));
+
+    gsize size = 0;
+    const void *params = g_bytes_get_data((GBytes *)p->data, &size);
+    new->params = malloc(size);
+    memcpy(new->params, params, size);
+    new->blend_params = malloc(sizeof(dt_develop_blend_params_t));
+    memcpy(new->blend_params, g_bytes_get_data((GBytes *)b->data, NULL), sizeof(dt_develop_blend_params_t));
 
     result = g_list_append(result, new);
 
     h = g_list_next(h);
+    p = g_list_next(p);
+    b = g_list_next(b);
   }
   return result;
 }
@@ -262,7 +332,7 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t *d
     dt_undo_history_t *hist = (dt_undo_history_t *)data;
 
     g_list_free_full(darktable.develop->history, dt_dev_free_history_item);
-    darktable.develop->history = _duplicate_history(hist->snapshot);
+    darktable.develop->history = _history_restore(hist);
     darktable.develop->history_end = hist->end;
 
     //  let's handle invalidated module in the history
@@ -355,8 +425,10 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t *d
 static void _history_undo_data_free(gpointer data)
 {
   dt_undo_history_t *hist = (dt_undo_history_t *)data;
-  GList *snapshot = hist->snapshot;
-  g_list_free_full(snapshot, dt_dev_free_history_item);
+  // the params belong to the blobs
+  g_list_free_full(hist->snapshot, free);
+  g_list_free_full(hist->params, (GDestroyNotify)g_bytes_unref);
+  g_list_free_full(hist->blend_params, (GDestroyNotify)g_bytes_unref);
   free(data);
 }
 
@@ -390,9 +462,8 @@ static void _lib_history_change_callback(gpointer instance, gpointer user_data)
   if (d->record_undo == TRUE)
   {
     /* record undo/redo history snapshot */
-    dt_undo_history_t *hist = malloc(sizeof(dt_undo_history_t));
-    hist->snapshot = _duplicate_history(darktable.develop->history);
-    hist->end = darktable.develop->history_end;
+    dt_undo_history_t *hist
+        = _history_snapshot(d, darktable.develop->history, darktable.develop->history_end);
 
     dt_undo_record(darktable.undo, self, DT_UNDO_HISTORY, (dt_undo_data_t *)hist,
                    _pop_undo, _history_undo_data_free);
@@ -229,6 +229,9 @@ _print_button_clicked (GtkWidget *widget, gpointer user_data)
   buf.levels = levels;
   buf.bpp = bpp;
   buf.write_image = write_image;
+  // no streaming: the whole buffer gets laid out on the page and converted to the printer profile, and it is
+  // only as large as the page at the printer resolution anyway
+  buf.write_image_begin = NULL;
 
   dt_print_format_t dat;
   dat.max_width = max_width;
@@ -0,0 +1,197 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// import throughput test: fills two temporary directories with the same small files, imports one of them
+// image by image like dt_image_import() callers do, and the other one as a film roll, which goes through the
+// pipelined importer. the files are tiny generated jpegs, or copies of a template (a small dng, say).
+// fails if not every file ended up in the library with an xmp sidecar.
+// usage: ./import [number of files] [template file] [darktable options]
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/imageio_jpeg.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int fill_directory(const char *dir, const int num, const char *template)
+{
+  gchar *contents = NULL;
+  gsize length = 0;
+  const char *ext = "jpg";
+  if(template)
+  {
+    if(!g_file_get_contents(template, &contents, &length, NULL)) return 1;
+    const char *c = strrchr(template, '.');
+    if(c) ext = c + 1;
+  }
+
+  uint8_t pixels[64 * 64 * 4];
+  for(int k = 0; k < num; k++)
+  {
+    gchar *name = g_strdup_printf("%s/img_%06d.%s", dir, k, ext);
+    int err;
+    if(contents)
+      err = !g_file_set_contents(name, contents, length, NULL);
+    else
+    {
+      // make every file a bit different
+      for(int i = 0; i < 64 * 64 * 4; i++) pixels[i] = (i * 7 + k) & 0xff;
+      err = dt_imageio_jpeg_write(name, pixels, 64, 64, 90, NULL, 0);
+    }
+    g_free(name);
+    if(err)
+    {
+      g_free(contents);
+      return 1;
+    }
+  }
+  g_free(contents);
+  return 0;
+}
+
+static void empty_directory(const char *dir)
+{
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_unlink(path);
+    g_free(path);
+  }
+  g_dir_close(d);
+  g_rmdir(dir);
+}
+
+static int count_xmp_files(const char *dir)
+{
+  int count = 0;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+    if(g_str_has_suffix(name, ".xmp")) count++;
+  g_dir_close(d);
+  return count;
+}
+
+static int count_images(const char *dir)
+{
+  int count = 0;
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(dt_database_get(darktable.db),
+                     "SELECT COUNT(*) FROM main.images AS i, main.film_rolls AS f "
+                     "WHERE i.film_id = f.id AND f.folder = ?1",
+                     -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_STATIC);
+  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+int main(int argc, char *arg[])
+{
+  const int num = argc > 1 ? MAX(1, atoi(arg[1])) : 2000;
+  const char *template = argc > 2 ? arg[2] : NULL;
+
+  // no job system: the film import runs synchronously in this thread.
+  char *m_arg[] = { "darktable-import-test", "--library", ":memory:", "--conf", "write_sidecar_files=TRUE", NULL };
+  if(dt_init(5, m_arg, FALSE, FALSE, NULL))
+  {
+    fprintf(stderr, "[import] failed to init darktable\n");
+    exit(1);
+  }
+  dt_conf_set_bool("ui_last/import_recursive", FALSE);
+  dt_conf_set_bool("ui_last/import_ignore_jpegs", FALSE);
+
+  gchar *serial_dir = g_dir_make_tmp("darktable-import-serial-XXXXXX", NULL);
+  gchar *pipelined_dir = g_dir_make_tmp("darktable-import-pipelined-XXXXXX", NULL);
+  if(!serial_dir || !pipelined_dir || fill_directory(serial_dir, num, template)
+     || fill_directory(pipelined_dir, num, template))
+  {
+    fprintf(stderr, "[import] failed to create the test files\n");
+    exit(1);
+  }
+
+  // one by one, like the tethering and the lua imports
+  double start = dt_get_wtime();
+  dt_film_t film;
+  dt_film_init(&film);
+  const int filmid = dt_film_new(&film, serial_dir);
+  GDir *d = g_dir_open(serial_dir, 0, NULL);
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    gchar *path = g_build_filename(serial_dir, name, NULL);
+    dt_image_import(filmid, path, FALSE);
+    g_free(path);
+  }
+  g_dir_close(d);
+  dt_film_cleanup(&film);
+  const double serial = dt_get_wtime() - start;
+
+  // the whole directory at once
+  start = dt_get_wtime();
+  dt_film_import(pipelined_dir);
+  const double pipelined = dt_get_wtime() - start;
+
+  fprintf(stderr, "[import] %d %s files, %d threads\n", num, template ? template : "generated jpeg",
+          dt_get_num_threads());
+  fprintf(stderr, "%-12s %9s %10s %12s\n", "importer", "imported", "time [s]", "images/s");
+  const int serial_images = count_images(serial_dir);
+  const int pipelined_images = count_images(pipelined_dir);
+  fprintf(stderr, "%-12s %9d %10.3f %12.1f\n", "serial", serial_images, serial, num / MAX(serial, 1e-9));
+  fprintf(stderr, "%-12s %9d %10.3f %12.1f\n", "pipelined", pipelined_images, pipelined,
+          num / MAX(pipelined, 1e-9));
+
+  // writes the sidecars that are still queued
+  dt_cleanup();
+
+  const int serial_xmp = count_xmp_files(serial_dir);
+  const int pipelined_xmp = count_xmp_files(pipelined_dir);
+  int err = 0;
+  if(serial_images != num || pipelined_images != num)
+  {
+    fprintf(stderr, "[import] expected %d images in the library, got %d serial and %d pipelined\n", num,
+            serial_images, pipelined_images);
+    err = 1;
+  }
+  if(serial_xmp != num || pipelined_xmp != num)
+  {
+    fprintf(stderr, "[import] expected %d xmp files, got %d serial and %d pipelined\n", num, serial_xmp,
+            pipelined_xmp);
+    err = 1;
+  }
+
+  empty_directory(serial_dir);
+  empty_directory(pipelined_dir);
+  g_free(serial_dir);
+  g_free(pipelined_dir);
+
+  exit(err);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
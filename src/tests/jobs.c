@@ -0,0 +1,136 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2016 the darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// synthetic load test for the job scheduler: floods all queues with tiny jobs, like an import or a
+// thumbnail storm would, and reports throughput and queue latency per queue.
+// usage: ./jobs [jobs per queue] [darktable options]
+
+#include "common/darktable.h"
+#include "control/control.h"
+#include "control/jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct load_job_t
+{
+  int queue;
+  int seq; // makes every job unique, so none of them get deduped
+  double enqueued;
+} load_job_t;
+
+static const char *queue_names[DT_JOB_QUEUE_MAX]
+    = { "user fg", "system fg", "user bg", "user export", "system bg" };
+
+static double *latency[DT_JOB_QUEUE_MAX];
+static int executed[DT_JOB_QUEUE_MAX];
+static int discarded[DT_JOB_QUEUE_MAX];
+static double finished[DT_JOB_QUEUE_MAX];
+
+static int32_t load_job_run(dt_job_t *job)
+{
+  const load_job_t *params = dt_control_job_get_params(job);
+  const double now = dt_get_wtime();
+  const int k = __sync_fetch_and_add(&executed[params->queue], 1);
+  latency[params->queue][k] = now - params->enqueued;
+  finished[params->queue] = now;
+  // pretend to do some work
+  volatile float sum = 0.0f;
+  for(int i = 0; i < 1000; i++) sum += i;
+  return 0;
+}
+
+static void load_job_state(dt_job_t *job, dt_job_state_t state)
+{
+  if(state != DT_JOB_STATE_DISCARDED) return;
+  const load_job_t *params = dt_control_job_get_params(job);
+  __sync_fetch_and_add(&discarded[params->queue], 1);
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+int main(int argc, char *arg[])
+{
+  const int num = argc > 1 ? MAX(1, atoi(arg[1])) : 20000;
+
+  char *m_arg[] = { "darktable-jobs-test", "--library", ":memory:", "--conf", "write_sidecar_files=FALSE", NULL };
+  if(dt_init(5, m_arg, FALSE, FALSE, NULL))
+  {
+    fprintf(stderr, "[jobs] failed to init darktable\n");
+    exit(1);
+  }
+  // without gui the job system isn't started, jobs would run synchronously.
+  dt_control_init(darktable.control);
+
+  for(int q = 0; q < DT_JOB_QUEUE_MAX; q++) latency[q] = (double *)calloc(num, sizeof(double));
+
+  const double start = dt_get_wtime();
+  for(int k = 0; k < num; k++)
+  {
+    for(int q = 0; q < DT_JOB_QUEUE_MAX; q++)
+    {
+      dt_job_t *job = dt_control_job_create(&load_job_run, "load test %d", q);
+      load_job_t *params = (load_job_t *)calloc(1, sizeof(load_job_t));
+      params->queue = q;
+      params->seq = k;
+      params->enqueued = dt_get_wtime();
+      dt_control_job_set_params_with_size(job, params, sizeof(load_job_t), free);
+      dt_control_job_set_state_callback(job, &load_job_state);
+      dt_control_add_job(darktable.control, q, job);
+    }
+  }
+  const double queued = dt_get_wtime();
+
+  // wait for everything to drain
+  for(;;)
+  {
+    int done = 1;
+    for(int q = 0; q < DT_JOB_QUEUE_MAX; q++)
+      if(__sync_fetch_and_add(&executed[q], 0) + __sync_fetch_and_add(&discarded[q], 0) < num) done = 0;
+    if(done) break;
+    g_usleep(1000);
+  }
+
+  fprintf(stderr, "[jobs] %d jobs per queue, %d worker threads, queued all in %.3f s\n", num,
+          darktable.control->num_threads, queued - start);
+  fprintf(stderr, "%-12s %9s %9s %12s %10s %10s %10s\n", "queue", "executed", "discarded", "jobs/s",
+          "p50 [ms]", "p90 [ms]", "p99 [ms]");
+  for(int q = 0; q < DT_JOB_QUEUE_MAX; q++)
+  {
+    const int n = executed[q];
+    qsort(latency[q], n, sizeof(double), double_cmp);
+    fprintf(stderr, "%-12s %9d %9d %12.1f %10.3f %10.3f %10.3f\n", queue_names[q], n, discarded[q],
+            n / MAX(finished[q] - start, 1e-9), n ? 1000.0 * latency[q][n / 2] : 0.0,
+            n ? 1000.0 * latency[q][(int)(n * 0.9)] : 0.0, n ? 1000.0 * latency[q][(int)(n * 0.99)] : 0.0);
+    free(latency[q]);
+  }
+
+  dt_control_shutdown(darktable.control);
+  dt_control_cleanup(darktable.control);
+  dt_cleanup();
+  exit(0);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -170,6 +170,7 @@ void expose(
   static cairo_surface_t *image_surface = NULL;
   static int image_surface_width = 0, image_surface_height = 0, image_surface_imgid = -1;
   static float roi_hash_old = -1.0f;
+  static uint32_t progressive_serial_old = 0;
   // compute patented dreggn hash so we don't need to check all values:
   const float roi_hash = width + 7.0f * height + 23.0f * zoom + 42.0f * zoom_x + 91.0f * zoom_y
                          + 666.0f * zoom;
@@ -228,10 +229,12 @@ void expose(
     dt_pthread_mutex_unlock(mutex);
     image_surface_imgid = dev->image_storage.id;
   }
-  else if((dev->preview_status == DT_DEV_PIXELPIPE_VALID) && (roi_hash != roi_hash_old))
+  else if((dev->preview_status == DT_DEV_PIXELPIPE_VALID)
+          && (roi_hash != roi_hash_old || dev->progressive.serial != progressive_serial_old))
   {
     // draw preview
     roi_hash_old = roi_hash;
+    progressive_serial_old = dev->progressive.serial;
     mutex = &dev->preview_pipe->backbuf_mutex;
     dt_pthread_mutex_lock(mutex);
 
@@ -255,8 +258,77 @@ void expose(
     cairo_fill(cr);
     cairo_surface_destroy(surface);
     dt_pthread_mutex_unlock(mutex);
+
+    // draw the tiles the full pipe has finished so far on top
+    mutex = &dev->progressive.mutex;
+    dt_pthread_mutex_lock(mutex);
+    if(dev->image_status == DT_DEV_PIXELPIPE_RUNNING && dev->progressive.done && dev->progressive.zoom == zoom
+       && dev->progressive.closeup == closeup && dev->progressive.zoom_x == zoom_x
+       && dev->progressive.zoom_y == zoom_y)
+    {
+      const int pwd = dev->progressive.width, pht = dev->progressive.height;
+      const float ts = dev->progressive.tile_size / darktable.gui->ppd;
+      const float wd = pwd / darktable.gui->ppd, ht = pht / darktable.gui->ppd;
+      int have_tiles = 0;
+      cairo_identity_matrix(cr);
+      cairo_translate(cr, .5f * (width - wd), .5f * (height - ht));
+      if(closeup)
+      {
+        cairo_scale(cr, 2.0, 2.0);
+        cairo_translate(cr, -.25f * wd, -.25f * ht);
+      }
+      for(int ty = 0; ty < dev->progressive.tiles_y; ty++)
+        for(int tx = 0; tx < dev->progressive.tiles_x; tx++)
+          if(dev->progressive.done[ty * dev->progressive.tiles_x + tx])
+          {
+            cairo_rectangle(cr, tx * ts, ty * ts, MIN(ts, wd - tx * ts), MIN(ts, ht - ty * ts));
+            have_tiles = 1;
+          }
+      if(have_tiles)
+      {
+        stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, pwd);
+        surface = dt_cairo_image_surface_create_for_data(dev->progressive.buf, CAIRO_FORMAT_RGB24, pwd, pht,
+                                                         stride);
+        cairo_set_source_surface(cr, surface, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+        cairo_fill(cr);
+        cairo_surface_destroy(surface);
+      }
+      cairo_new_path(cr);
+    }
+    dt_pthread_mutex_unlock(mutex);
     image_surface_imgid = dev->image_storage.id;
   }
+  else if(image_surface_imgid != dev->image_storage.id)
+  {
+    // nothing processed for this image yet, show the stand-in the neighbour prefetch rendered for it
+    mutex = &dev->prefetch.mutex;
+    dt_pthread_mutex_lock(mutex);
+    for(int k = 0; k < 2; k++)
+    {
+      if(dev->prefetch.standin[k].imgid != dev->image_storage.id || !dev->prefetch.standin[k].buf) continue;
+      const int bwd = dev->prefetch.standin[k].width, bht = dev->prefetch.standin[k].height;
+      dt_gui_gtk_set_source_rgb(cr, DT_GUI_COLOR_DARKROOM_BG);
+      cairo_paint(cr);
+      stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, bwd);
+      surface = dt_cairo_image_surface_create_for_data(dev->prefetch.standin[k].buf, CAIRO_FORMAT_RGB24, bwd,
+                                                       bht, stride);
+      // the stand-in has been rendered in device pixels
+      const float wd = bwd / darktable.gui->ppd, ht = bht / darktable.gui->ppd;
+      const float fit_scale = fminf(dev->width / wd, dev->height / ht);
+      cairo_translate(cr, width / 2.0, height / 2.0f);
+      cairo_scale(cr, fit_scale, fit_scale);
+      cairo_translate(cr, -.5f * wd, -.5f * ht);
+      cairo_rectangle(cr, 0, 0, wd, ht);
+      cairo_set_source_surface(cr, surface, 0, 0);
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+      cairo_fill(cr);
+      cairo_surface_destroy(surface);
+      image_surface_imgid = dev->image_storage.id;
+      break;
+    }
+    dt_pthread_mutex_unlock(mutex);
+  }
   cairo_restore(cri);
 
   if(image_surface_imgid == dev->image_storage.id)
@@ -530,6 +602,9 @@ static void dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
     return;
   }
 
+  // the neighbours of the old image are of no use any more
+  dt_dev_prefetch_cancel(dev);
+
   // get last active plugin, make sure focus out is called:
   gchar *active_plugin = dt_conf_get_string("plugins/darkroom/active");
   dt_iop_request_focus(NULL);
@@ -1794,6 +1869,8 @@ void leave(dt_view_t *self)
     dt_conf_set_string("plugins/darkroom/active", "");
 
   dt_develop_t *dev = (dt_develop_t *)self->data;
+  dt_dev_prefetch_cancel(dev);
+
   // tag image as changed
   // TODO: only tag the image when there was a real change.
   guint tagid = 0;
@@ -1877,6 +1954,9 @@ void mouse_leave(dt_view_t *self)
 
   // reset any changes the selected plugin might have made.
   dt_control_change_cursor(GDK_LEFT_PTR);
+
+  // progressive rendering starts from the center again
+  dev->progressive.pointer_x = dev->progressive.pointer_y = 0.0f;
 }
 
 void mouse_moved(dt_view_t *self, double x, double y, double pressure, int which)
@@ -1903,6 +1983,8 @@ void mouse_moved(dt_view_t *self, double x, double y, double pressure, int which
   int handled = 0;
   x += offx;
   y += offy;
+  dev->progressive.pointer_x = x - .5f * dev->width;
+  dev->progressive.pointer_y = y - .5f * dev->height;
   if(dev->gui_module && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF && ctl->button_down
      && ctl->button_down_which == 1)
   {
@@ -1995,6 +2077,9 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
   if(width_i > capwd) x += (capwd - width_i) * .5f;
   if(height_i > capht) y += (capht - height_i) * .5f;
 
+  // the user is interacting, leave the cpu to the center view
+  dt_dev_prefetch_cancel(dev);
+
   int handled = 0;
   if(dev->gui_module && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF && which == 1)
   {
@@ -2082,6 +2167,8 @@ void scrolled(dt_view_t *self, double x, double y, int up, int state)
   if(width_i > capwd) x += (capwd - width_i) * .5f;
   if(height_i > capht) y += (capht - height_i) * .5f;
 
+  dt_dev_prefetch_cancel(dev);
+
   int handled = 0;
   // masks
   if(dev->form_visible) handled = dt_masks_events_mouse_scrolled(dev->gui_module, x, y, up, state);
@@ -1302,7 +1302,7 @@ static int expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int3
       free(lib->full_res_thumb);
       lib->full_res_thumb = NULL;
       dt_colorspaces_color_profile_type_t color_space;
-      if(!dt_imageio_large_thumbnail(filename, &lib->full_res_thumb,
+      if(!dt_imageio_large_thumbnail(filename, lib->full_preview_id, 0, &lib->full_res_thumb,
                                                &lib->full_res_thumb_wd,
                                                &lib->full_res_thumb_ht,
                                                &color_space)) {
@@ -1569,13 +1569,13 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
   }
 
   mouse_over_id = dt_view_get_image_to_act_on();
+  // this updates the collection (and collected_images, if the rating moved images around)
   if(mouse_over_id <= 0)
     dt_ratings_apply_to_selection(num);
   else
     dt_ratings_apply_to_image(mouse_over_id, num);
-  _update_collected_images(self);
+  dt_control_queue_redraw_center();
 
-  dt_collection_update_query(darktable.collection); // update the counter
   if(lib->collection_count != dt_collection_get_count(darktable.collection))
   {
     // some images disappeared from collection. Selection is now invisible.
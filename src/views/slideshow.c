@@ -147,6 +147,8 @@ static int process_next_image(dt_slideshow_t *d)
   buf.levels = levels;
   buf.bpp = bpp;
   buf.write_image = write_image;
+  // no streaming: the buffer is shown, not written, and it is never larger than the screen
+  buf.write_image_begin = NULL;
   dat.max_width = d->width;
   dat.max_height = d->height;
   dat.style[0] = '\0';